@@ -1,4 +1,9 @@
-/* hashtable.c 
+/* bench/baseline_hashtable.c
+ * The compiler's hashtable as it was before it became a swiss table (and
+ * then DEFINE_MAP), frozen so that bench/hashtable.c can still measure the
+ * maps against it. Only the benchmark is built with it; its hash functions
+ * now live in src/utils/hash.c.
+ *
  * An implementation of a hashtable for generic use. Uses unsigned long as
  * key type and void* as value type. Supports insertion, lookup, and deletion 
  * with ~O(1) time complexity. 
@@ -16,12 +21,19 @@
 
 #include <stdlib.h>
 
-#include "hashtable.h"
+#include "baseline_hashtable.h"
 
 const int HASHENTRY_FREE = 0, HASHENTRY_ACTIVE = 1, HASHENTRY_DELETED = 2;
 
 static void resize(HashTable *table);
 
+/* Allocates a zeroed (all HASHENTRY_FREE) entries array for the table. */
+static HashEntry *allocate_entries(HashTable *table, int size) {
+	if (table->arena != NULL)
+		return arena_calloc(table->arena, size, sizeof(HashEntry));
+	return calloc(size, sizeof(HashEntry));
+}
+
 /* Initializes the hashtable with default values.
  *
  * table - the hashtable to initialize.
@@ -31,8 +43,19 @@ static void resize(HashTable *table);
  *      set to 0 if table should not have a size limit.
  */
 void hashtable_init(HashTable *table, int size, int max_size) {
+	hashtable_init_arena(table, size, max_size, NULL);
+}
+
+/* Initializes the hashtable like hashtable_init, but allocating its entries
+ * from the arena. The table then needs no deinit; its memory is released
+ * along with the arena's.
+ *
+ * arena - the arena to allocate from. NULL allocates from the heap.
+ */
+void hashtable_init_arena(HashTable *table, int size, int max_size, Arena *arena) {
 	if (size > max_size && max_size != 0) size = max_size; // bound size
-	table->entries = calloc(size, sizeof(HashEntry));
+	table->arena = arena;
+	table->entries = allocate_entries(table, size);
 	table->max_size = max_size;
 	table->size = size;
 	table->count = 0;
@@ -44,7 +67,8 @@ void hashtable_init(HashTable *table, int size, int max_size) {
  * table - the hashtable to deinitialize.
  */
 void hashtable_deinit(HashTable *table) {
-	free(table->entries);
+	if (table->arena == NULL)
+		free(table->entries);
 }
 
 /* Adds the key-value pair to the given hashtable.
@@ -59,7 +83,7 @@ void hashtable_deinit(HashTable *table) {
 bool hashtable_add(HashTable *table, unsigned long key, void *value) {
 	// ensure hashtable load factor is not excessive
 	if ((double) table->count / table->size >= 0.5) {
-		if (table->size >= table->max_size) return false;
+		if (table->max_size != 0 && table->size >= table->max_size) return false;
 		resize(table);
 	}
 
@@ -171,20 +195,6 @@ int hashtable_index(HashTable *table, unsigned long key) {
 	return -1;
 }
 
-/* djb2: http://www.cse.yorku.ca/~oz/hash.html
- * by Dan Bernstein
- * Computes hash for a string.
- */
-unsigned long hash_string(char *str) {
-	unsigned long hash = 5381;
-	int c;
-
-	while (c = *str++)
-		hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-
-	return hash;
-}
-
 /* Doubles the size of the table and properly rehashes all entries
  * into the new entry arrays. (does not resize beyond max_size)
  *
@@ -197,7 +207,7 @@ static void resize(HashTable *table) {
 		new_size = table->max_size;
 	}
 
-	HashEntry *new_entries = calloc(new_size, sizeof(HashEntry));
+	HashEntry *new_entries = allocate_entries(table, new_size);
 	HashEntry *old_entries = table->entries;
 	table->entries = new_entries;
 	table->size = new_size;
@@ -207,5 +217,6 @@ static void resize(HashTable *table) {
 		if (old_entries[i].state != HASHENTRY_ACTIVE) continue;
 		hashtable_add(table, old_entries[i].key, old_entries[i].value);
 	}
-	free(old_entries);
+	if (table->arena == NULL)
+		free(old_entries);
 }
@@ -1,12 +1,14 @@
-/* hashtable.h
+/* bench/baseline_hashtable.h
  * author: Andrew Klinge
 */
 
-#ifndef __HASHTABLE_H__
-#define __HASHTABLE_H__
+#ifndef __BASELINE_HASHTABLE_H__
+#define __BASELINE_HASHTABLE_H__
 
 #include <stdbool.h>
 
+#include "utils/arena.h"
+
 // state values for HashEntry
 extern const int HASHENTRY_FREE, HASHENTRY_ALLOCATED, HASHENTRY_DELETED;
 
@@ -24,9 +26,11 @@ typedef struct HashTable {
 	int max_size;
 	int count;
 	int free_count; // number of open entry spots
+	Arena *arena; // where entries are allocated. NULL if from heap
 } HashTable;
 
 void hashtable_init(HashTable *table, int size, int max_size);
+void hashtable_init_arena(HashTable *table, int size, int max_size, Arena *arena);
 void hashtable_deinit(HashTable *table);
 
 bool hashtable_add(HashTable *table, unsigned long key, void *value);
@@ -37,6 +41,4 @@ void *hashtable_remove(HashTable *table, unsigned long key);
 void *hashtable_get(HashTable *table, unsigned long key);
 void *hashtable_get_at(HashTable *table, int index);
 
-unsigned long hash_string(char *str);
-
 #endif 
@@ -0,0 +1,272 @@
+/* bench/compile.c
+ * Benchmark of the compiler over a corpus of sources (see bench/corpus.c).
+ * Times each front-end phase in this process, by running the corpus through
+ * the scanner alone, then the scanner, preprocessor and parser, then also the
+ * optimizer, and taking the differences. Then times the compiler binary compiling the
+ * whole corpus, and reports its peak resident memory. Each time is the best
+ * of a number of rounds. The results are printed as one JSON object, or as
+ * a CSV header and row, so that they can be collected across versions.
+ * usage: compile_bench [--csv] [--rounds N] <compiler> <file1> [file2, ...]
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "scanner.h"
+#include "preprocessor.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "symtable.h"
+#include "token.h"
+#include "source.h"
+#include "version.h"
+#include "utils/interner.h"
+#include "utils/arena.h"
+
+#define ROUNDS 3
+#define BENCH_ARENA_BLOCK_SIZE 65536
+
+// how far through the front end each file is run
+enum phases {
+	PHASE_SCAN,
+	PHASE_PARSE,
+	PHASE_FOLD
+};
+
+struct FrontEnd {
+	Interner interner;
+	Arena arena;
+	struct SymTable symtable;
+	struct Scanner scanner;
+	struct Preprocessor preprocessor;
+	struct Parser parser;
+	int ln; // line number
+	long tokens; // scanned from the file being run
+};
+
+struct Results {
+	long bytes;
+	long tokens;
+	long statements;
+	double scan_seconds;
+	double parse_seconds; // of the preprocessor and parser alone
+	double fold_seconds; // of the optimizer alone
+	double compile_seconds; // of the compiler binary, from start to exit
+	long peak_rss_kb; // of the compiler binary
+};
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/* Reads the next token for the preprocessor from the scanner, counting it
+ * (see TokenReader).
+ */
+static int read_token(void *context, struct Token *token) {
+	struct FrontEnd *front_end = context;
+	int result;
+	do {
+		result = scanner_scan(&front_end->scanner, &front_end->ln, token);
+	} while (result == SCAN_NULL);
+	if (result == SCAN_VALID) front_end->tokens++;
+	return result;
+}
+
+/* Runs the file through the front end up to the phase, counting its bytes,
+ * tokens and statements into results.
+ * Returns: whether successful
+ */
+static bool run_file(struct FrontEnd *front_end, const char *file_name, int phase, struct Results *results) {
+	struct Source source;
+	if (!source_open(&source, file_name)) {
+		fprintf(stderr, "Failed to open file %s\n", file_name);
+		return false;
+	}
+	scanner_set_source(&front_end->scanner, &source);
+	parser_set_source(&front_end->parser, &source);
+	front_end->ln = 1;
+	front_end->tokens = 0;
+	preprocessor_set_source(&front_end->preprocessor, &source, read_token, front_end);
+	results->bytes += source.size;
+
+	bool success = false;
+	while (true) {
+		struct Token token;
+		if (phase == PHASE_SCAN) {
+			if (read_token(front_end, &token) == SCAN_ERROR) break;
+			success = token.id == TOKEN_EOF;
+			if (success) break;
+			continue;
+		}
+		if (preprocessor_next(&front_end->preprocessor, &token) == PREPROCESS_ERROR) break;
+
+		struct Statement statement;
+		int parse_result = parser_parse(&front_end->parser, &front_end->symtable, &token, &statement);
+		if (parse_result == PARSE_ERROR) break;
+		if (token.id == TOKEN_EOF) {
+			success = true;
+			break;
+		}
+		if (parse_result == PARSE_NULL) continue;
+		results->statements++;
+		if (phase == PHASE_FOLD)
+			optimizer_fold(&statement);
+	}
+	results->tokens += front_end->tokens;
+	source_close(&source);
+	symtable_reset(&front_end->symtable);
+	arena_reset(&front_end->arena);
+	if (!success) fprintf(stderr, "Failed to compile %s\n", file_name);
+	return success;
+}
+
+/* Runs every file through the front end up to the phase.
+ * Returns: the fastest round's time in seconds, -1 if a file failed
+ */
+static double time_phase(struct FrontEnd *front_end, char **file_names, int count, int phase, int rounds,
+	struct Results *results) {
+	double best = -1;
+	for (int round = 0; round < rounds; round++) {
+		struct Results counts = { 0 };
+		double start = now();
+		for (int i = 0; i < count; i++) {
+			if (!run_file(front_end, file_names[i], phase, &counts)) return -1;
+		}
+		double seconds = now() - start;
+		if (best < 0 || seconds < best) best = seconds;
+		results->bytes = counts.bytes;
+		results->tokens = counts.tokens;
+		if (phase != PHASE_SCAN) results->statements = counts.statements;
+	}
+	return best;
+}
+
+/* Runs the compiler binary on every file, discarding its output.
+ * Returns: the fastest round's time in seconds, -1 if it failed
+ */
+static double time_compiler(char *compiler, char **file_names, int count, int rounds, long *peak_rss_kb) {
+	char *args[count + 2];
+	args[0] = compiler;
+	memcpy(args + 1, file_names, sizeof(char*) * count);
+	args[count + 1] = NULL;
+
+	double best = -1;
+	for (int round = 0; round < rounds; round++) {
+		double start = now();
+		pid_t pid = fork();
+		if (pid == 0) {
+			int null = open("/dev/null", O_WRONLY);
+			dup2(null, STDOUT_FILENO);
+			execv(compiler, args);
+			_exit(127);
+		}
+		int status;
+		struct rusage usage;
+		if (pid < 0 || wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "Failed to run %s on the corpus\n", compiler);
+			return -1;
+		}
+		double seconds = now() - start;
+		if (best < 0 || seconds < best) best = seconds;
+		if (usage.ru_maxrss > *peak_rss_kb) *peak_rss_kb = usage.ru_maxrss;
+	}
+	return best;
+}
+
+static void print_json(const struct Results *results, int files) {
+	printf("{\n"
+		"\t\"version\": \"%s\",\n"
+		"\t\"files\": %i,\n"
+		"\t\"bytes\": %li,\n"
+		"\t\"tokens\": %li,\n"
+		"\t\"statements\": %li,\n"
+		"\t\"scan_seconds\": %.6f,\n"
+		"\t\"parse_seconds\": %.6f,\n"
+		"\t\"fold_seconds\": %.6f,\n"
+		"\t\"compile_seconds\": %.6f,\n"
+		"\t\"scan_tokens_per_second\": %.0f,\n"
+		"\t\"compile_tokens_per_second\": %.0f,\n"
+		"\t\"compile_statements_per_second\": %.0f,\n"
+		"\t\"peak_rss_kb\": %li\n"
+		"}\n",
+		VERSION, files, results->bytes, results->tokens, results->statements,
+		results->scan_seconds, results->parse_seconds, results->fold_seconds, results->compile_seconds,
+		results->tokens / results->scan_seconds, results->tokens / results->compile_seconds,
+		results->statements / results->compile_seconds, results->peak_rss_kb);
+}
+
+static void print_csv(const struct Results *results, int files) {
+	printf("version,files,bytes,tokens,statements,scan_seconds,parse_seconds,fold_seconds,compile_seconds,"
+		"scan_tokens_per_second,compile_tokens_per_second,compile_statements_per_second,peak_rss_kb\n");
+	printf("%s,%i,%li,%li,%li,%.6f,%.6f,%.6f,%.6f,%.0f,%.0f,%.0f,%li\n",
+		VERSION, files, results->bytes, results->tokens, results->statements,
+		results->scan_seconds, results->parse_seconds, results->fold_seconds, results->compile_seconds,
+		results->tokens / results->scan_seconds, results->tokens / results->compile_seconds,
+		results->statements / results->compile_seconds, results->peak_rss_kb);
+}
+
+int main(int arg_count, char **args) {
+	bool csv = false;
+	int rounds = ROUNDS;
+	int first = 1;
+	while (first < arg_count && args[first][0] == '-') {
+		if (strcmp(args[first], "--csv") == 0) {
+			csv = true;
+		} else if (strcmp(args[first], "--rounds") == 0 && first + 1 < arg_count) {
+			rounds = atoi(args[++first]);
+		} else {
+			break;
+		}
+		first++;
+	}
+	if (arg_count - first < 2 || rounds < 1) {
+		fprintf(stderr, "usage: %s [--csv] [--rounds N] <compiler> <file1> [file2, ...]\n", args[0]);
+		return EXIT_FAILURE;
+	}
+	char *compiler = args[first];
+	char **file_names = args + first + 1;
+	int count = arg_count - first - 1;
+
+	struct FrontEnd front_end;
+	arena_init(&front_end.arena, BENCH_ARENA_BLOCK_SIZE);
+	interner_init(&front_end.interner);
+	token_intern_empty(&front_end.interner);
+	scanner_init(&front_end.scanner, &front_end.interner);
+	preprocessor_init(&front_end.preprocessor, &front_end.interner, &front_end.arena);
+	parser_init(&front_end.parser, &front_end.interner, &front_end.arena);
+	symtable_init(&front_end.symtable);
+
+	struct Results results = { 0 };
+	double scan = time_phase(&front_end, file_names, count, PHASE_SCAN, rounds, &results);
+	double parse = (scan < 0) ? -1 : time_phase(&front_end, file_names, count, PHASE_PARSE, rounds, &results);
+	double fold = (parse < 0) ? -1 : time_phase(&front_end, file_names, count, PHASE_FOLD, rounds, &results);
+	double compile = (fold < 0) ? -1 : time_compiler(compiler, file_names, count, rounds, &results.peak_rss_kb);
+
+	symtable_deinit(&front_end.symtable);
+	parser_deinit(&front_end.parser);
+	preprocessor_deinit(&front_end.preprocessor);
+	interner_deinit(&front_end.interner);
+	arena_deinit(&front_end.arena);
+	if (compile < 0) return EXIT_FAILURE;
+
+	// a phase's time is the difference from the run stopping before it
+	results.scan_seconds = scan;
+	results.parse_seconds = (parse > scan) ? parse - scan : 0;
+	results.fold_seconds = (fold > parse) ? fold - parse : 0;
+	results.compile_seconds = compile;
+	if (csv)
+		print_csv(&results, count);
+	else
+		print_json(&results, count);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,285 @@
+/* bench/corpus.c
+ * Generates a synthetic corpus of C-Slim sources for benchmarking the
+ * compiler: declarations, assignments and prints of int expressions, and
+ * if/else and while blocks nested up to a given depth. Every file compiles.
+ * The same options and seed always generate the same corpus.
+ * usage: gen_corpus <directory> [options], writing corpus_<i>.cslim
+ *   -n <files> ............ number of files (default 16)
+ *   -m <statements> ....... statements per file, counting block statements
+ *                           (default 2000). a module holds at most 65536
+ *                           instructions, so keep it below about 8000
+ *   -d <depth> ............ deepest nesting of blocks (default 4)
+ *   -v <variables> ........ most variables live at once (default 128). the
+ *                           compiler keeps those past its first 192 in
+ *                           globals, so more also measures those
+ *   -i <min>-<max> ........ identifier length range, at least 3 (default 3-16)
+ *   -c <density> .......... fraction of statements preceded by a comment
+ *                           line (default 0.2)
+ *   -f <fan-out> .......... files after it that each file includes, so that
+ *                           the includes never form a cycle (default 2)
+ *   -s <seed> ............. random seed (default 1)
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CORPUS_MAX_IDENT 64
+#define CORPUS_MAX_DEPTH 64
+#define CORPUS_MAX_BLOCK 8 // statements in a block, at most
+
+struct Options {
+	int files;
+	int statements;
+	int depth;
+	int variables; // live at once, at most
+	int ident_min, ident_max;
+	double comments;
+	int fanout;
+	uint64_t seed;
+};
+
+struct Generator {
+	const struct Options *options;
+	FILE *out;
+	uint64_t state; // of the random number generator
+	char (*names)[CORPUS_MAX_IDENT + 1]; // live variables, innermost scope last
+	int var_count;
+	int declared; // variables declared so far in the file, making each name unique
+	int statements_left;
+	int loops; // open while blocks, which a break may leave
+};
+
+/* Returns: the next of a xorshift64* sequence of random numbers */
+static uint64_t next_random(struct Generator *gen) {
+	gen->state ^= gen->state >> 12;
+	gen->state ^= gen->state << 25;
+	gen->state ^= gen->state >> 27;
+	return gen->state * UINT64_C(2685821657736338717);
+}
+
+/* Returns: a random int from 0 to bound - 1 */
+static int random_below(struct Generator *gen, int bound) {
+	return (int) (next_random(gen) % (uint64_t) bound);
+}
+
+static bool chance(struct Generator *gen, double probability) {
+	return (next_random(gen) >> 11) * 0x1.0p-53 < probability;
+}
+
+static void indent(struct Generator *gen, int depth) {
+	for (int i = 0; i < depth; i++) {
+		fputc('\t', gen->out);
+	}
+}
+
+/* Writes a comment line of random words. */
+static void comment(struct Generator *gen, int depth) {
+	indent(gen, depth);
+	fputs("//", gen->out);
+	int words = 3 + random_below(gen, 8);
+	for (int i = 0; i < words; i++) {
+		fputc(' ', gen->out);
+		int length = 1 + random_below(gen, 8);
+		for (int j = 0; j < length; j++) {
+			fputc('a' + random_below(gen, 26), gen->out);
+		}
+	}
+	fputc('\n', gen->out);
+}
+
+/* Stores a new variable name, of a length in the options' range, in name.
+ * Names are unique within the file: they end with `_` and the count of
+ * variables declared before, which no other name's random part contains.
+ */
+static void new_name(struct Generator *gen, char *name) {
+	char suffix[16];
+	int suffix_length = snprintf(suffix, sizeof(suffix), "_%x", gen->declared++);
+	int length = gen->options->ident_min + random_below(gen, gen->options->ident_max - gen->options->ident_min + 1);
+	int random_length = length - suffix_length;
+	if (random_length < 1) random_length = 1;
+	name[0] = 'a' + random_below(gen, 26);
+	for (int i = 1; i < random_length; i++) {
+		int c = random_below(gen, 36);
+		name[i] = (c < 26) ? 'a' + c : '0' + c - 26;
+	}
+	memcpy(name + random_length, suffix, suffix_length + 1);
+}
+
+/* Writes an operand: a live variable or an int literal. */
+static void operand(struct Generator *gen) {
+	if (gen->var_count > 0 && chance(gen, 0.7))
+		fputs(gen->names[random_below(gen, gen->var_count)], gen->out);
+	else
+		fprintf(gen->out, "%i", 1 + random_below(gen, 999)); // never 0, a divisor
+}
+
+/* Writes an int expression of up to operations binary operations. */
+static void expression(struct Generator *gen, int operations) {
+	static const char *operators[] = { "+", "-", "*", "/", "%", "+", "-", "*" };
+	int count = random_below(gen, operations + 1);
+	if (count > 0 && chance(gen, 0.3)) {
+		fputc('(', gen->out);
+		expression(gen, count - 1);
+		fputc(')', gen->out);
+	} else {
+		operand(gen);
+	}
+	for (int i = 0; i < count; i++) {
+		fprintf(gen->out, " %s ", operators[random_below(gen, 8)]);
+		operand(gen);
+	}
+}
+
+/* Writes a comparison of two operands. */
+static void condition(struct Generator *gen) {
+	static const char *comparisons[] = { "<", "<=", ">", ">=", "==", "!=" };
+	operand(gen);
+	fprintf(gen->out, " %s ", comparisons[random_below(gen, 6)]);
+	operand(gen);
+}
+
+static void statement(struct Generator *gen, int depth);
+
+/* Writes the statements of a block, between its braces. */
+static void block(struct Generator *gen, int depth) {
+	int var_count = gen->var_count;
+	fputs(" {\n", gen->out);
+	int count = 1 + random_below(gen, CORPUS_MAX_BLOCK);
+	for (int i = 0; i < count && gen->statements_left > 0; i++) {
+		statement(gen, depth + 1);
+	}
+	indent(gen, depth);
+	fputc('}', gen->out);
+	gen->var_count = var_count; // leave the block's scope
+}
+
+/* Writes a statement, with the statements of its blocks if it opens one. */
+static void statement(struct Generator *gen, int depth) {
+	gen->statements_left--;
+	if (chance(gen, gen->options->comments)) comment(gen, depth);
+	indent(gen, depth);
+
+	int kind = random_below(gen, 20);
+	if (kind < 2 && depth < gen->options->depth) {
+		fputs("if (", gen->out);
+		condition(gen);
+		fputc(')', gen->out);
+		block(gen, depth);
+		if (chance(gen, 0.5) && gen->statements_left > 0) {
+			gen->statements_left--;
+			fputs(" else", gen->out);
+			block(gen, depth);
+		}
+		fputc('\n', gen->out);
+	} else if (kind < 3 && depth < gen->options->depth) {
+		fputs("while (", gen->out);
+		condition(gen);
+		fputc(')', gen->out);
+		gen->loops++;
+		block(gen, depth);
+		gen->loops--;
+		fputc('\n', gen->out);
+	} else if (kind < 4 && gen->loops > 0) {
+		fputs("break;\n", gen->out);
+	} else if (kind < 6) {
+		fputs("print ", gen->out);
+		expression(gen, 3);
+		fputs(";\n", gen->out);
+	} else if (kind < 12 && gen->var_count < gen->options->variables) {
+		char *name = gen->names[gen->var_count];
+		new_name(gen, name);
+		fprintf(gen->out, "int %s = ", name);
+		expression(gen, 3);
+		fputs(";\n", gen->out);
+		gen->var_count++; // in scope after its own initial value
+	} else if (gen->var_count > 0) {
+		fprintf(gen->out, "%s = ", gen->names[random_below(gen, gen->var_count)]);
+		expression(gen, 4);
+		fputs(";\n", gen->out);
+	} else {
+		fprintf(gen->out, "print \"%i\";\n", random_below(gen, 1000));
+	}
+}
+
+/* Writes the file of the corpus with the index.
+ * Returns: whether successful
+ */
+static bool generate_file(const struct Options *options, const char *directory, int index) {
+	char path[strlen(directory) + 32];
+	snprintf(path, sizeof(path), "%s/corpus_%i.cslim", directory, index);
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		fprintf(stderr, "Failed to open file %s\n", path);
+		return false;
+	}
+
+	struct Generator gen;
+	gen.options = options;
+	gen.out = out;
+	gen.state = (options->seed + (uint64_t) index) * UINT64_C(0x9E3779B97F4A7C15) | 1;
+	gen.names = malloc(sizeof(gen.names[0]) * options->variables);
+	gen.var_count = 0;
+	gen.declared = 0;
+	gen.statements_left = options->statements;
+	gen.loops = 0;
+
+	for (int i = 1; i <= options->fanout && index + i < options->files; i++) {
+		fprintf(out, "#include \"corpus_%i.cslim\";\n", index + i);
+	}
+	while (gen.statements_left > 0) {
+		statement(&gen, 0);
+	}
+	free(gen.names);
+	return fclose(out) == 0;
+}
+
+int main(int arg_count, char **args) {
+	struct Options options = { 16, 2000, 4, 128, 3, 16, 0.2, 2, 1 };
+	if (arg_count < 2 || args[1][0] == '-') {
+		fprintf(stderr, "usage: %s <directory> [-n files] [-m statements] [-d depth] "
+			"[-v variables] [-i min-max] [-c density] [-f fan-out] [-s seed]\n", args[0]);
+		return EXIT_FAILURE;
+	}
+	const char *directory = args[1];
+	for (int i = 2; i < arg_count; i++) {
+		const char *option = args[i];
+		const char *value = (i + 1 < arg_count) ? args[++i] : "";
+		if (strcmp(option, "-n") == 0) {
+			options.files = atoi(value);
+		} else if (strcmp(option, "-m") == 0) {
+			options.statements = atoi(value);
+		} else if (strcmp(option, "-d") == 0) {
+			options.depth = atoi(value);
+		} else if (strcmp(option, "-v") == 0) {
+			options.variables = atoi(value);
+		} else if (strcmp(option, "-i") == 0) {
+			if (sscanf(value, "%d-%d", &options.ident_min, &options.ident_max) != 2)
+				options.ident_min = options.ident_max = atoi(value);
+		} else if (strcmp(option, "-c") == 0) {
+			options.comments = atof(value);
+		} else if (strcmp(option, "-f") == 0) {
+			options.fanout = atoi(value);
+		} else if (strcmp(option, "-s") == 0) {
+			options.seed = strtoull(value, NULL, 10);
+		} else {
+			fprintf(stderr, "Unknown option %s\n", option);
+			return EXIT_FAILURE;
+		}
+	}
+	if (options.files < 1 || options.statements < 1 || options.depth < 0 || options.depth > CORPUS_MAX_DEPTH
+		|| options.variables < 1 || options.ident_min < 3 || options.ident_max < options.ident_min || options.ident_max > CORPUS_MAX_IDENT
+		|| options.fanout < 0) {
+		fprintf(stderr, "Invalid options: expected files, statements and variables of at least 1, depth from 0 to %i "
+			"and identifier lengths from 3 to %i\n", CORPUS_MAX_DEPTH, CORPUS_MAX_IDENT);
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < options.files; i++) {
+		if (!generate_file(&options, directory, i)) return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
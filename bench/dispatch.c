@@ -0,0 +1,76 @@
+/* bench/dispatch.c
+ * Microbenchmark of the interpreter's instruction dispatch. Runs a loop of
+ * short integer instructions, where dispatch is most of the work of each, and
+ * reports the time per instruction. Built once per dispatch mode (see
+ * VM_COMPUTED_GOTO in vm.c and the makefile's bench rule) to compare them.
+ * usage: dispatch_<mode> [iterations]
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vm.h"
+
+#ifndef DISPATCH_NAME
+#define DISPATCH_NAME "default"
+#endif
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(int arg_count, char **args) {
+	long iterations = (arg_count > 1) ? atol(args[1]) : 50000000;
+
+	// i = 0; sum = 0; while (i < iterations) { sum = sum + i * 3 - 7; i = i + 1; } print sum
+	enum { I, SUM, N, T };
+	const int loop = 3;
+	const int end = 13;
+	const uint32_t code[] = {
+		INSTRUCTION_BX(OP_INT, I, 0),
+		INSTRUCTION_BX(OP_INT, SUM, 0),
+		INSTRUCTION_BX(OP_CONST, N, 0),
+		INSTRUCTION(OP_LESS_INT, T, I, N), // loop
+		INSTRUCTION_BX(OP_JUMP_IF_FALSE, T, end),
+		INSTRUCTION_BX(OP_INT, T, 3),
+		INSTRUCTION(OP_MUL_INT, T, I, T),
+		INSTRUCTION(OP_ADD_INT, SUM, SUM, T),
+		INSTRUCTION_BX(OP_INT, T, 7),
+		INSTRUCTION(OP_SUB_INT, SUM, SUM, T),
+		INSTRUCTION_BX(OP_INT, T, 1),
+		INSTRUCTION(OP_ADD_INT, I, I, T),
+		INSTRUCTION_AX(OP_JUMP, loop),
+		INSTRUCTION(OP_PRINT_INT, SUM, 0, 0), // end
+		INSTRUCTION(OP_HALT, 0, 0, 0)
+	};
+	const long instructions_per_iteration = end - loop;
+	struct ModuleConstant constants[] = { { .kind = CONSTANT_INT, .int_value = iterations } };
+
+	struct Module module;
+	memset(&module, 0, sizeof(module));
+	module.code = code;
+	module.code_count = sizeof(code) / sizeof(code[0]);
+	module.constants = constants;
+	module.constant_count = 1;
+	module.register_count = T + 1;
+
+	struct VM vm;
+	vm_init(&vm);
+	printf("%-8s sum ", DISPATCH_NAME);
+	fflush(stdout);
+	double start = now();
+	int result = vm_run(&vm, &module);
+	double seconds = now() - start;
+	vm_deinit(&vm);
+	if (result != VM_HALTED) return EXIT_FAILURE;
+
+	long executed = iterations * instructions_per_iteration;
+	printf("%-8s %8.3f ns/instruction %8.1f M instructions/s %8.3f ns/iteration\n", DISPATCH_NAME,
+		seconds * 1e9 / executed, executed / seconds / 1e6, seconds * 1e9 / iterations);
+	return EXIT_SUCCESS;
+}
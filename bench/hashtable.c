@@ -0,0 +1,189 @@
+/* bench/hashtable.c
+ * Microbenchmark of hashtable insert, lookup and remove throughput, with
+ * keys that are small sequential ids (as interned names are) and with keys
+ * that are arbitrary 64-bit hashes. Also reports the longest probe and the
+ * slowest single remove+insert, since latency spikes matter to long-lived
+ * tables as much as throughput does. Measures a DEFINE_MAP instance keyed
+ * by integers, as the compiler's symbol table and constant pools are, next
+ * to the baseline: the hashtable the compiler used before its swiss table
+ * (see baseline_hashtable.c).
+ * usage: hashtable_bench [key_count] [rounds]
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "utils/map.h"
+#include "baseline_hashtable.h"
+
+DEFINE_MAP(BenchMap, benchmap, unsigned long, unsigned long*, map_hash_int, map_int_equal)
+
+enum bench_results {
+	BENCH_INSERT, // Mops/s
+	BENCH_LOOKUP_HIT,
+	BENCH_LOOKUP_MISS,
+	BENCH_REMOVE_INSERT,
+	BENCH_CHURN_P999, // ns per remove+insert
+	BENCH_CHURN_MAX,
+	BENCH_RESULTS_COUNT
+};
+
+static const char *const result_names[BENCH_RESULTS_COUNT][2] = {
+	[BENCH_INSERT] = { "insert", "Mops/s" },
+	[BENCH_LOOKUP_HIT] = { "lookup hit", "Mops/s" },
+	[BENCH_LOOKUP_MISS] = { "lookup miss", "Mops/s" },
+	[BENCH_REMOVE_INSERT] = { "remove+insert", "Mops/s" },
+	[BENCH_CHURN_P999] = { "p99.9 churn op", "ns" },
+	[BENCH_CHURN_MAX] = { "max churn op", "ns" }
+};
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/* Returns: the rate of operations performed since start, in Mops/s */
+static double rate(long operations, double start) {
+	return operations / (now() - start) / 1e6;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double difference = *(const double*) a - *(const double*) b;
+	return (difference > 0) - (difference < 0);
+}
+
+// the operations of each table measured, on a table t
+#define MAP_INIT(t) benchmap_init(t, 8, NULL)
+#define MAP_PUT(t, key, value) benchmap_put(t, key, value)
+#define MAP_GET(t, key) benchmap_get(t, key)
+#define MAP_REMOVE(t, key) benchmap_remove(t, key, NULL)
+#define MAP_DEINIT(t) benchmap_deinit(t)
+#define BASELINE_INIT(t) hashtable_init(t, 8, 0)
+#define BASELINE_PUT(t, key, value) hashtable_add(t, key, value)
+#define BASELINE_GET(t, key) hashtable_get(t, key)
+#define BASELINE_REMOVE(t, key) hashtable_remove(t, key)
+#define BASELINE_DEINIT(t) hashtable_deinit(t)
+
+/* Defines run_<name>, which runs every benchmark on a table of the type
+ * through the operations <OPS>_INIT, _PUT, _GET, _REMOVE and _DEINIT, using
+ * keys[0..count) as present keys and keys[count..2*count) as absent keys,
+ * and stores each result in results. Returns a sum of what was looked up,
+ * so that the lookups are not optimized away.
+ */
+#define DEFINE_RUN(name, Type, OPS) \
+static long run_##name(unsigned long *keys, int count, int rounds, double *results) { \
+	long sink = 0; \
+	/* insert into tables grown from their initial size */ \
+	double start = now(); \
+	for (int r = 0; r < rounds; r++) { \
+		Type table; \
+		OPS##_INIT(&table); \
+		for (int i = 0; i < count; i++) { \
+			OPS##_PUT(&table, keys[i], &keys[i]); \
+		} \
+		sink += table.count; \
+		OPS##_DEINIT(&table); \
+	} \
+	results[BENCH_INSERT] = rate((long) count * rounds, start); \
+\
+	Type table; \
+	OPS##_INIT(&table); \
+	for (int i = 0; i < count; i++) { \
+		OPS##_PUT(&table, keys[i], &keys[i]); \
+	} \
+	start = now(); \
+	for (int r = 0; r < rounds; r++) { \
+		for (int i = 0; i < count; i++) { \
+			sink += OPS##_GET(&table, keys[i]) != NULL; \
+		} \
+	} \
+	results[BENCH_LOOKUP_HIT] = rate((long) count * rounds, start); \
+	start = now(); \
+	for (int r = 0; r < rounds; r++) { \
+		for (int i = count; i < 2 * count; i++) { \
+			sink += OPS##_GET(&table, keys[i]) != NULL; \
+		} \
+	} \
+	results[BENCH_LOOKUP_MISS] = rate((long) count * rounds, start); \
+\
+	/* remove and re-add, as the symbol table does when leaving scopes */ \
+	start = now(); \
+	for (int r = 0; r < rounds; r++) { \
+		for (int i = 0; i < count; i++) { \
+			OPS##_REMOVE(&table, keys[i]); \
+			OPS##_PUT(&table, keys[i], &keys[i]); \
+		} \
+	} \
+	results[BENCH_REMOVE_INSERT] = rate((long) count * rounds, start); \
+\
+	/* time each remove+insert on its own. the 99.9th percentile is reported \
+	   rather than the maximum, which mostly measures preemption */ \
+	double *times = malloc(sizeof(double) * count); \
+	for (int i = 0; i < count; i++) { \
+		double op_start = now(); \
+		OPS##_REMOVE(&table, keys[i]); \
+		OPS##_PUT(&table, keys[i], &keys[i]); \
+		times[i] = now() - op_start; \
+	} \
+	qsort(times, count, sizeof(double), compare_doubles); \
+	results[BENCH_CHURN_P999] = times[count - 1 - count / 1000] * 1e9; \
+	results[BENCH_CHURN_MAX] = times[count - 1] * 1e9; \
+	free(times); \
+	OPS##_DEINIT(&table); \
+	return sink; \
+}
+
+DEFINE_RUN(map, BenchMap, MAP)
+DEFINE_RUN(baseline, HashTable, BASELINE)
+
+/* Runs every benchmark on both tables and prints their results side by side,
+ * with the map's longest probe.
+ * Returns: a sum of what was looked up (see DEFINE_RUN)
+ */
+static long run(const char *keys_name, unsigned long *keys, int count, int rounds) {
+	double baseline[BENCH_RESULTS_COUNT];
+	double map[BENCH_RESULTS_COUNT];
+	long sink = run_baseline(keys, count, rounds, baseline);
+	sink += run_map(keys, count, rounds, map);
+	for (int i = 0; i < BENCH_RESULTS_COUNT; i++) {
+		printf("%-8s %-16s %10.2f %10.2f %s\n", keys_name, result_names[i][0], baseline[i], map[i],
+			result_names[i][1]);
+	}
+
+	BenchMap table;
+	benchmap_init(&table, 8, NULL);
+	for (int i = 0; i < count; i++) {
+		benchmap_put(&table, keys[i], &keys[i]);
+	}
+	printf("%-8s %-16s %10s %10d slots\n", keys_name, "max probe", "-", table.max_probe);
+	benchmap_deinit(&table);
+	return sink;
+}
+
+int main(int arg_count, char **args) {
+	int count = (arg_count > 1) ? atoi(args[1]) : 100000;
+	int rounds = (arg_count > 2) ? atoi(args[2]) : 20;
+
+	printf("%-8s %-16s %10s %10s\n", "keys", "operation", "baseline", "map");
+	unsigned long *keys = malloc(sizeof(unsigned long) * 2 * count);
+	for (int i = 0; i < 2 * count; i++) {
+		keys[i] = i;
+	}
+	long sink = run("ids", keys, count, rounds);
+
+	unsigned long state = 88172645463325252UL;
+	for (int i = 0; i < 2 * count; i++) {
+		// xorshift64
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		keys[i] = state;
+	}
+	sink += run("hashes", keys, count, rounds);
+
+	free(keys);
+	return sink == 0;
+}
@@ -0,0 +1,73 @@
+/* bench/opcode_pairs.c
+ * Profiles the instructions a module dispatches when run: the total, the
+ * dispatches per executed statement, and the most frequent pairs of
+ * consecutive opcodes, which are the candidates for fusing into
+ * superinstructions. Built with VM_PROFILE (see the makefile's bench rule).
+ * The module's own output is discarded.
+ * usage: opcode_pairs <module.csb> [executed statements] [pairs shown]
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+
+#define PAIRS_SHOWN 10
+
+struct Pair {
+	int first, second;
+	uint64_t count;
+};
+
+static int compare_pairs(const void *a, const void *b) {
+	uint64_t count_a = ((const struct Pair*) a)->count;
+	uint64_t count_b = ((const struct Pair*) b)->count;
+	return (count_a < count_b) - (count_a > count_b);
+}
+
+int main(int arg_count, char **args) {
+	if (arg_count < 2) {
+		fprintf(stderr, "usage: %s <module.csb> [executed statements] [pairs shown]\n", args[0]);
+		return EXIT_FAILURE;
+	}
+	long statements = (arg_count > 2) ? atol(args[2]) : 0;
+	int shown = (arg_count > 3) ? atoi(args[3]) : PAIRS_SHOWN;
+
+	struct Module module;
+	if (!module_load(&module, args[1], stderr)) return EXIT_FAILURE;
+	struct VMProfile *profile = calloc(1, sizeof(struct VMProfile));
+	struct VM vm;
+	vm_init(&vm);
+	vm.out = fopen("/dev/null", "w");
+	vm.profile = profile;
+	int result = vm_run(&vm, &module);
+	fclose(vm.out);
+	vm_deinit(&vm);
+	module_unload(&module);
+	if (result != VM_HALTED) {
+		free(profile);
+		return EXIT_FAILURE;
+	}
+
+	printf("%s: %llu dispatches", args[1], (unsigned long long) profile->dispatches);
+	if (statements > 0) printf(", %.3f per statement", (double) profile->dispatches / statements);
+	printf("\n");
+
+	static struct Pair pairs[OPCODES_COUNT * OPCODES_COUNT];
+	int count = 0;
+	for (int first = 0; first < OPCODES_COUNT; first++) {
+		for (int second = 0; second < OPCODES_COUNT; second++) {
+			if (profile->pairs[first][second] == 0) continue;
+			pairs[count++] = (struct Pair) { first, second, profile->pairs[first][second] };
+		}
+	}
+	qsort(pairs, count, sizeof(struct Pair), compare_pairs);
+	for (int i = 0; i < count && i < shown; i++) {
+		printf("  %5.1f%%  %-28s %s\n", 100.0 * pairs[i].count / profile->dispatches,
+			opcode_names[pairs[i].first], opcode_names[pairs[i].second]);
+	}
+	free(profile);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+/* build_cache.c
+ * Keeps what compiling each source produced in a cache directory, so that
+ * compiling an unchanged source again only hashes it and loads its cache
+ * file. A source's key is the 128-bit hash of its text, with the hash of its
+ * file's name and the compiler's version and options: a module depends on
+ * nothing else, as the files a source includes are imported when its module
+ * is loaded, not compiled into it. The hashes are the same on every machine
+ * and are stored in the cache file as well as naming it, so that a file is
+ * only taken for the source it was compiled from. A source's includes are
+ * cached with it to be resolved again, which compiles them (or finds them in
+ * the cache) in turn. A cache file is written to a temporary file that is
+ * renamed over it, so a cache file is either complete or missing even while
+ * compilers share the directory.
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "build_cache.h"
+#include "version.h"
+
+/* the start of a cache file. The parts of its entry follow, in order. */
+struct CacheHeader {
+	char magic[4]; // BUILD_CACHE_MAGIC
+	uint32_t version; // BUILD_CACHE_VERSION
+	uint64_t source_size; // of the source the entry was compiled from
+	struct Hash128 source_hash; // the key of the source the entry was compiled from
+	struct Hash128 context_hash;
+	uint32_t success;
+	uint32_t includes_size;
+	uint32_t out_size;
+	uint32_t err_size;
+	uint32_t module_size;
+	uint32_t padding;
+};
+
+/* Opens the cache in the directory, creating the directory if need be.
+ * Returns: whether successful (errors are reported to err)
+ *
+ * options - the compiler options that change what it compiles to
+ */
+bool build_cache_open(struct BuildCache *cache, const char *directory, const char *options, FILE *err) {
+	if (mkdir(directory, 0777) != 0 && errno != EEXIST) {
+		fprintf(err, "Failed to create cache directory %s\n", directory);
+		return false;
+	}
+	cache->directory = directory;
+	snprintf(cache->options, sizeof(cache->options), "%s %s", VERSION, options);
+	atomic_init(&cache->hits, 0);
+	atomic_init(&cache->misses, 0);
+	return true;
+}
+
+/* Computes the key of the file's source. The file's name is part of the key
+ * as errors name the file.
+ */
+void build_cache_key(struct BuildCache *cache, const char *file_name, const struct Source *source,
+	struct CacheKey *key) {
+	key->source = hash_bytes_128(source->data, source->size, 0);
+	// the options and the name, each null-terminated so that no two pairs are the same text
+	size_t options_size = strlen(cache->options) + 1;
+	size_t name_size = strlen(file_name) + 1;
+	char context[options_size + name_size];
+	memcpy(context, cache->options, options_size);
+	memcpy(context + options_size, file_name, name_size);
+	key->context = hash_bytes_128(context, options_size + name_size, 0);
+	sprintf(key->name, "%016llx%016llx%016llx%016llx",
+		(unsigned long long) key->source.high, (unsigned long long) key->source.low,
+		(unsigned long long) key->context.high, (unsigned long long) key->context.low);
+}
+
+/* Writes the path of the key's cache file to path, with room for
+ * strlen(cache->directory) + BUILD_CACHE_KEY_LENGTH + 2 chars.
+ */
+static void entry_path(struct BuildCache *cache, const struct CacheKey *key, char *path) {
+	sprintf(path, "%s/%s", cache->directory, key->name);
+}
+
+static bool hashes_equal(struct Hash128 a, struct Hash128 b) {
+	return a.low == b.low && a.high == b.high;
+}
+
+/* Loads the entry of the key from the cache, counting a hit or a miss.
+ * Returns: whether found. If so, build_cache_release must release the entry
+ *
+ * source_size - of the source with the key, which the entry must match
+ */
+bool build_cache_load(struct BuildCache *cache, const struct CacheKey *key, size_t source_size,
+	struct CacheEntry *entry) {
+	char path[strlen(cache->directory) + BUILD_CACHE_KEY_LENGTH + 2];
+	entry_path(cache, key, path);
+	if (!source_open(&entry->file, path)) {
+		atomic_fetch_add(&cache->misses, 1);
+		return false;
+	}
+
+	struct CacheHeader header;
+	bool valid = entry->file.size >= sizeof(header);
+	if (valid) {
+		memcpy(&header, entry->file.data, sizeof(header));
+		valid = memcmp(header.magic, BUILD_CACHE_MAGIC, 4) == 0 && header.version == BUILD_CACHE_VERSION
+			&& header.source_size == source_size
+			&& hashes_equal(header.source_hash, key->source) && hashes_equal(header.context_hash, key->context)
+			&& entry->file.size == sizeof(header) + (size_t) header.includes_size + header.out_size
+				+ header.err_size + header.module_size;
+	}
+	if (!valid) {
+		// written by another version or on a machine of other byte order, or cut short
+		source_close(&entry->file);
+		atomic_fetch_add(&cache->misses, 1);
+		return false;
+	}
+	entry->success = header.success;
+	entry->includes = entry->file.data + sizeof(header);
+	entry->includes_size = header.includes_size;
+	entry->out = entry->includes + entry->includes_size;
+	entry->out_size = header.out_size;
+	entry->err = entry->out + entry->out_size;
+	entry->err_size = header.err_size;
+	entry->module = entry->err + entry->err_size;
+	entry->module_size = header.module_size;
+	atomic_fetch_add(&cache->hits, 1);
+	return true;
+}
+
+/* Frees an entry loaded from the cache. Does NOT free the entry. */
+void build_cache_release(struct CacheEntry *entry) {
+	source_close(&entry->file);
+}
+
+/* Stores the entry as the key's, replacing any entry it had.
+ * Returns: whether successful
+ *
+ * source_size - of the source with the key
+ */
+bool build_cache_store(struct BuildCache *cache, const struct CacheKey *key, size_t source_size,
+	const struct CacheEntry *entry) {
+	char temp_path[strlen(cache->directory) + sizeof("/.tmp-XXXXXX")];
+	sprintf(temp_path, "%s/.tmp-XXXXXX", cache->directory);
+	int fd = mkstemp(temp_path);
+	if (fd < 0) return false;
+	fchmod(fd, 0644); // readable by others sharing the cache, as mkstemp makes it private
+	FILE *file = fdopen(fd, "wb");
+	if (file == NULL) {
+		close(fd);
+		remove(temp_path);
+		return false;
+	}
+
+	struct CacheHeader header = { BUILD_CACHE_MAGIC, BUILD_CACHE_VERSION, source_size, key->source, key->context,
+		entry->success, entry->includes_size, entry->out_size, entry->err_size, entry->module_size, 0 };
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(entry->includes, sizeof(char), entry->includes_size, file) == entry->includes_size
+		&& fwrite(entry->out, sizeof(char), entry->out_size, file) == entry->out_size
+		&& fwrite(entry->err, sizeof(char), entry->err_size, file) == entry->err_size
+		&& fwrite(entry->module, sizeof(char), entry->module_size, file) == entry->module_size;
+	if (fclose(file) != 0) written = false;
+
+	char path[strlen(cache->directory) + BUILD_CACHE_KEY_LENGTH + 2];
+	entry_path(cache, key, path);
+	if (!written || rename(temp_path, path) != 0) {
+		remove(temp_path);
+		return false;
+	}
+	return true;
+}
+
+/* Appends an include statement to the includes of an entry being written. */
+void build_cache_record_include(FILE *includes, const char *path, int ln) {
+	struct CachedInclude include = { ln, strlen(path) + 1 };
+	fwrite(&include, sizeof(include), 1, includes);
+	fwrite(path, sizeof(char), include.size, includes);
+}
+
+/* Reads the entry's include statement at offset, and moves offset past it.
+ * Returns: the path included, NULL after the last include
+ *
+ * ln - where to store the line of the include statement
+ */
+const char *build_cache_next_include(const struct CacheEntry *entry, size_t *offset, int *ln) {
+	struct CachedInclude include;
+	if (*offset + sizeof(include) > entry->includes_size) return NULL;
+	memcpy(&include, entry->includes + *offset, sizeof(include));
+	const char *path = entry->includes + *offset + sizeof(include);
+	if (include.size == 0 || *offset + sizeof(include) + include.size > entry->includes_size
+		|| path[include.size - 1] != '\0')
+		return NULL;
+	*offset += sizeof(include) + include.size;
+	*ln = include.ln;
+	return path;
+}
+
+/* Prints how many files were found in the cache and how many were not. */
+void build_cache_print_stats(struct BuildCache *cache, FILE *out) {
+	fprintf(out, "Build cache %s: %i hits, %i misses\n", cache->directory,
+		atomic_load(&cache->hits), atomic_load(&cache->misses));
+}
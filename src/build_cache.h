@@ -0,0 +1,78 @@
+/* build_cache.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __BUILD_CACHE_H__
+#define __BUILD_CACHE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "source.h"
+#include "utils/hash.h"
+
+#define BUILD_CACHE_MAGIC "CSBC"
+#define BUILD_CACHE_VERSION 2
+#define BUILD_CACHE_KEY_LENGTH 64 // hex digits of a key's name
+#define BUILD_CACHE_MAX_OPTIONS 64 // chars of the compiler's version and options
+
+/* what compiling a source produced, as stored in the cache: its includes,
+ * to be resolved again, its output and errors, and its module if it
+ * compiled. Each part is bytes of one cache file, in this order.
+ */
+struct CacheEntry {
+	bool success;
+	const char *includes; // CachedIncludes, each followed by its path
+	size_t includes_size;
+	const char *out;
+	size_t out_size;
+	const char *err;
+	size_t err_size;
+	const char *module;
+	size_t module_size;
+	struct Source file; // the cache file, when loaded from the cache
+};
+
+/* an include statement of a cached source. Its null-terminated path follows. */
+struct CachedInclude {
+	uint32_t ln;
+	uint32_t size; // of the path, counting its null terminator
+};
+
+/* what identifies a compile of a source: the source's text, and what else
+ * the compile's output depends on.
+ */
+struct CacheKey {
+	struct Hash128 source; // of the source's text
+	struct Hash128 context; // of the file's name and the compiler's version and options
+	char name[BUILD_CACHE_KEY_LENGTH + 1]; // of the cache file: both hashes, in hex
+};
+
+/* a directory of files compiled before, each named by the key of its source
+ * (see build_cache_key). Threads may share the cache, as may processes.
+ */
+struct BuildCache {
+	const char *directory;
+	char options[BUILD_CACHE_MAX_OPTIONS]; // the compiler's version and the options that change its output
+	atomic_int hits;
+	atomic_int misses;
+};
+
+bool build_cache_open(struct BuildCache *cache, const char *directory, const char *options, FILE *err);
+
+void build_cache_key(struct BuildCache *cache, const char *file_name, const struct Source *source,
+	struct CacheKey *key);
+bool build_cache_load(struct BuildCache *cache, const struct CacheKey *key, size_t source_size,
+	struct CacheEntry *entry);
+void build_cache_release(struct CacheEntry *entry);
+bool build_cache_store(struct BuildCache *cache, const struct CacheKey *key, size_t source_size,
+	const struct CacheEntry *entry);
+
+void build_cache_record_include(FILE *includes, const char *path, int ln);
+const char *build_cache_next_include(const struct CacheEntry *entry, size_t *offset, int *ln);
+
+void build_cache_print_stats(struct BuildCache *cache, FILE *out);
+
+#endif
@@ -7,77 +7,885 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "compiler.h"
+#include "optimizer.h"
+#include "peephole.h"
 #include "token.h"
+#include "source.h"
+#include "version.h"
+#include "utils/ring.h"
+#include "trace.h"
+#include "utils/stats.h"
 
-// enables all debugging output
-#define DEBUG_ALL 1
-// enables specific debugging output
-#define DEBUG_TOKENS 0
-#define DEBUG_STATEMENTS 0
+#define COMPILER_ARENA_BLOCK_SIZE 65536
+#define COMPILER_BLOCKS_INITIAL_SIZE 16
 
-#define VERSION "0.2.3"
+#define PIPELINE_RING_SIZE 4096 // tokens the scanning thread may be ahead of the parser
+#define PIPELINE_BATCH_SIZE 64 // tokens passed through the ring at once
+
+#define TRACE_PATH "cslim.trace" // default trace file
+
+// variables in frame slots below this have a register, and the registers
+// above them hold temporaries. variables in the slots from it on are globals
+#define COMPILER_VARIABLE_REGISTERS 192
 
 void compiler_init(struct Compiler *compiler) {
-	scanner_init(&compiler->scanner);
-	parser_init(&compiler->parser);
+	arena_init(&compiler->arena, COMPILER_ARENA_BLOCK_SIZE);
+	interner_init(&compiler->interner);
+	token_intern_empty(&compiler->interner);
+	scanner_init(&compiler->scanner, &compiler->interner);
+	preprocessor_init(&compiler->preprocessor, &compiler->interner, &compiler->arena);
+	parser_init(&compiler->parser, &compiler->interner, &compiler->arena);
 	symtable_init(&compiler->symtable);
+	module_writer_init(&compiler->writer, &compiler->interner);
+	blockvec_init(&compiler->blocks, COMPILER_BLOCKS_INITIAL_SIZE);
+	indexvec_init(&compiler->breaks, COMPILER_BLOCKS_INITIAL_SIZE);
+	compiler->optimize = 2;
+	compiler->fence = 0;
+	compiler->pipeline = false;
+	compiler->includes = NULL;
+	compiler->file = -1;
+	compiler->cache = NULL;
+	compiler->included = NULL;
+	compiler->cacheable = false;
+	compiler_set_output(compiler, stdout, stderr);
 }
 
-/* Compiles the file with the given file path to bytecode at the output path.
- * Returns: whether successful.
+/* Frees a Compiler's resources. Does NOT free the compiler. */
+void compiler_deinit(struct Compiler *compiler) {
+	indexvec_deinit(&compiler->breaks);
+	blockvec_deinit(&compiler->blocks);
+	module_writer_deinit(&compiler->writer);
+	symtable_deinit(&compiler->symtable);
+	parser_deinit(&compiler->parser);
+	preprocessor_deinit(&compiler->preprocessor);
+	interner_deinit(&compiler->interner);
+	arena_deinit(&compiler->arena);
+}
+
+/* Sets where the compiler and its stages write output. */
+void compiler_set_output(struct Compiler *compiler, FILE *out, FILE *err) {
+	compiler->out = out;
+	compiler->err = err;
+	compiler->scanner.err = err;
+	compiler->preprocessor.err = err;
+	compiler->parser.err = err;
+}
+
+// instruction of each operation, by the type of its operands: { int, float }
+static const int operation_ops[][2] = {
+	[EXPR_NEG] = { OP_NEG_INT, OP_NEG_FLOAT },
+	[EXPR_NOT] = { OP_NOT, OP_NOT },
+	[EXPR_INT_TO_FLOAT] = { OP_INT_TO_FLOAT, OP_INT_TO_FLOAT },
+	[EXPR_ADD] = { OP_ADD_INT, OP_ADD_FLOAT },
+	[EXPR_SUB] = { OP_SUB_INT, OP_SUB_FLOAT },
+	[EXPR_MUL] = { OP_MUL_INT, OP_MUL_FLOAT },
+	[EXPR_DIV] = { OP_DIV_INT, OP_DIV_FLOAT },
+	[EXPR_MOD] = { OP_MOD_INT, OP_MOD_INT },
+	[EXPR_LESS] = { OP_LESS_INT, OP_LESS_FLOAT },
+	[EXPR_LESS_EQUAL] = { OP_LESS_EQUAL_INT, OP_LESS_EQUAL_FLOAT },
+	[EXPR_EQUAL] = { OP_EQUAL_INT, OP_EQUAL_FLOAT },
+	[EXPR_NOT_EQUAL] = { OP_NOT_EQUAL_INT, OP_NOT_EQUAL_FLOAT },
+	[EXPR_SHL] = { OP_SHL_INT, OP_SHL_INT },
+	[EXPR_DIV_POW2] = { OP_DIV_POW2_INT, OP_DIV_POW2_INT },
+	[EXPR_MOD_POW2] = { OP_MOD_POW2_INT, OP_MOD_POW2_INT }
+};
+
+static const int print_ops[] = {
+	[TYPE_INT] = OP_PRINT_INT,
+	[TYPE_FLOAT] = OP_PRINT_FLOAT,
+	[TYPE_STRING] = OP_PRINT_STRING
+};
+
+// kind of the values of a global, by the type of its variable
+static const int global_kinds[] = {
+	[TYPE_INT] = CONSTANT_INT,
+	[TYPE_FLOAT] = CONSTANT_FLOAT,
+	[TYPE_STRING] = CONSTANT_STRING
+};
+
+/* Returns: the first register holding temporaries, above every visible
+ * variable's register
+ */
+static inline int first_temp(const struct Compiler *compiler) {
+	int slots = compiler->symtable.slot_count;
+	return (slots < COMPILER_VARIABLE_REGISTERS) ? slots : COMPILER_VARIABLE_REGISTERS;
+}
+
+/* Returns: index of the global holding a variable without a register, -1 if
+ * the module has too many
+ */
+static int variable_global(struct Compiler *compiler, const Sym *sym) {
+	return module_writer_global(&compiler->writer, sym->slot - COMPILER_VARIABLE_REGISTERS,
+		global_kinds[(int) sym->type]);
+}
+
+/* Appends the instruction to the module's code, fusing it with the ones
+ * before it when fully optimizing (see peephole_emit).
+ * Returns: index of the instruction, -1 if the code is full
+ */
+static int emit(struct Compiler *compiler, uint32_t instruction) {
+	if (compiler->optimize < 2) return module_writer_emit(&compiler->writer, instruction);
+	return peephole_emit(&compiler->writer, instruction, compiler->fence, first_temp(compiler));
+}
+
+/* Generates code computing the expression into a register. A variable with
+ * a register is already in it, so it needs no code; anything else, including
+ * a global's value, is computed into target, with intermediate values in
+ * registers from temps on.
+ * Returns: register holding the value, -1 if the module ran out of
+ * registers, globals, constants or instructions
+ */
+static int generate_expression(struct Compiler *compiler, const struct Expr *nodes, ExprId id, int target, int temps) {
+	struct ModuleWriter *writer = &compiler->writer;
+	const struct Expr *expr = &nodes[id];
+	if (target >= MODULE_MAX_REGISTERS || temps >= MODULE_MAX_REGISTERS) return -1;
+	int constant;
+	switch (expr->id) {
+	case EXPR_VAR: {
+		if (expr->sym->slot < COMPILER_VARIABLE_REGISTERS) return expr->sym->slot;
+		int global = variable_global(compiler, expr->sym);
+		if (global == -1) return -1;
+		return (emit(compiler, INSTRUCTION_BX(OP_GET_GLOBAL, target, global)) != -1) ? target : -1;
+	}
+	case EXPR_INT:
+		if (expr->int_value >= MODULE_MIN_IMMEDIATE && expr->int_value <= MODULE_MAX_IMMEDIATE)
+			return (emit(compiler, INSTRUCTION_BX(OP_INT, target, expr->int_value)) != -1) ? target : -1;
+		constant = module_writer_int(writer, expr->int_value);
+		break;
+	case EXPR_FLOAT:
+		constant = module_writer_float(writer, expr->float_value);
+		break;
+	case EXPR_STRING:
+		constant = module_writer_string(writer, expr->string);
+		break;
+	case EXPR_NEG:
+	case EXPR_NOT:
+	case EXPR_INT_TO_FLOAT: {
+		// nothing reads target after the operand, so it can be computed there
+		int operand = generate_expression(compiler, nodes, expr->left, target, temps);
+		if (operand == -1) return -1;
+		int op = operation_ops[(int) expr->id][nodes[expr->left].type == TYPE_FLOAT];
+		return (emit(compiler, INSTRUCTION(op, target, operand, 0)) != -1) ? target : -1;
+	}
+	case EXPR_SHL:
+	case EXPR_DIV_POW2:
+	case EXPR_MOD_POW2: {
+		// the right operand is the shift itself
+		int operand = generate_expression(compiler, nodes, expr->left, target, temps);
+		if (operand == -1) return -1;
+		int op = operation_ops[(int) expr->id][0];
+		return (emit(compiler, INSTRUCTION(op, target, operand, nodes[expr->right].int_value)) != -1) ? target : -1;
+	}
+	default: {
+		// target may be a variable the right operand reads, so the left is
+		// computed into a temporary instead
+		int left = generate_expression(compiler, nodes, expr->left, temps, temps + 1);
+		if (left == -1) return -1;
+		int right_temps = (left == temps) ? temps + 1 : temps;
+		int right = generate_expression(compiler, nodes, expr->right, right_temps, right_temps + 1);
+		if (right == -1) return -1;
+		int op = operation_ops[(int) expr->id][nodes[expr->left].type == TYPE_FLOAT];
+		return (emit(compiler, INSTRUCTION(op, target, left, right)) != -1) ? target : -1;
+	}
+	}
+	if (constant == -1) return -1;
+	return (emit(compiler, INSTRUCTION_BX(OP_CONST, target, constant)) != -1) ? target : -1;
+}
+
+/* Generates code storing the value of the statement's expression in its
+ * variable: in its register, or from a temporary into its global.
+ */
+static bool generate_store(struct Compiler *compiler, const struct Statement *statement) {
+	const Sym *sym = statement->sym;
+	int temps = first_temp(compiler);
+	if (sym->slot >= COMPILER_VARIABLE_REGISTERS) {
+		int global = variable_global(compiler, sym);
+		if (global == -1) return false;
+		int value = generate_expression(compiler, statement->nodes, statement->expr, temps, temps + 1);
+		return value != -1 && emit(compiler, INSTRUCTION_BX(OP_SET_GLOBAL, value, global)) != -1;
+	}
+	int value = generate_expression(compiler, statement->nodes, statement->expr, sym->slot, temps);
+	if (value == -1) return false;
+	return value == sym->slot
+		|| emit(compiler, INSTRUCTION(OP_MOVE, sym->slot, value, 0)) != -1;
+}
+
+/* Generates the start of the block opened by an IF, ELSE or WHILE statement:
+ * the test of its condition, jumping past the block if it is false. When
+ * optimizing, a constant condition needs no test, and no code is generated
+ * for a block that never runs.
+ * Returns: whether succeeded
+ *
+ * dead - whether the code around the block never runs
+ */
+static bool open_block(struct Compiler *compiler, const struct Statement *statement, bool dead) {
+	struct ModuleWriter *writer = &compiler->writer;
+	struct Block block = {
+		.kind = statement->id,
+		.start = writer->code.count,
+		.exit = -1,
+		.breaks = compiler->breaks.count,
+		.dead = dead,
+		.always = false
+	};
+	compiler->fence = writer->code.count; // a loop jumps back to its start
+	bool value;
+	if (statement->id == STATEMENT_ELSE) {
+		// runs exactly when the block of the IF before it did not
+		const struct Block *taken = &compiler->closed;
+		block.dead = dead || taken->always;
+		if (!block.dead && !taken->dead) {
+			// the IF's block ends by jumping past this one instead
+			block.exit = emit(compiler, INSTRUCTION_AX(OP_JUMP, 0));
+			if (block.exit == -1) return false;
+			module_writer_patch(writer, taken->exit, writer->code.count);
+			compiler->fence = writer->code.count;
+		}
+	} else if (dead) {
+		// generates nothing
+	} else if (compiler->optimize && optimizer_constant_condition(statement, &value)) {
+		block.dead = !value;
+		block.always = value;
+	} else {
+		int temps = first_temp(compiler);
+		int condition = generate_expression(compiler, statement->nodes, statement->expr, temps, temps + 1);
+		if (condition == -1) return false;
+		block.exit = emit(compiler, INSTRUCTION_BX(OP_JUMP_IF_FALSE, condition, 0));
+		if (block.exit == -1) return false;
+	}
+	blockvec_push(&compiler->blocks, block);
+	return true;
+}
+
+/* Generates the end of the innermost block: a loop jumps back to its
+ * condition, and jumps past the block land after it.
+ * Returns: whether succeeded
+ */
+static bool close_block(struct Compiler *compiler) {
+	struct ModuleWriter *writer = &compiler->writer;
+	struct Block block = blockvec_pop(&compiler->blocks);
+	if (block.kind == STATEMENT_WHILE) {
+		if (!block.dead && emit(compiler, INSTRUCTION_AX(OP_JUMP, block.start)) == -1) return false;
+		for (int i = block.breaks; i < compiler->breaks.count; i++) {
+			module_writer_patch(writer, compiler->breaks.items[i], writer->code.count);
+		}
+		compiler->breaks.count = block.breaks;
+	}
+	if (block.exit != -1) module_writer_patch(writer, block.exit, writer->code.count);
+	compiler->closed = block;
+	compiler->fence = writer->code.count;
+	return true;
+}
+
+/* Generates a break: out of the innermost loop, or out of the module if it
+ * is in none.
+ * Returns: whether succeeded
+ */
+static bool generate_break(struct Compiler *compiler) {
+	for (int i = compiler->blocks.count - 1; i >= 0; i--) {
+		if (compiler->blocks.items[i].kind != STATEMENT_WHILE) continue;
+		int jump = emit(compiler, INSTRUCTION_AX(OP_JUMP, 0));
+		if (jump == -1) return false;
+		indexvec_push(&compiler->breaks, jump);
+		return true;
+	}
+	return emit(compiler, INSTRUCTION(OP_BREAK, 0, 0, 0)) != -1;
+}
+
+/* Generates the code of a statement into the compiler's module. Variables
+ * live in the frame slots the symbol table gave them, in registers up to
+ * COMPILER_VARIABLE_REGISTERS and in globals from there on, and registers
+ * above the registers of visible variables hold intermediate values.
+ * Returns: whether succeeded (fails only if the module is too large, see
+ * exceeded_limit)
+ */
+static bool generate(struct Compiler *compiler, const struct Statement *statement) {
+	struct ModuleWriter *writer = &compiler->writer;
+	bool dead = compiler->blocks.count > 0 && compiler->blocks.items[compiler->blocks.count - 1].dead;
+	switch (statement->id) {
+	case STATEMENT_IF:
+	case STATEMENT_ELSE:
+	case STATEMENT_WHILE:
+		return open_block(compiler, statement, dead);
+	case STATEMENT_END:
+		return close_block(compiler);
+	case STATEMENT_INCLUDE:
+		return module_writer_import(writer, statement->args[0]);
+	}
+	if (dead) return true;
+
+	switch (statement->id) {
+	case STATEMENT_BREAK:
+		return generate_break(compiler);
+	case STATEMENT_BREAK_LABEL: {
+		int label = module_writer_string(writer, statement->args[0]);
+		return label != -1 && emit(compiler, INSTRUCTION_AX(OP_BREAK_LABEL, label)) != -1;
+	}
+	case STATEMENT_VAR_DECL:
+	case STATEMENT_ASSIGN:
+		return generate_store(compiler, statement);
+	case STATEMENT_PRINT: {
+		int temps = first_temp(compiler);
+		int value = generate_expression(compiler, statement->nodes, statement->expr, temps, temps + 1);
+		return value != -1 && emit(compiler,
+			INSTRUCTION(print_ops[(int) statement->nodes[statement->expr].type], value, 0, 0)) != -1;
+	}
+	default:
+		return true;
+	}
+}
+
+/* Returns: what the module ran out of when generating a statement failed */
+static const char *exceeded_limit(const struct Compiler *compiler) {
+	const struct ModuleWriter *writer = &compiler->writer;
+	if (writer->code.count >= MODULE_MAX_CODE) return "instructions";
+	if (writer->constants.count >= MODULE_MAX_CONSTANTS) return "constants";
+	if (writer->globals.count >= MODULE_MAX_GLOBALS) return "globals";
+	return "registers for the values of an expression";
+}
+
+/* Writes the compiler's module to the file at path.
+ * Returns: whether succeeded
  */
-bool compiler_compile(struct Compiler *compiler, char *file_name) {
-	FILE *file = fopen(file_name, "r");
+static bool write_module(struct Compiler *compiler, const char *path) {
+	FILE *file = fopen(path, "wb");
 	if (file == NULL) {
-		fprintf(stderr, "Failed to open file %s\n", file_name);
+		fprintf(compiler->err, "Failed to open output file %s\n", path);
+		compiler->cacheable = false;
+		return false;
+	}
+	bool written = module_writer_write(&compiler->writer, file);
+	if (fclose(file) != 0) written = false;
+	if (!written) {
+		fprintf(compiler->err, "Failed to write output file %s\n", path);
+		remove(path);
+		compiler->cacheable = false;
 		return false;
 	}
 
+	if (trace_flags & TRACE_MODULES) {
+		struct Module module;
+		if (!module_load(&module, path, compiler->err)) return false;
+		module_print(&module, compiler->out);
+		module_unload(&module);
+	}
+	return true;
+}
+
+/* a result of scanner_scan, passed from the scanning thread of a pipelined
+ * compile to the parser.
+ */
+struct Scan {
+	int result; // enum scan_code, never SCAN_NULL
+	int ln; // line number the scanner was at after scanning the token
+	struct Token token;
+};
+
+DEFINE_RING(ScanRing, scanring, struct Scan)
+
+/* scans a file on a thread of its own, ahead of the parser consuming its
+ * tokens. The scanner's error messages are held back until the parser
+ * reaches the error, so that they are reported after the parser's output
+ * for the tokens before it, and not at all if the parser stops first.
+ */
+struct Pipeline {
+	struct Scanner *scanner; // used only by the scanning thread until it stops
+	ScanRing ring;
+	atomic_bool cancelled; // set once the parser stops, to stop the scanning thread
+	FILE *err; // where the scanning thread reports errors, into err_text
+	FILE *scanner_err; // where the scanner reported errors before
+	char *err_text;
+	size_t err_size;
+	struct Scan batch[PIPELINE_BATCH_SIZE]; // popped from the ring, not yet parsed
+	int batch_count;
+	int batch_next; // index in batch of the next scan to parse
+	pthread_t thread;
+};
+
+/* Scanning thread. Scans the whole source unless cancelled, pushing each
+ * batch of scans into the ring once it is full or the source has ended.
+ * Its stats are merged once it ends.
+ */
+static void *scan_ahead(void *arg) {
+	struct Pipeline *pipeline = arg;
+	struct Scan batch[PIPELINE_BATCH_SIZE];
+	int count = 0;
 	int ln = 1; // line number
+	bool done = false;
+	STATS_PHASE(STATS_PHASE_SCAN);
+	while (!done) {
+		struct Scan *scan = &batch[count];
+		scan->result = scanner_scan(pipeline->scanner, &ln, &scan->token);
+		if (scan->result == SCAN_NULL) continue;
+		scan->ln = ln;
+		count++;
+		done = scan->result == SCAN_ERROR || scan->token.id == TOKEN_EOF;
+		if (count < PIPELINE_BATCH_SIZE && !done) continue;
+
+		// the error's message is in err_text by the time its scan is popped
+		if (scan->result == SCAN_ERROR) fflush(pipeline->err);
+		int pushed = 0;
+		while (pushed < count && !atomic_load_explicit(&pipeline->cancelled, memory_order_relaxed)) {
+			int batch_pushed = scanring_push(&pipeline->ring, batch + pushed, count - pushed);
+			if (batch_pushed == 0) sched_yield(); // full, wait for the parser
+			pushed += batch_pushed;
+		}
+		if (pushed < count) break; // cancelled
+		count = 0;
+	}
+	stats_merge();
+	return NULL;
+}
+
+/* Starts scanning the scanner's source on a new thread. */
+static void pipeline_start(struct Pipeline *pipeline, struct Scanner *scanner) {
+	pipeline->scanner = scanner;
+	scanring_init(&pipeline->ring, PIPELINE_RING_SIZE);
+	atomic_init(&pipeline->cancelled, false);
+	pipeline->err = open_memstream(&pipeline->err_text, &pipeline->err_size);
+	pipeline->scanner_err = scanner->err;
+	scanner->err = pipeline->err;
+	pipeline->batch_count = 0;
+	pipeline->batch_next = 0;
+	pthread_create(&pipeline->thread, NULL, scan_ahead, pipeline);
+}
+
+/* Gets the next token from the scanning thread like scanner_scan, waiting
+ * for it to be scanned if need be. An error's message is reported to err.
+ * Returns: SCAN_ERROR or SCAN_VALID
+ */
+static int pipeline_next(struct Pipeline *pipeline, int *ln, struct Token *token, FILE *err) {
+	while (pipeline->batch_next == pipeline->batch_count) {
+		pipeline->batch_count = scanring_pop(&pipeline->ring, pipeline->batch, PIPELINE_BATCH_SIZE);
+		pipeline->batch_next = 0;
+		if (pipeline->batch_count == 0) sched_yield(); // empty, wait for the scanner
+	}
+	const struct Scan *scan = &pipeline->batch[pipeline->batch_next++];
+	*ln = scan->ln;
+	*token = scan->token;
+	if (scan->result == SCAN_ERROR)
+		fwrite(pipeline->err_text, sizeof(char), pipeline->err_size, err);
+	return scan->result;
+}
+
+/* Stops the scanning thread, wherever it is in the source, and frees the
+ * pipeline's resources. Does NOT free the pipeline.
+ */
+static void pipeline_stop(struct Pipeline *pipeline) {
+	atomic_store(&pipeline->cancelled, true);
+	pthread_join(pipeline->thread, NULL);
+	pipeline->scanner->err = pipeline->scanner_err;
+	fclose(pipeline->err);
+	free(pipeline->err_text);
+	scanring_deinit(&pipeline->ring);
+}
+
+/* where the preprocessor reads the tokens of the file being compiled: from
+ * the compiler's scanner, or from the scanning thread if pipelined.
+ */
+struct TokenSource {
+	struct Compiler *compiler;
+	struct Pipeline *pipeline; // NULL if not pipelined
+	int ln; // line number the scanner was at after scanning the last token read
+};
+
+/* Reads the next token for the preprocessor (see TokenReader). */
+static int read_token(void *context, struct Token *token) {
+	struct TokenSource *source = context;
+	// waiting for the scanning thread is none of the phases
+	STATS_BEGIN((source->pipeline != NULL) ? STATS_PHASE_NONE : STATS_PHASE_SCAN);
+	int result;
+	do {
+		result = (source->pipeline != NULL)
+			? pipeline_next(source->pipeline, &source->ln, token, source->compiler->err)
+			: scanner_scan(&source->compiler->scanner, &source->ln, token);
+	} while (result == SCAN_NULL);
+	STATS_END();
+	return result;
+}
+
+/* Compiles the source of the file to a module next to it (see module_path),
+ * closing the source once it is parsed.
+ * Returns: whether successful.
+ */
+static bool compile(struct Compiler *compiler, const char *file_name, struct Source *source) {
+	trace_file(file_name);
+	scanner_set_source(&compiler->scanner, source);
+	parser_set_source(&compiler->parser, source);
+	module_writer_reset(&compiler->writer);
+	blockvec_clear(&compiler->blocks);
+	indexvec_clear(&compiler->breaks);
+	compiler->fence = 0;
+	struct Pipeline pipeline;
+	if (compiler->pipeline)
+		pipeline_start(&pipeline, &compiler->scanner);
+	struct TokenSource tokens = { compiler, compiler->pipeline ? &pipeline : NULL, 1 };
+	preprocessor_set_source(&compiler->preprocessor, source, read_token, &tokens);
+
 	bool success = false;
 	while (true) {
 		struct Token token;
-		int scan_result = scanner_scan(&compiler->scanner, file, &ln, &token);
-		if (scan_result == SCAN_ERROR) break;
-		if (scan_result == SCAN_NULL) continue;
+		STATS_PHASE(STATS_PHASE_PARSE);
+		if (preprocessor_next(&compiler->preprocessor, &token) == PREPROCESS_ERROR) break;
 		if (token.id == TOKEN_EOF) {
-			success = true;
+			struct Statement statement;
+			if (parser_parse(&compiler->parser, &compiler->symtable, &token, &statement) == PARSE_ERROR) break;
+			success = compiler->blocks.count == 0;
+			if (!success)
+				fprintf(compiler->err, "Expected `}` to close block before end of file %s\n", file_name);
 			break;
 		}
-		if (DEBUG_TOKENS || DEBUG_ALL)
-			printf("@%i [%i] %s\n", ln, token.id, token.string);
+		if (trace_flags & TRACE_TOKENS)
+			trace_event(TRACE_KIND_TOKEN, token.id, token.ln, token.offset, token.length);
 
 		struct Statement statement;
 		int parse_result = parser_parse(&compiler->parser, &compiler->symtable, &token, &statement);
 		if (parse_result == PARSE_ERROR) break;
 		if (parse_result == PARSE_NULL) continue;
-		if (DEBUG_STATEMENTS || DEBUG_ALL)
-			printf("@%i  |-> [%i]\n", ln, statement.id);
+		if (trace_flags & TRACE_STATEMENTS) {
+			const struct Token *first = &compiler->parser.first;
+			const struct Token *last = &compiler->parser.last;
+			trace_event(TRACE_KIND_STATEMENT, statement.id, first->ln, first->site_offset,
+				last->site_offset + last->site_length - first->site_offset);
+		}
+		STATS_PHASE(STATS_PHASE_EMIT);
+		if (statement.id == STATEMENT_INCLUDE && compiler->includes != NULL) {
+			const char *path = interner_string(&compiler->interner, statement.args[0]);
+			if (compiler->included != NULL)
+				build_cache_record_include(compiler->included, path, compiler->parser.first.ln);
+			int included = include_graph_include(compiler->includes, compiler->file, path,
+				compiler->parser.first.ln, compiler->err);
+			if (included == INCLUDE_DUPLICATE) continue;
+			if (included != INCLUDE_NEW) {
+				compiler->cacheable = false; // depends on other files
+				break;
+			}
+		}
+		if (compiler->optimize)
+			optimizer_fold(&statement);
+		if (!generate(compiler, &statement)) {
+			fprintf(compiler->err, "Module of %s exceeds the maximum number of %s at line %i\n", file_name,
+				exceeded_limit(compiler), compiler->parser.first.ln);
+			success = false;
+			break;
+		}
+	}
+	STATS_PHASE(STATS_PHASE_READ);
+	if (compiler->pipeline)
+		pipeline_stop(&pipeline);
+	source_close(source);
+
+	STATS_PHASE(STATS_PHASE_EMIT);
+	if (success && compiler->optimize >= 2)
+		peephole_thread_jumps(&compiler->writer);
+	if (success) {
+		STATS_PHASE(STATS_PHASE_WRITE);
+		char path[strlen(file_name) + sizeof("stdin" MODULE_EXTENSION)];
+		module_path(file_name, path);
+		success = write_module(compiler, path);
+	}
+	return success;
+}
+
+/* Repeats compiling the file from what the build cache has of it: resolves
+ * its includes again, then repeats its output and writes its module.
+ * Returns: whether successful
+ */
+static bool compile_from_cache(struct Compiler *compiler, const char *file_name, const struct CacheEntry *entry) {
+	size_t offset = 0;
+	int ln;
+	const char *included;
+	while ((included = build_cache_next_include(entry, &offset, &ln)) != NULL) {
+		if (compiler->includes != NULL
+			&& include_graph_include(compiler->includes, compiler->file, included, ln, compiler->err) > INCLUDE_DUPLICATE)
+			return false;
+	}
+	fwrite(entry->err, sizeof(char), entry->err_size, compiler->err);
+	fwrite(entry->out, sizeof(char), entry->out_size, compiler->out);
+	if (!entry->success) return false;
+
+	STATS_PHASE(STATS_PHASE_WRITE);
+	char path[strlen(file_name) + sizeof("stdin" MODULE_EXTENSION)];
+	module_path(file_name, path);
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(compiler->err, "Failed to open output file %s\n", path);
+		return false;
+	}
+	bool written = fwrite(entry->module, sizeof(char), entry->module_size, file) == entry->module_size;
+	if (fclose(file) != 0 || !written) {
+		fprintf(compiler->err, "Failed to write output file %s\n", path);
+		remove(path);
+		return false;
+	}
+	return true;
+}
+
+/* Compiles the source of the file like compile, unless the build cache has
+ * it. Otherwise, stores what it compiles to in the cache, unless that
+ * depends on more than the source: its includes failed or the module could
+ * not be written.
+ * Returns: whether successful
+ */
+static bool compile_cached(struct Compiler *compiler, const char *file_name, struct Source *source) {
+	struct CacheKey key;
+	build_cache_key(compiler->cache, file_name, source, &key);
+	size_t source_size = source->size;
+	struct CacheEntry entry;
+	if (build_cache_load(compiler->cache, &key, source_size, &entry)) {
+		source_close(source);
+		bool success = compile_from_cache(compiler, file_name, &entry);
+		build_cache_release(&entry);
+		return success;
+	}
+
+	// record the output of the compile, to cache it
+	FILE *out = compiler->out;
+	FILE *err = compiler->err;
+	char *includes_text, *out_text, *err_text, *module = NULL;
+	size_t module_size = 0;
+	compiler->included = open_memstream(&includes_text, &entry.includes_size);
+	FILE *out_memory = open_memstream(&out_text, &entry.out_size);
+	FILE *err_memory = open_memstream(&err_text, &entry.err_size);
+	compiler_set_output(compiler, out_memory, err_memory);
+	compiler->cacheable = true;
+
+	bool success = compile(compiler, file_name, source);
+	compiler_set_output(compiler, out, err);
+	fclose(compiler->included);
+	compiler->included = NULL;
+	fclose(out_memory);
+	fclose(err_memory);
+	fwrite(err_text, sizeof(char), entry.err_size, err);
+	fwrite(out_text, sizeof(char), entry.out_size, out);
+
+	if (compiler->cacheable) {
+		if (success) {
+			FILE *module_memory = open_memstream(&module, &module_size);
+			module_writer_write(&compiler->writer, module_memory);
+			fclose(module_memory);
+		}
+		entry.success = success;
+		entry.includes = includes_text;
+		entry.out = out_text;
+		entry.err = err_text;
+		entry.module = module;
+		entry.module_size = module_size;
+		build_cache_store(compiler->cache, &key, source_size, &entry);
+	}
+	free(includes_text);
+	free(out_text);
+	free(err_text);
+	free(module);
+	return success;
+}
+
+/* Compiles the file with the given file path to a module next to it (see
+ * module_path), or takes the module from the build cache if it has the file.
+ * Returns: whether successful.
+ */
+bool compiler_compile(struct Compiler *compiler, const char *file_name) {
+	struct Source source;
+	STATS_PHASE(STATS_PHASE_READ);
+	if (!source_open(&source, file_name)) {
+		fprintf(compiler->err, "Failed to open file %s\n", file_name);
+		STATS_PHASE(STATS_PHASE_NONE);
+		return false;
 	}
-	fclose(file);
+	bool success = (compiler->cache != NULL)
+		? compile_cached(compiler, file_name, &source)
+		: compile(compiler, file_name, &source);
+	STATS_PHASE(STATS_PHASE_NONE);
+
+	// release everything created for this file at once
+	symtable_reset(&compiler->symtable);
+	arena_reset(&compiler->arena);
+	return success;
+}
+
+/* shared state of the workers compiling files in parallel. */
+struct CompileJobs {
+	struct IncludeGraph *includes; // files to compile, which grow as they are compiled
+	int optimize; // optimization level of every worker's compiler
+	bool pipeline; // whether every worker's compiler scans on a thread of its own
+	struct BuildCache *cache; // shared by every worker's compiler, NULL if none
+	atomic_int compiled_counts[2]; // of input files, then of included files
+	pthread_mutex_t output_lock; // held while writing a file's buffered output
+};
+
+/* Compiles the file like compiler_compile, but buffers the compiler's output
+ * so that it is written all at once rather than interleaved with other workers'.
+ */
+static bool compile_buffered(struct Compiler *compiler, const char *file_name, pthread_mutex_t *output_lock) {
+	char *out_buf, *err_buf;
+	size_t out_size, err_size;
+	FILE *out = open_memstream(&out_buf, &out_size);
+	FILE *err = open_memstream(&err_buf, &err_size);
+	compiler_set_output(compiler, out, err);
+
+	bool success = compiler_compile(compiler, file_name);
+	fclose(out);
+	fclose(err);
+
+	pthread_mutex_lock(output_lock);
+	fwrite(err_buf, sizeof(char), err_size, stderr);
+	fwrite(out_buf, sizeof(char), out_size, stdout);
+	pthread_mutex_unlock(output_lock);
+	free(out_buf);
+	free(err_buf);
 	return success;
 }
 
+/* Worker thread. Compiles files from the shared jobs until none are left,
+ * using its own Compiler. A file waits for a free worker, not for the
+ * files it includes.
+ */
+static void *compile_worker(void *arg) {
+	struct CompileJobs *jobs = arg;
+	struct Compiler compiler;
+	compiler_init(&compiler);
+	compiler.optimize = jobs->optimize;
+	compiler.pipeline = jobs->pipeline;
+	compiler.includes = jobs->includes;
+	compiler.cache = jobs->cache;
+
+	const char *file_name;
+	while ((compiler.file = include_graph_next(jobs->includes, &file_name)) != -1) {
+		if (compile_buffered(&compiler, file_name, &jobs->output_lock))
+			atomic_fetch_add(&jobs->compiled_counts[compiler.file >= jobs->includes->input_count], 1);
+		include_graph_done(jobs->includes);
+	}
+	compiler_deinit(&compiler);
+	stats_merge();
+	trace_flush();
+	return NULL;
+}
+
+/* Compiles the graph's files, and the files they include, using a pool of
+ * worker threads.
+ *
+ * compiled_counts - where to add the number of input files, then of
+ *      included files, successfully compiled
+ */
+static void compile_parallel(struct IncludeGraph *includes, int thread_count, int optimize, bool pipeline,
+	struct BuildCache *cache, int compiled_counts[2]) {
+	struct CompileJobs jobs;
+	jobs.includes = includes;
+	jobs.optimize = optimize;
+	jobs.pipeline = pipeline;
+	jobs.cache = cache;
+	atomic_init(&jobs.compiled_counts[0], 0);
+	atomic_init(&jobs.compiled_counts[1], 0);
+	pthread_mutex_init(&jobs.output_lock, NULL);
+
+	pthread_t threads[thread_count];
+	for (int i = 0; i < thread_count; i++) {
+		pthread_create(&threads[i], NULL, compile_worker, &jobs);
+	}
+	for (int i = 0; i < thread_count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&jobs.output_lock);
+	compiled_counts[0] += atomic_load(&jobs.compiled_counts[0]);
+	compiled_counts[1] += atomic_load(&jobs.compiled_counts[1]);
+}
+
 static inline void print_help() {
 	printf("C-Slim compiler usage:\n"
-		"\targs: <file1> [file2, file3, ...]\n"
+		"\targs: <file1> [file2, file3, ...] (- reads from stdin)\n"
+		"\t-j <N> ... compile up to N files in parallel\n"
+		"\t-O0 ... generate code as written\n"
+		"\t-O1 ... fold constants and simplify expressions, dropping code that never runs\n"
+		"\t-O2 ... also fuse common instruction sequences and shorten chains of jumps (default)\n"
+		"\t--pipeline ... scan each file on a thread of its own, ahead of parsing it\n"
+		"\t--trace=<events> ... trace a comma-separated list of events: tokens, statements, modules.\n"
+		"\t\ttokens and statements are recorded to a binary trace file, see cslim_trace\n"
+		"\t--trace-file=<path> ... write the trace to path (default " TRACE_PATH ")\n"
+		"\t--stats ... print the time spent in each phase and counts of tokens, allocations and more\n"
+		"\t--cache=<dir> ... keep what each file compiles to in dir, and take it from there while the\n"
+		"\t\tfile is unchanged instead of compiling it again. not used while tracing\n"
+		"\t--cache-stats ... print how many files were found in the cache and how many were not\n"
 		"\t--help ... print this page\n"
 		"\t--version ... print version\n");
 }
 
+/* Parses a comma-separated list of events to trace, as in "tokens,statements".
+ * Returns: the events' enum trace_flags, -1 if one is unknown
+ */
+static int parse_trace_events(const char *list) {
+	static const struct { const char *name; int flag; } events[] = {
+		{ "tokens", TRACE_TOKENS },
+		{ "statements", TRACE_STATEMENTS },
+		{ "modules", TRACE_MODULES }
+	};
+	int event_count = sizeof(events) / sizeof(events[0]);
+	int flags = 0;
+	while (*list != '\0') {
+		size_t length = strcspn(list, ",");
+		int event = 0;
+		while (event < event_count
+			&& (strlen(events[event].name) != length || strncmp(events[event].name, list, length) != 0))
+			event++;
+		if (event == event_count) return -1;
+		flags |= events[event].flag;
+		list += length;
+		if (*list == ',') list++;
+	}
+	return flags;
+}
+
 /* Compiles C-Slim input files. */
 int main(int arg_count, char **args) {
 	char *input_files[arg_count - 1];
 	int input_files_count = 0;
+	int thread_count = 1;
+	int optimize = 2;
+	bool pipeline = false;
+	bool stats = false;
+	int trace = 0; // enum trace_flags
+	const char *trace_path = TRACE_PATH;
+	const char *cache_path = NULL;
+	bool cache_stats = false;
 	for (int i = 1; i < arg_count; i++) {
 		char *arg = args[i];
-		if (strcmp("--help", arg) == 0) {
+		if (strncmp("-j", arg, 2) == 0) {
+			// accepts both "-j N" and "-jN"
+			char *count = arg + 2;
+			if (*count == '\0')
+				count = (i + 1 < arg_count) ? args[++i] : "";
+			thread_count = atoi(count);
+			if (thread_count < 1) {
+				fprintf(stderr, "Option -j expects a positive number of threads\n");
+				return EXIT_FAILURE;
+			}
+		} else if (strncmp("-O", arg, 2) == 0 && arg[2] >= '0' && arg[2] <= '2' && arg[3] == '\0') {
+			optimize = arg[2] - '0';
+		} else if (strcmp("--pipeline", arg) == 0) {
+			pipeline = true;
+		} else if (strncmp("--trace=", arg, 8) == 0) {
+			trace = parse_trace_events(arg + 8);
+			if (trace == -1) {
+				fprintf(stderr, "Option --trace expects events from: tokens, statements, modules\n");
+				return EXIT_FAILURE;
+			}
+		} else if (strncmp("--trace-file=", arg, 13) == 0) {
+			trace_path = arg + 13;
+		} else if (strcmp("--stats", arg) == 0) {
+			stats = true;
+		} else if (strncmp("--cache=", arg, 8) == 0 && arg[8] != '\0') {
+			cache_path = arg + 8;
+		} else if (strcmp("--cache-stats", arg) == 0) {
+			cache_stats = true;
+		} else if (strcmp("--help", arg) == 0) {
 			print_help();
 		} else if (strcmp("--version", arg) == 0) {
 			printf("C-Slim compiler version %s\n", VERSION);
-		} else if (arg[0] == '-') {
+		} else if (arg[0] == '-' && arg[1] != '\0') {
 			fprintf(stderr, "Unknown option %s\nTry --help\n", arg);
 			return EXIT_FAILURE;
 		} else {
@@ -91,22 +899,69 @@ int main(int arg_count, char **args) {
 		return EXIT_FAILURE;
 	}
 
-	scanner_global_init();
-
-	struct Compiler compiler;
-	compiler_init(&compiler);
-
-	int compiled_count = 0;
+	if (trace != 0 && !trace_open(trace_path, trace)) {
+		fprintf(stderr, "Failed to open trace file %s\n", trace_path);
+		return EXIT_FAILURE;
+	}
+	// a file found in the cache is not compiled, so it could not be traced
+	struct BuildCache cache;
+	bool caching = cache_path != NULL && trace == 0;
+	if (caching) {
+		char options[] = { '-', 'O', '0' + optimize, '\0' };
+		if (!build_cache_open(&cache, cache_path, options, stderr))
+			return EXIT_FAILURE;
+	}
+	if (stats && STATS)
+		stats_start();
+	struct IncludeGraph includes;
+	include_graph_init(&includes);
 	for (int i = 0; i < input_files_count; i++) {
-		if (compiler_compile(&compiler, input_files[i]))
-			compiled_count++;
+		include_graph_add(&includes, input_files[i]);
+	}
+	int compiled_counts[2] = { 0, 0 }; // of input files, then of included files
+	if (thread_count > 1) {
+		compile_parallel(&includes, thread_count, optimize, pipeline, caching ? &cache : NULL, compiled_counts);
+	} else {
+		struct Compiler compiler;
+		compiler_init(&compiler);
+		compiler.optimize = optimize;
+		compiler.pipeline = pipeline;
+		compiler.includes = &includes;
+		compiler.cache = caching ? &cache : NULL;
+		const char *file_name;
+		while ((compiler.file = include_graph_next(&includes, &file_name)) != -1) {
+			if (compiler_compile(&compiler, file_name))
+				compiled_counts[compiler.file >= includes.input_count]++;
+			include_graph_done(&includes);
+		}
+		compiler_deinit(&compiler);
+	}
+	int input_count = includes.input_count;
+	int included_count = includes.files.count - input_count;
+	bool success = compiled_counts[0] == input_count && compiled_counts[1] == included_count;
+	include_graph_deinit(&includes);
+	trace_close();
+	if (stats && STATS) {
+		stats_merge();
+		stats_print(stderr, token_name);
+	} else if (stats) {
+		fprintf(stderr, "Option --stats needs a build with STATS=1\n");
+	}
+	if (cache_stats && caching) {
+		build_cache_print_stats(&cache, stderr);
+	} else if (cache_stats) {
+		fprintf(stderr, "Option --cache-stats needs --cache=<dir>, without --trace\n");
 	}
 
-	if (compiled_count == input_files_count) {
-		printf("SUCCESS! Compiled all %i input files\n", input_files_count);
-		return EXIT_SUCCESS;
+	if (success) {
+		printf("SUCCESS! Compiled all %i input files", input_count);
+		if (included_count > 0)
+			printf(" and %i included files", included_count);
 	} else {
-		printf("FAILURE! Compiled %i out of %i input files\n", compiled_count, input_files_count);
-		return EXIT_FAILURE;
+		printf("FAILURE! Compiled %i of %i input files", compiled_counts[0], input_count);
+		if (included_count > 0)
+			printf(" and %i of %i included files", compiled_counts[1], included_count);
 	}
+	printf("\n");
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -5,20 +5,59 @@
 #ifndef __COMPILER_H__
 #define __COMPILER_H__
 
+#include <stdio.h>
 #include <stdbool.h>
 
 #include "symtable.h"
 #include "scanner.h"
 #include "parser.h"
+#include "preprocessor.h"
+#include "module.h"
+#include "include_graph.h"
+#include "build_cache.h"
+#include "utils/interner.h"
+#include "utils/arena.h"
+#include "utils/vec.h"
+
+/* a block of code being generated, opened by an IF, ELSE or WHILE statement. */
+struct Block {
+	int kind; // enum statements, of the statement that opened it
+	int start; // index of a loop's first instruction
+	int exit; // index of the jump past the block, -1 if none
+	int breaks; // count of the compiler's breaks when the block was opened
+	bool dead; // never runs, so no code is generated for it
+	bool always; // runs whenever the code around it does: the condition is constant and true
+};
+
+DEFINE_VEC(BlockVec, blockvec, struct Block)
 
 struct Compiler {
+	Interner interner; // shared by every file the compiler compiles
+	Arena arena; // everything created while compiling one file
 	struct SymTable symtable;
 	struct Scanner scanner;
+	struct Preprocessor preprocessor;
 	struct Parser parser;
+	struct ModuleWriter writer; // module of the file being compiled
+	BlockVec blocks; // open blocks, innermost last
+	struct Block closed; // the block last closed, for an ELSE after an IF's
+	IndexVec breaks; // index of each break out of an open loop, to be patched at its end
+	int optimize; // optimization level: 0 generates code as written, 1 simplifies it, 2 also fuses instructions
+	int fence; // index of the first instruction that may be fused: none before the last jump target
+	bool pipeline; // scan on a thread of its own, ahead of the parser (see struct Pipeline)
+	struct IncludeGraph *includes; // files being compiled, which includes are added to. NULL to only import them
+	int file; // index in includes of the file being compiled
+	struct BuildCache *cache; // where files compiled before are looked up and stored. NULL if not
+	FILE *included; // where include statements are recorded for the cache, NULL if not
+	bool cacheable; // what the file compiles to depends only on its text, so it may be cached
+	FILE *out; // where debugging output is written
+	FILE *err; // where errors are reported
 };
 
 void compiler_init(struct Compiler *compiler);
+void compiler_deinit(struct Compiler *compiler);
+void compiler_set_output(struct Compiler *compiler, FILE *out, FILE *err);
 
-bool compiler_compile(struct Compiler *compiler, char *file_name);
+bool compiler_compile(struct Compiler *compiler, const char *file_name);
 
 #endif
@@ -0,0 +1,220 @@
+/* include_graph.c
+ * Resolves `#include "path";` to the files to compile. A path is resolved
+ * relative to the directory of the file including it, and a file is known
+ * by its canonical path, so every way of naming it leads to the same file,
+ * which is compiled once however many files include it. As a module only
+ * imports the files it includes, rather than needing them compiled first,
+ * files are added to the graph as their includes are compiled, and each is
+ * compiled as soon as a thread is free: the files need not be scanned ahead
+ * of compiling them to find their includes. An include that would close a
+ * cycle is reported as an error, with the files on the cycle.
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "include_graph.h"
+
+#define INCLUDE_GRAPH_INITIAL_SIZE 64
+#define INCLUDE_GRAPH_INCLUDES_SIZE 4
+
+void include_graph_init(struct IncludeGraph *graph) {
+	includedfilevec_init(&graph->files, INCLUDE_GRAPH_INITIAL_SIZE);
+	filemap_init(&graph->indexes, INCLUDE_GRAPH_INITIAL_SIZE, NULL);
+	indexvec_init(&graph->search, INCLUDE_GRAPH_INITIAL_SIZE);
+	interner_init(&graph->paths);
+	graph->input_count = 0;
+	graph->next = 0;
+	graph->busy = 0;
+	graph->visits = 0;
+	pthread_mutex_init(&graph->lock, NULL);
+	pthread_cond_init(&graph->changed, NULL);
+}
+
+/* Frees an IncludeGraph's resources. Does NOT free the graph. */
+void include_graph_deinit(struct IncludeGraph *graph) {
+	for (int i = 0; i < graph->files.count; i++) {
+		indexvec_deinit(&graph->files.items[i].includes);
+	}
+	includedfilevec_deinit(&graph->files);
+	filemap_deinit(&graph->indexes);
+	indexvec_deinit(&graph->search);
+	interner_deinit(&graph->paths);
+	pthread_mutex_destroy(&graph->lock);
+	pthread_cond_destroy(&graph->changed);
+}
+
+static StrId intern(struct IncludeGraph *graph, const char *string) {
+	return interner_intern(&graph->paths, string, strlen(string));
+}
+
+static const char *file_name(struct IncludeGraph *graph, int file) {
+	return interner_string(&graph->paths, graph->files.items[file].name);
+}
+
+/* Finds the file with the canonical path, adding it if new. The lock must be held.
+ * name - path to report the file by, if new
+ * Returns: index of the file
+ */
+static int find_file(struct IncludeGraph *graph, const char *path, const char *name) {
+	StrId key = intern(graph, path);
+	int *index = filemap_get(&graph->indexes, key);
+	if (index != NULL) return *index;
+
+	struct IncludedFile file;
+	file.path = key;
+	file.name = intern(graph, name);
+	indexvec_init(&file.includes, INCLUDE_GRAPH_INCLUDES_SIZE);
+	file.visit = 0;
+	file.parent = -1;
+	includedfilevec_push(&graph->files, file);
+	filemap_put(&graph->indexes, key, graph->files.count - 1);
+	pthread_cond_signal(&graph->changed);
+	return graph->files.count - 1;
+}
+
+/* Adds an input file, given by its path relative to the working directory,
+ * unless it was added already. Must be called before any file is compiled.
+ * Returns: index of the file
+ */
+int include_graph_add(struct IncludeGraph *graph, const char *path) {
+	pthread_mutex_lock(&graph->lock);
+	char canonical[PATH_MAX];
+	// a file that cannot be resolved (or stdin, "-") is known by the path
+	// given, so that compiling it reports the error
+	int file = find_file(graph, (realpath(path, canonical) != NULL) ? canonical : path, path);
+	graph->input_count = graph->files.count;
+	pthread_mutex_unlock(&graph->lock);
+	return file;
+}
+
+/* Writes the path, relative to the directory of the file at from, to joined. */
+static void join(const char *from, const char *path, char *joined) {
+	const char *slash = strrchr(from, '/');
+	if (path[0] == '/' || slash == NULL) {
+		strcpy(joined, path);
+		return;
+	}
+	int length = slash + 1 - from;
+	memcpy(joined, from, length);
+	strcpy(joined + length, path);
+}
+
+/* Searches the files that start includes, directly or not, for end. The
+ * lock must be held. Files reached are marked with the search's visit and
+ * the file they were reached from.
+ * Returns: whether found
+ */
+static bool reaches(struct IncludeGraph *graph, int start, int end) {
+	int visit = ++graph->visits;
+	struct IncludedFile *files = graph->files.items;
+	indexvec_clear(&graph->search);
+	indexvec_push(&graph->search, start);
+	files[start].visit = visit;
+	files[start].parent = -1;
+	while (graph->search.count > 0) {
+		int file = indexvec_pop(&graph->search);
+		for (int i = 0; i < files[file].includes.count; i++) {
+			int included = files[file].includes.items[i];
+			if (files[included].visit == visit) continue;
+			files[included].visit = visit;
+			files[included].parent = file;
+			if (included == end) return true;
+			indexvec_push(&graph->search, included);
+		}
+	}
+	return false;
+}
+
+/* Prints the cycle that the file including the included file would close,
+ * as in "a -> b -> a", after reaches(graph, included, file) found it.
+ */
+static void print_cycle(struct IncludeGraph *graph, int file, int included, FILE *err) {
+	fprintf(err, "%s", file_name(graph, file));
+	indexvec_clear(&graph->search);
+	if (included != file) {
+		// follow the search back from the file to the included file
+		for (int i = file; i != -1; i = graph->files.items[i].parent) {
+			indexvec_push(&graph->search, i);
+		}
+	} else {
+		indexvec_push(&graph->search, file);
+	}
+	for (int i = graph->search.count - 1; i >= 0; i--) {
+		fprintf(err, " -> %s", file_name(graph, graph->search.items[i]));
+	}
+}
+
+/* Records that the file includes the path, adding the file at the path if
+ * it is new so that it is compiled too.
+ * Returns: enum include_codes. NOT_FOUND and CYCLE are reported to err
+ *
+ * ln - line of the file that includes the path
+ */
+int include_graph_include(struct IncludeGraph *graph, int file, const char *path, int ln, FILE *err) {
+	pthread_mutex_lock(&graph->lock);
+	struct IncludedFile *from = &graph->files.items[file];
+	const char *from_path = interner_string(&graph->paths, from->path);
+	const char *from_name = interner_string(&graph->paths, from->name);
+	char resolved[strlen(from_path) + strlen(path) + 1];
+	char name[strlen(from_name) + strlen(path) + 1];
+	char canonical[PATH_MAX];
+	join(from_path, path, resolved);
+	join(from_name, path, name);
+	if (realpath(resolved, canonical) == NULL) {
+		fprintf(err, "Failed to find included file %s at line %i of %s\n", path, ln, from_name);
+		pthread_mutex_unlock(&graph->lock);
+		return INCLUDE_NOT_FOUND;
+	}
+
+	int included = find_file(graph, canonical, name);
+	from = &graph->files.items[file]; // moved if the file was added
+	int result = INCLUDE_NEW;
+	for (int i = 0; i < from->includes.count; i++) {
+		if (from->includes.items[i] == (uint32_t) included) result = INCLUDE_DUPLICATE;
+	}
+	if (result == INCLUDE_NEW && (included == file || reaches(graph, included, file))) {
+		fprintf(err, "Include cycle at line %i of %s: ", ln, file_name(graph, file));
+		print_cycle(graph, file, included, err);
+		fprintf(err, "\n");
+		result = INCLUDE_CYCLE;
+	}
+	if (result == INCLUDE_NEW)
+		indexvec_push(&graph->files.items[file].includes, included);
+	pthread_mutex_unlock(&graph->lock);
+	return result;
+}
+
+/* Takes the next file to compile, waiting while every file added is taken
+ * but those being compiled may yet include more. include_graph_done must be
+ * called once the file is compiled.
+ * Returns: index of the file, -1 once every file is compiled
+ *
+ * name - where to store the file's name, the path to compile it from
+ */
+int include_graph_next(struct IncludeGraph *graph, const char **name) {
+	pthread_mutex_lock(&graph->lock);
+	while (graph->next == graph->files.count && graph->busy > 0) {
+		pthread_cond_wait(&graph->changed, &graph->lock);
+	}
+	int file = -1;
+	if (graph->next < graph->files.count) {
+		file = graph->next++;
+		graph->busy++;
+		*name = file_name(graph, file);
+	}
+	pthread_mutex_unlock(&graph->lock);
+	return file;
+}
+
+/* Records that a file taken by include_graph_next is compiled. */
+void include_graph_done(struct IncludeGraph *graph) {
+	pthread_mutex_lock(&graph->lock);
+	graph->busy--;
+	if (graph->busy == 0)
+		pthread_cond_broadcast(&graph->changed); // no more files will be added
+	pthread_mutex_unlock(&graph->lock);
+}
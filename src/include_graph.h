@@ -0,0 +1,62 @@
+/* include_graph.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __INCLUDE_GRAPH_H__
+#define __INCLUDE_GRAPH_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "module.h"
+#include "utils/map.h"
+#include "utils/vec.h"
+#include "utils/interner.h"
+
+enum include_codes {
+	INCLUDE_NEW, // the file includes the path for the first time
+	INCLUDE_DUPLICATE, // the file already included the path
+	INCLUDE_NOT_FOUND, // no file at the path
+	INCLUDE_CYCLE // the path includes the file, directly or not
+};
+
+/* a file to compile: an input file or a file one includes. */
+struct IncludedFile {
+	StrId path; // canonical path, which identifies the file
+	StrId name; // path as given or as resolved from the including file's name, for messages
+	IndexVec includes; // index of each file it includes, in the order included
+	int visit; // IncludeGraph.visits when last visited by a search for a cycle
+	int parent; // file from which the last search reached it
+};
+
+DEFINE_VEC(IncludedFileVec, includedfilevec, struct IncludedFile)
+DEFINE_MAP(FileMap, filemap, StrId, int, map_hash_int, map_int_equal)
+
+/* the files being compiled and which include which, shared by the threads
+ * compiling them. Files are added as their includes are compiled, so each
+ * is compiled once however many files include it.
+ */
+struct IncludeGraph {
+	IncludedFileVec files; // in the order added, which is the order they are compiled in
+	FileMap indexes; // canonical path -> index in files
+	int input_count; // files added as input files, which come first
+	int next; // index of the next file to compile
+	int busy; // files being compiled, which may include more files
+	int visits; // count of searches for a cycle
+	IndexVec search; // files a search for a cycle has yet to visit
+	Interner paths; // of files' paths and names
+	pthread_mutex_t lock; // held while using any of the above
+	pthread_cond_t changed; // a file was added, or the last file being compiled was done
+};
+
+void include_graph_init(struct IncludeGraph *graph);
+void include_graph_deinit(struct IncludeGraph *graph);
+
+int include_graph_add(struct IncludeGraph *graph, const char *path);
+int include_graph_include(struct IncludeGraph *graph, int file, const char *path, int ln, FILE *err);
+
+int include_graph_next(struct IncludeGraph *graph, const char **name);
+void include_graph_done(struct IncludeGraph *graph);
+
+#endif
@@ -0,0 +1,132 @@
+/* interpreter.c
+ * C-Slim interpreter. runs modules (bytecode) produced by the compiler.
+ * A module's imports, the files it includes, run before it: each is the
+ * module compiled from the included file, resolved relative to the
+ * importing module's directory as the compiler resolved the file. A module
+ * runs once however many modules import it, known by its canonical path.
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "module.h"
+#include "vm.h"
+#include "version.h"
+#include "utils/map.h"
+#include "utils/interner.h"
+
+enum run_states {
+	RUN_STARTED, // running its imports, or itself
+	RUN_DONE
+};
+
+DEFINE_MAP(RunMap, runmap, StrId, int, map_hash_int, map_int_equal)
+
+/* the modules run so far, and the VM running them. */
+struct Runner {
+	struct VM vm;
+	Interner paths; // canonical paths of modules
+	RunMap states; // canonical path -> enum run_states
+};
+
+static inline void print_help() {
+	printf("C-Slim interpreter usage:\n"
+		"\targs: <module1.csb> [module2.csb, ...] (run in order, each after the modules it imports)\n"
+		"\t--help ... print this page\n"
+		"\t--version ... print version\n");
+}
+
+/* Writes to imported the path of the module compiled from the file that the
+ * module at from includes as path, relative to the directory of from.
+ */
+static void import_path(const char *from, const char *path, char *imported) {
+	const char *slash = strrchr(from, '/');
+	char joined[strlen(from) + strlen(path) + 1];
+	if (path[0] == '/' || slash == NULL) {
+		strcpy(joined, path);
+	} else {
+		int length = slash + 1 - from;
+		memcpy(joined, from, length);
+		strcpy(joined + length, path);
+	}
+	module_path(joined, imported);
+}
+
+/* Runs the module in the file, after the modules it imports, unless it ran
+ * already. Errors are printed to stderr.
+ * Returns: whether it and its imports ran until they halted
+ */
+static bool run(struct Runner *runner, const char *file_name) {
+	char canonical[PATH_MAX];
+	const char *path = (realpath(file_name, canonical) != NULL) ? canonical : file_name;
+	StrId key = interner_intern(&runner->paths, path, strlen(path));
+	int *state = runmap_get(&runner->states, key);
+	if (state != NULL) {
+		if (*state == RUN_DONE) return true;
+		fprintf(stderr, "Import cycle at module %s\n", file_name);
+		return false;
+	}
+	runmap_put(&runner->states, key, RUN_STARTED);
+
+	struct Module module;
+	if (!module_load(&module, file_name, stderr)) return false;
+	bool success = true;
+	for (int i = 0; i < module.import_count && success; i++) {
+		const char *included = module_string(&module, module.imports[i]);
+		if (included == NULL) {
+			fprintf(stderr, "Invalid module %s: import %i is not a path\n", file_name, i);
+			success = false;
+			break;
+		}
+		char imported[strlen(file_name) + strlen(included) + sizeof("stdin" MODULE_EXTENSION)];
+		import_path(file_name, included, imported);
+		success = run(runner, imported);
+	}
+	if (success)
+		success = vm_run(&runner->vm, &module) == VM_HALTED;
+	module_unload(&module);
+	runmap_put(&runner->states, key, RUN_DONE);
+	return success;
+}
+
+/* Runs compiled C-Slim modules. */
+int main(int arg_count, char **args) {
+	char *module_files[arg_count - 1];
+	int module_files_count = 0;
+	for (int i = 1; i < arg_count; i++) {
+		char *arg = args[i];
+		if (strcmp("--help", arg) == 0) {
+			print_help();
+		} else if (strcmp("--version", arg) == 0) {
+			printf("C-Slim interpreter version %s\n", VERSION);
+		} else if (arg[0] == '-' && arg[1] != '\0') {
+			fprintf(stderr, "Unknown option %s\nTry --help\n", arg);
+			return EXIT_FAILURE;
+		} else {
+			module_files[module_files_count] = arg;
+			module_files_count++;
+		}
+	}
+	if (module_files_count == 0) {
+		fprintf(stderr, "No modules to run\n");
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	struct Runner runner;
+	vm_init(&runner.vm);
+	interner_init(&runner.paths);
+	runmap_init(&runner.states, 16, NULL);
+	int result = EXIT_SUCCESS;
+	for (int i = 0; i < module_files_count && result == EXIT_SUCCESS; i++) {
+		if (!run(&runner, module_files[i]))
+			result = EXIT_FAILURE;
+	}
+	runmap_deinit(&runner.states);
+	interner_deinit(&runner.paths);
+	vm_deinit(&runner.vm);
+	return result;
+}
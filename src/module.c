@@ -0,0 +1,547 @@
+/* module.c
+ * Reads and writes binary modules (see module.h). The writer collects a
+ * module's code, constants, exports, imports and globals in memory,
+ * deduplicating constants, and writes them out as one file. The loader maps a file and
+ * points into it.
+ * author: Andrew Klinge
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "module.h"
+
+#define MODULE_WRITER_INITIAL_SIZE 256
+
+/* Rounds the size up to a multiple of MODULE_ALIGNMENT. */
+static inline uint64_t align(uint64_t size) {
+	return (size + MODULE_ALIGNMENT - 1) & ~(uint64_t) (MODULE_ALIGNMENT - 1);
+}
+
+/* Checks if the condition is true, and if not, then prints the error message
+ * for the module's file.
+ * Returns: whether the check failed (condition was false)
+ */
+static bool assert(bool condition, const char *file_name, FILE *err, const char *error_string) {
+	if (condition) return false;
+	fprintf(err, "Invalid module %s: %s\n", file_name, error_string);
+	return true;
+}
+
+/* Loads the module file for reading, mapping it into memory. Only the header
+ * and section table are read, so loading takes the same time for any amount
+ * of code. Errors are printed to err.
+ * Returns: whether succeeded
+ */
+bool module_load(struct Module *module, const char *file_name, FILE *err) {
+	memset(module, 0, sizeof(struct Module));
+	if (!source_open(&module->file, file_name)) {
+		fprintf(err, "Failed to open module %s\n", file_name);
+		return false;
+	}
+	const char *data = module->file.data;
+	size_t size = module->file.size;
+
+	const struct ModuleHeader *header = (const struct ModuleHeader*) data;
+	if (assert(size >= sizeof(struct ModuleHeader), file_name, err, "too small for header")
+		|| assert(memcmp(header->magic, MODULE_MAGIC, sizeof(header->magic)) == 0, file_name, err,
+			"not a C-Slim module")
+		|| assert(header->version == MODULE_VERSION, file_name, err,
+			"compiled by an incompatible version")
+		|| assert(header->byte_order == MODULE_BYTE_ORDER, file_name, err,
+			"compiled on a machine of different byte order")
+		|| assert(header->size == size, file_name, err, "truncated")
+		|| assert(header->register_count <= MODULE_MAX_REGISTERS, file_name, err, "frame too large")
+		|| assert(header->section_count <= (size - sizeof(struct ModuleHeader))
+			/ sizeof(struct ModuleSection), file_name, err, "section table out of bounds")) {
+		module_unload(module);
+		return false;
+	}
+
+	module->register_count = header->register_count;
+	const struct ModuleSection *sections = (const struct ModuleSection*) (header + 1);
+	for (uint32_t i = 0; i < header->section_count; i++) {
+		const struct ModuleSection *section = &sections[i];
+		if (assert(section->offset % MODULE_ALIGNMENT == 0
+			&& section->offset <= size && section->size <= size - section->offset,
+			file_name, err, "section out of bounds")) {
+			module_unload(module);
+			return false;
+		}
+		const void *start = data + section->offset;
+		size_t record_size;
+		switch (section->kind) {
+		case MODULE_SECTION_CODE:
+			module->code = start;
+			module->code_count = section->count;
+			record_size = sizeof(uint32_t);
+			break;
+		case MODULE_SECTION_CONSTANTS:
+			module->constants = start;
+			module->constant_count = section->count;
+			record_size = sizeof(struct ModuleConstant);
+			break;
+		case MODULE_SECTION_STRINGS:
+			module->strings = start;
+			module->strings_size = section->size;
+			record_size = 1;
+			break;
+		case MODULE_SECTION_EXPORTS:
+			module->exports = start;
+			module->export_count = section->count;
+			record_size = sizeof(struct ModuleExport);
+			break;
+		case MODULE_SECTION_IMPORTS:
+			module->imports = start;
+			module->import_count = section->count;
+			record_size = sizeof(uint32_t);
+			break;
+		case MODULE_SECTION_GLOBALS:
+			module->globals = start;
+			module->global_count = section->count;
+			record_size = sizeof(uint32_t);
+			break;
+		default:
+			continue; // from a newer minor revision, not needed to run
+		}
+		if (assert(section->count <= section->size / record_size, file_name, err,
+			"section records out of bounds")) {
+			module_unload(module);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Unmaps a loaded module. Does NOT free the module. */
+void module_unload(struct Module *module) {
+	if (module->file.data != NULL)
+		source_close(&module->file);
+	module->file.data = NULL;
+}
+
+/* Returns the null-terminated text of the string constant, NULL if the
+ * constant is not a string in bounds of the strings section.
+ */
+const char *module_string(const struct Module *module, int constant) {
+	if (constant < 0 || constant >= module->constant_count) return NULL;
+	const struct ModuleConstant *string = &module->constants[constant];
+	if (string->kind != CONSTANT_STRING || string->string_offset >= module->strings_size
+		|| string->length >= module->strings_size - string->string_offset
+		|| module->strings[string->string_offset + string->length] != '\0')
+		return NULL;
+	return module->strings + string->string_offset;
+}
+
+/* Finds the module's export of the given name, for `file:object` access.
+ * Exports are sorted by name, so this is a binary search in the mapped file.
+ * Returns: the export, NULL if there is none of that name
+ */
+const struct ModuleExport *module_find_export(const struct Module *module, const char *name, int length) {
+	int low = 0;
+	int high = module->export_count - 1;
+	while (low <= high) {
+		int middle = (low + high) / 2;
+		const struct ModuleExport *export = &module->exports[middle];
+		const char *export_name = module_string(module, export->name);
+		if (export_name == NULL) return NULL;
+		int export_length = module->constants[export->name].length;
+		int order = memcmp(export_name, name, (export_length < length) ? export_length : length);
+		if (order == 0) order = export_length - length;
+		if (order == 0) return export;
+		if (order < 0) {
+			low = middle + 1;
+		} else {
+			high = middle - 1;
+		}
+	}
+	return NULL;
+}
+
+const char *const opcode_names[OPCODES_COUNT] = {
+#define OPCODE_NAME(name, format) #name,
+	OPCODES(OPCODE_NAME)
+#undef OPCODE_NAME
+};
+
+const unsigned char opcode_formats[OPCODES_COUNT] = {
+#define OPCODE_FORMAT(name, format) format,
+	OPCODES(OPCODE_FORMAT)
+#undef OPCODE_FORMAT
+};
+
+/* Prints the instruction's operands as registers (r), constants (k),
+ * globals (g), immediate values and jump targets (@).
+ */
+static void print_operands(uint32_t instruction, FILE *out) {
+	switch (opcode_formats[INSTRUCTION_OP(instruction)]) {
+	case FORMAT_A:
+		fprintf(out, "r%u", OPERAND_A(instruction));
+		break;
+	case FORMAT_AB:
+	case FORMAT_ABJ:
+		fprintf(out, "r%u r%u", OPERAND_A(instruction), OPERAND_B(instruction));
+		break;
+	case FORMAT_ABC:
+		fprintf(out, "r%u r%u r%u", OPERAND_A(instruction), OPERAND_B(instruction), OPERAND_C(instruction));
+		break;
+	case FORMAT_ABN:
+		fprintf(out, "r%u r%u %u", OPERAND_A(instruction), OPERAND_B(instruction), OPERAND_C(instruction));
+		break;
+	case FORMAT_ABI:
+		fprintf(out, "r%u r%u %i", OPERAND_A(instruction), OPERAND_B(instruction), OPERAND_SC(instruction));
+		break;
+	case FORMAT_AK:
+		fprintf(out, "r%u k%u", OPERAND_A(instruction), OPERAND_BX(instruction));
+		break;
+	case FORMAT_AG:
+		fprintf(out, "r%u g%u", OPERAND_A(instruction), OPERAND_BX(instruction));
+		break;
+	case FORMAT_AI:
+	case FORMAT_AIJ:
+		fprintf(out, "r%u %i", OPERAND_A(instruction), OPERAND_SBX(instruction));
+		break;
+	case FORMAT_AT:
+		fprintf(out, "r%u @%u", OPERAND_A(instruction), OPERAND_BX(instruction));
+		break;
+	case FORMAT_T:
+		fprintf(out, "@%u", OPERAND_AX(instruction));
+		break;
+	case FORMAT_S:
+		fprintf(out, "k%u", OPERAND_AX(instruction));
+		break;
+	}
+}
+
+/* Gets the path of the module compiled from the source file: the source's
+ * path with its extension replaced by MODULE_EXTENSION. Stdin ("-") compiles
+ * to "stdin" MODULE_EXTENSION.
+ *
+ * path - where to store the path. must have room for
+ *      strlen(file_name) + sizeof("stdin" MODULE_EXTENSION) chars
+ */
+void module_path(const char *file_name, char *path) {
+	if (strcmp(file_name, "-") == 0) file_name = "stdin";
+	size_t length = strlen(file_name);
+	size_t extension_length = strlen(SOURCE_EXTENSION);
+	if (length > extension_length && strcmp(file_name + length - extension_length, SOURCE_EXTENSION) == 0)
+		length -= extension_length;
+	memcpy(path, file_name, length);
+	strcpy(path + length, MODULE_EXTENSION);
+}
+
+/* Prints the module's constants, exports, imports, globals and code, one per
+ * line.
+ */
+void module_print(const struct Module *module, FILE *out) {
+	for (int i = 0; i < module->constant_count; i++) {
+		const struct ModuleConstant *constant = &module->constants[i];
+		if (constant->kind == CONSTANT_INT) {
+			fprintf(out, "const %i: int %lli\n", i, (long long) constant->int_value);
+		} else if (constant->kind == CONSTANT_FLOAT) {
+			fprintf(out, "const %i: float %g\n", i, constant->float_value);
+		} else {
+			const char *string = module_string(module, i);
+			fprintf(out, "const %i: string \"%s\"\n", i, string != NULL ? string : "?");
+		}
+	}
+	for (int i = 0; i < module->export_count; i++) {
+		const struct ModuleExport *export = &module->exports[i];
+		const char *name = module_string(module, export->name);
+		fprintf(out, "export %s: kind %u at %u\n", name != NULL ? name : "?", export->kind, export->address);
+	}
+	for (int i = 0; i < module->import_count; i++) {
+		const char *path = module_string(module, module->imports[i]);
+		fprintf(out, "import \"%s\"\n", path != NULL ? path : "?");
+	}
+	static const char *const kind_names[] = {
+		[CONSTANT_INT] = "int",
+		[CONSTANT_FLOAT] = "float",
+		[CONSTANT_STRING] = "string"
+	};
+	for (int i = 0; i < module->global_count; i++) {
+		uint32_t kind = module->globals[i];
+		fprintf(out, "global %i: %s\n", i, (kind <= CONSTANT_STRING) ? kind_names[kind] : "?");
+	}
+	fprintf(out, "registers %i\n", module->register_count);
+	for (int i = 0; i < module->code_count; i++) {
+		int op = INSTRUCTION_OP(module->code[i]);
+		fprintf(out, "%4i  %-14s ", i, (op < OPCODES_COUNT) ? opcode_names[op] : "?");
+		if (op < OPCODES_COUNT) print_operands(module->code[i], out);
+		fprintf(out, "\n");
+	}
+}
+
+/* Initializes a writer with an empty module. */
+void module_writer_init(struct ModuleWriter *writer, Interner *interner) {
+	instructionvec_init(&writer->code, MODULE_WRITER_INITIAL_SIZE);
+	constantvec_init(&writer->constants, MODULE_WRITER_INITIAL_SIZE);
+	charvec_init(&writer->strings, MODULE_WRITER_INITIAL_SIZE);
+	exportvec_init(&writer->exports, MODULE_WRITER_INITIAL_SIZE);
+	indexvec_init(&writer->imports, MODULE_WRITER_INITIAL_SIZE);
+	indexvec_init(&writer->globals, MODULE_WRITER_INITIAL_SIZE);
+	constantmap_init(&writer->int_constants, MODULE_WRITER_INITIAL_SIZE, NULL);
+	constantmap_init(&writer->float_constants, MODULE_WRITER_INITIAL_SIZE, NULL);
+	constantmap_init(&writer->string_constants, MODULE_WRITER_INITIAL_SIZE, NULL);
+	constantmap_init(&writer->variable_globals, MODULE_WRITER_INITIAL_SIZE, NULL);
+	writer->register_count = 0;
+	writer->interner = interner;
+}
+
+/* Frees a writer's resources. Does NOT free the writer. */
+void module_writer_deinit(struct ModuleWriter *writer) {
+	instructionvec_deinit(&writer->code);
+	constantvec_deinit(&writer->constants);
+	charvec_deinit(&writer->strings);
+	exportvec_deinit(&writer->exports);
+	indexvec_deinit(&writer->imports);
+	indexvec_deinit(&writer->globals);
+	constantmap_deinit(&writer->int_constants);
+	constantmap_deinit(&writer->float_constants);
+	constantmap_deinit(&writer->string_constants);
+	constantmap_deinit(&writer->variable_globals);
+}
+
+/* Empties the writer for the next module, keeping its memory for reuse. */
+void module_writer_reset(struct ModuleWriter *writer) {
+	instructionvec_clear(&writer->code);
+	constantvec_clear(&writer->constants);
+	charvec_clear(&writer->strings);
+	exportvec_clear(&writer->exports);
+	indexvec_clear(&writer->imports);
+	indexvec_clear(&writer->globals);
+	constantmap_clear(&writer->int_constants);
+	constantmap_clear(&writer->float_constants);
+	constantmap_clear(&writer->string_constants);
+	constantmap_clear(&writer->variable_globals);
+	writer->register_count = 0;
+}
+
+/* Adds the constant to the pool unless an equal one was added under key.
+ * Returns: index of the constant, -1 if the pool is full
+ */
+static int add_constant(struct ModuleWriter *writer, ConstantMap *added, unsigned long key,
+	struct ModuleConstant *constant) {
+	int *index = constantmap_get(added, key);
+	if (index != NULL) return *index;
+	if (writer->constants.count >= MODULE_MAX_CONSTANTS) return -1;
+	constantvec_push(&writer->constants, *constant);
+	constantmap_put(added, key, writer->constants.count - 1);
+	return writer->constants.count - 1;
+}
+
+/* Returns: index of the int constant, -1 if the pool is full */
+int module_writer_int(struct ModuleWriter *writer, int64_t value) {
+	struct ModuleConstant constant = { .kind = CONSTANT_INT, .int_value = value };
+	return add_constant(writer, &writer->int_constants, value, &constant);
+}
+
+/* Returns: index of the float constant, -1 if the pool is full */
+int module_writer_float(struct ModuleWriter *writer, double value) {
+	struct ModuleConstant constant = { .kind = CONSTANT_FLOAT, .float_value = value };
+	unsigned long bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return add_constant(writer, &writer->float_constants, bits, &constant);
+}
+
+/* Returns: index of the constant for the interned string, -1 if the pool is full */
+int module_writer_string(struct ModuleWriter *writer, StrId string) {
+	int *index = constantmap_get(&writer->string_constants, string);
+	if (index != NULL) return *index;
+
+	int length = interner_length(writer->interner, string);
+	struct ModuleConstant constant = {
+		.kind = CONSTANT_STRING,
+		.length = length,
+		.string_offset = writer->strings.count
+	};
+	int added = add_constant(writer, &writer->string_constants, string, &constant);
+	if (added == -1) return -1;
+	charvec_reserve(&writer->strings, writer->strings.count + length + 1);
+	memcpy(writer->strings.items + writer->strings.count, interner_string(writer->interner, string), length + 1);
+	writer->strings.count += length + 1;
+	return added;
+}
+
+/* Gets the global holding a variable. Variables of the same number share a
+ * global only if their values are of the same kind, so that each global
+ * always holds values of one kind.
+ * Returns: index of the global, -1 if the module has too many
+ *
+ * variable - number of the variable, as the compiler numbers them
+ * kind - enum module_constants, of the variable's values
+ */
+int module_writer_global(struct ModuleWriter *writer, int variable, int kind) {
+	unsigned long key = (unsigned long) variable << 2 | kind;
+	int *index = constantmap_get(&writer->variable_globals, key);
+	if (index != NULL) return *index;
+	if (writer->globals.count >= MODULE_MAX_GLOBALS) return -1;
+	indexvec_push(&writer->globals, kind);
+	constantmap_put(&writer->variable_globals, key, writer->globals.count - 1);
+	return writer->globals.count - 1;
+}
+
+/* Appends an instruction to the module's code, growing the module's frame
+ * to hold the registers it uses.
+ * Returns: index of the instruction, -1 if the code is full
+ */
+int module_writer_emit(struct ModuleWriter *writer, uint32_t instruction) {
+	if (writer->code.count >= MODULE_MAX_CODE) return -1;
+	int registers = 0;
+	switch (opcode_formats[INSTRUCTION_OP(instruction)]) {
+	case FORMAT_ABC:
+		registers = OPERAND_C(instruction) + 1;
+		// fall through
+	case FORMAT_AB:
+	case FORMAT_ABN:
+	case FORMAT_ABI:
+	case FORMAT_ABJ:
+		if (OPERAND_B(instruction) >= registers) registers = OPERAND_B(instruction) + 1;
+		// fall through
+	case FORMAT_A:
+	case FORMAT_AK:
+	case FORMAT_AG:
+	case FORMAT_AI:
+	case FORMAT_AIJ:
+	case FORMAT_AT:
+		if (OPERAND_A(instruction) >= registers) registers = OPERAND_A(instruction) + 1;
+		break;
+	}
+	if (registers > writer->register_count) writer->register_count = registers;
+	instructionvec_push(&writer->code, instruction);
+	return writer->code.count - 1;
+}
+
+/* Sets the target of the jump instruction at the index, for jumps emitted
+ * before the code they jump to.
+ */
+void module_writer_patch(struct ModuleWriter *writer, int at, int target) {
+	uint32_t jump = writer->code.items[at];
+	if (opcode_formats[INSTRUCTION_OP(jump)] == FORMAT_T) {
+		writer->code.items[at] = INSTRUCTION_AX(INSTRUCTION_OP(jump), target);
+	} else {
+		writer->code.items[at] = INSTRUCTION_BX(INSTRUCTION_OP(jump), OPERAND_A(jump), target);
+	}
+}
+
+/* Exports a symbol by name. Names must be unique within the module.
+ * Returns: whether succeeded
+ *
+ * kind - enum symbols
+ * address - index of the symbol's first instruction
+ */
+bool module_writer_export(struct ModuleWriter *writer, StrId name, int kind, int address) {
+	int constant = module_writer_string(writer, name);
+	if (constant == -1) return false;
+	struct ModuleExport export = { .name = constant, .kind = kind, .address = address };
+	exportvec_push(&writer->exports, export);
+	return true;
+}
+
+/* Records a file the module includes.
+ * Returns: whether succeeded
+ */
+bool module_writer_import(struct ModuleWriter *writer, StrId path) {
+	int constant = module_writer_string(writer, path);
+	if (constant == -1) return false;
+	indexvec_push(&writer->imports, constant);
+	return true;
+}
+
+/* an export along with its name, for sorting exports by name. */
+struct NamedExport {
+	const char *name;
+	uint32_t length;
+	struct ModuleExport export;
+};
+
+static int compare_exports(const void *a, const void *b) {
+	const struct NamedExport *export_a = a;
+	const struct NamedExport *export_b = b;
+	uint32_t length = (export_a->length < export_b->length) ? export_a->length : export_b->length;
+	int order = memcmp(export_a->name, export_b->name, length);
+	return (order != 0) ? order : (int) export_a->length - (int) export_b->length;
+}
+
+/* Sorts the writer's exports by the text of their names. */
+static void sort_exports(struct ModuleWriter *writer) {
+	int count = writer->exports.count;
+	if (count < 2) return;
+	struct NamedExport *named = malloc(sizeof(struct NamedExport) * count);
+	for (int i = 0; i < count; i++) {
+		const struct ModuleConstant *name = &writer->constants.items[writer->exports.items[i].name];
+		named[i].name = writer->strings.items + name->string_offset;
+		named[i].length = name->length;
+		named[i].export = writer->exports.items[i];
+	}
+	qsort(named, count, sizeof(struct NamedExport), compare_exports);
+	for (int i = 0; i < count; i++) {
+		writer->exports.items[i] = named[i].export;
+	}
+	free(named);
+}
+
+/* Writes the data followed by padding up to MODULE_ALIGNMENT.
+ * Returns: whether succeeded
+ *
+ * position - offset in the file the data is written at. advanced past it
+ */
+static bool write_aligned(FILE *file, const void *data, size_t size, uint64_t *position) {
+	static const char padding[MODULE_ALIGNMENT];
+	size_t padding_size = align(*position + size) - (*position + size);
+	*position += size + padding_size;
+	return fwrite(data, 1, size, file) == size
+		&& fwrite(padding, 1, padding_size, file) == padding_size;
+}
+
+/* Writes the module to the file, ending its code with OP_HALT.
+ * Returns: whether succeeded
+ */
+bool module_writer_write(struct ModuleWriter *writer, FILE *file) {
+	if (writer->code.count == 0 || INSTRUCTION_OP(writer->code.items[writer->code.count - 1]) != OP_HALT)
+		module_writer_emit(writer, INSTRUCTION(OP_HALT, 0, 0, 0));
+	sort_exports(writer);
+
+	struct { int kind; int count; const void *data; size_t size; } contents[MODULE_SECTIONS_COUNT] = {
+		{ MODULE_SECTION_CODE, writer->code.count, writer->code.items,
+			writer->code.count * sizeof(uint32_t) },
+		{ MODULE_SECTION_CONSTANTS, writer->constants.count, writer->constants.items,
+			writer->constants.count * sizeof(struct ModuleConstant) },
+		{ MODULE_SECTION_STRINGS, writer->strings.count, writer->strings.items,
+			writer->strings.count },
+		{ MODULE_SECTION_EXPORTS, writer->exports.count, writer->exports.items,
+			writer->exports.count * sizeof(struct ModuleExport) },
+		{ MODULE_SECTION_IMPORTS, writer->imports.count, writer->imports.items,
+			writer->imports.count * sizeof(uint32_t) },
+		{ MODULE_SECTION_GLOBALS, writer->globals.count, writer->globals.items,
+			writer->globals.count * sizeof(uint32_t) }
+	};
+
+	struct ModuleSection sections[MODULE_SECTIONS_COUNT];
+	uint64_t offset = align(sizeof(struct ModuleHeader) + sizeof(sections));
+	for (int i = 0; i < MODULE_SECTIONS_COUNT; i++) {
+		sections[i].kind = contents[i].kind;
+		sections[i].count = contents[i].count;
+		sections[i].offset = offset;
+		sections[i].size = contents[i].size;
+		offset += align(contents[i].size);
+	}
+
+	struct ModuleHeader header = {
+		.magic = MODULE_MAGIC,
+		.version = MODULE_VERSION,
+		.byte_order = MODULE_BYTE_ORDER,
+		.section_count = MODULE_SECTIONS_COUNT,
+		.register_count = writer->register_count,
+		.size = offset
+	};
+	uint64_t position = 0;
+	if (fwrite(&header, 1, sizeof(header), file) != sizeof(header)) return false;
+	position += sizeof(header);
+	if (!write_aligned(file, sections, sizeof(sections), &position)) return false;
+	for (int i = 0; i < MODULE_SECTIONS_COUNT; i++) {
+		if (!write_aligned(file, contents[i].data, contents[i].size, &position)) return false;
+	}
+	return true;
+}
@@ -0,0 +1,263 @@
+/* module.h
+ * Binary module format (.csb) written by the compiler and executed in place
+ * by the interpreter.
+ *
+ * A module file is a header, a section table and the sections it points to,
+ * each aligned to MODULE_ALIGNMENT. Every record has a fixed width and the
+ * file is in the byte order of the machine that wrote it, so a loaded module
+ * is used straight from the mapped file: loading only checks the header and
+ * section table, whatever the size of the code.
+ * author: Andrew Klinge
+*/
+
+#ifndef __MODULE_H__
+#define __MODULE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "source.h"
+#include "utils/interner.h"
+#include "utils/map.h"
+#include "utils/vec.h"
+
+#define MODULE_MAGIC "CSB"
+#define MODULE_VERSION 5 // incremented whenever the format changes
+#define MODULE_BYTE_ORDER 0x01020304 // as written by the writing machine
+#define MODULE_ALIGNMENT 8
+#define SOURCE_EXTENSION ".cslim"
+#define MODULE_EXTENSION ".csb"
+
+/* instructions are 32 bits: an 8-bit opcode then either three 8-bit operands
+ * a, b and c, an 8-bit a and a 16-bit bx (sbx when signed), or a 24-bit ax.
+ * registers are the slots of the module's frame, so 8 bits address all of
+ * them. variables beyond the registers are the module's globals, which only
+ * GET_GLOBAL and SET_GLOBAL address, by bx. 16-bit operands limit the
+ * globals, constants and instructions a module can have.
+ */
+#define MODULE_MAX_REGISTERS 256
+#define MODULE_MAX_GLOBALS 0x10000
+#define MODULE_MAX_CONSTANTS 0x10000
+#define MODULE_MAX_CODE 0x10000
+#define MODULE_MIN_IMMEDIATE INT16_MIN
+#define MODULE_MAX_IMMEDIATE INT16_MAX
+#define MODULE_MIN_SMALL_IMMEDIATE INT8_MIN // of an sc operand
+#define MODULE_MAX_SMALL_IMMEDIATE INT8_MAX
+#define INSTRUCTION(op, a, b, c) \
+	((uint32_t) (op) | (uint32_t) (a) << 8 | (uint32_t) (b) << 16 | (uint32_t) (c) << 24)
+#define INSTRUCTION_BX(op, a, bx) ((uint32_t) (op) | (uint32_t) (a) << 8 | (uint32_t) (uint16_t) (bx) << 16)
+#define INSTRUCTION_AX(op, ax) ((uint32_t) (op) | (uint32_t) (ax) << 8)
+#define INSTRUCTION_OP(instruction) ((instruction) & 0xFF)
+#define OPERAND_A(instruction) ((instruction) >> 8 & 0xFF)
+#define OPERAND_B(instruction) ((instruction) >> 16 & 0xFF)
+#define OPERAND_C(instruction) ((instruction) >> 24)
+#define OPERAND_SC(instruction) ((int8_t) ((instruction) >> 24))
+#define OPERAND_BX(instruction) ((instruction) >> 16)
+#define OPERAND_SBX(instruction) ((int16_t) ((instruction) >> 16))
+#define OPERAND_AX(instruction) ((instruction) >> 8)
+
+// which operands an instruction has and what they index
+enum formats {
+	FORMAT_NONE,
+	FORMAT_A, // a: register
+	FORMAT_AB, // a, b: registers
+	FORMAT_ABC, // a, b, c: registers
+	FORMAT_ABN, // a, b: registers, c: shift amount, less than 64
+	FORMAT_ABI, // a, b: registers, sc: signed immediate value
+	FORMAT_ABJ, // a, b: registers, then the JUMP the instruction branches with
+	FORMAT_AIJ, // a: register, sbx: signed immediate value, then the JUMP the instruction branches with
+	FORMAT_AK, // a: register, bx: constant
+	FORMAT_AG, // a: register, bx: global
+	FORMAT_AI, // a: register, sbx: signed immediate value
+	FORMAT_AT, // a: register, bx: index of the instruction to jump to
+	FORMAT_T, // ax: index of the instruction to jump to
+	FORMAT_S // ax: string constant
+};
+
+/* every instruction: X(name, format). a is the register written, if any, and
+ * b and c the registers read. arithmetic is typed, so INT and FLOAT
+ * instructions read the same registers differently.
+ *
+ * BRANCH instructions are a comparison fused with the JUMP after it, which
+ * is taken only if the comparison is false and skipped otherwise, so that
+ * testing a condition is a single dispatch. they read a and b, or a and an
+ * immediate value.
+ */
+#define OPCODES(X) \
+	X(NOP, FORMAT_NONE) \
+	X(HALT, FORMAT_NONE) /* end of the module's code */ \
+	X(BREAK, FORMAT_NONE) /* outside of a loop, ends the module */ \
+	X(BREAK_LABEL, FORMAT_S) /* ax: the label's name */ \
+	X(CONST, FORMAT_AK) \
+	X(INT, FORMAT_AI) \
+	X(MOVE, FORMAT_AB) \
+	X(GET_GLOBAL, FORMAT_AG) \
+	X(SET_GLOBAL, FORMAT_AG) /* reads a */ \
+	X(ADD_INT, FORMAT_ABC) \
+	X(SUB_INT, FORMAT_ABC) \
+	X(MUL_INT, FORMAT_ABC) \
+	X(DIV_INT, FORMAT_ABC) \
+	X(MOD_INT, FORMAT_ABC) \
+	X(NEG_INT, FORMAT_AB) \
+	X(ADD_INT_IMM, FORMAT_ABI) /* b + sc */ \
+	X(SHL_INT, FORMAT_ABN) /* b * 2^c */ \
+	X(DIV_POW2_INT, FORMAT_ABN) /* b / 2^c, rounded toward zero like DIV_INT */ \
+	X(MOD_POW2_INT, FORMAT_ABN) /* b % 2^c, of the sign of b like MOD_INT */ \
+	X(LESS_INT, FORMAT_ABC) \
+	X(LESS_EQUAL_INT, FORMAT_ABC) \
+	X(EQUAL_INT, FORMAT_ABC) \
+	X(NOT_EQUAL_INT, FORMAT_ABC) \
+	X(ADD_FLOAT, FORMAT_ABC) \
+	X(SUB_FLOAT, FORMAT_ABC) \
+	X(MUL_FLOAT, FORMAT_ABC) \
+	X(DIV_FLOAT, FORMAT_ABC) \
+	X(NEG_FLOAT, FORMAT_AB) \
+	X(LESS_FLOAT, FORMAT_ABC) \
+	X(LESS_EQUAL_FLOAT, FORMAT_ABC) \
+	X(EQUAL_FLOAT, FORMAT_ABC) \
+	X(NOT_EQUAL_FLOAT, FORMAT_ABC) \
+	X(INT_TO_FLOAT, FORMAT_AB) \
+	X(NOT, FORMAT_AB) \
+	X(JUMP, FORMAT_T) \
+	X(JUMP_IF_FALSE, FORMAT_AT) /* a: the condition */ \
+	X(BRANCH_LESS_INT, FORMAT_ABJ) \
+	X(BRANCH_LESS_EQUAL_INT, FORMAT_ABJ) \
+	X(BRANCH_EQUAL_INT, FORMAT_ABJ) \
+	X(BRANCH_NOT_EQUAL_INT, FORMAT_ABJ) \
+	X(BRANCH_LESS_INT_IMM, FORMAT_AIJ) \
+	X(BRANCH_LESS_EQUAL_INT_IMM, FORMAT_AIJ) \
+	X(BRANCH_GREATER_INT_IMM, FORMAT_AIJ) \
+	X(BRANCH_GREATER_EQUAL_INT_IMM, FORMAT_AIJ) \
+	X(BRANCH_EQUAL_INT_IMM, FORMAT_AIJ) \
+	X(BRANCH_NOT_EQUAL_INT_IMM, FORMAT_AIJ) \
+	X(PRINT_INT, FORMAT_A) /* a: the value printed */ \
+	X(PRINT_FLOAT, FORMAT_A) \
+	X(PRINT_STRING, FORMAT_A)
+
+enum opcodes {
+#define OPCODE_ENUM(name, format) OP_##name,
+	OPCODES(OPCODE_ENUM)
+#undef OPCODE_ENUM
+	OPCODES_COUNT
+};
+
+extern const char *const opcode_names[OPCODES_COUNT];
+extern const unsigned char opcode_formats[OPCODES_COUNT]; // enum formats
+
+enum module_sections {
+	MODULE_SECTION_CODE, // uint32_t instructions
+	MODULE_SECTION_CONSTANTS, // struct ModuleConstant
+	MODULE_SECTION_STRINGS, // null-terminated text of string constants
+	MODULE_SECTION_EXPORTS, // struct ModuleExport, sorted by name
+	MODULE_SECTION_IMPORTS, // uint32_t constant index of each included path
+	MODULE_SECTION_GLOBALS, // uint32_t enum module_constants, kind of each global's value
+	MODULE_SECTIONS_COUNT
+};
+
+enum module_constants {
+	CONSTANT_INT,
+	CONSTANT_FLOAT,
+	CONSTANT_STRING
+};
+
+struct ModuleHeader {
+	char magic[4]; // MODULE_MAGIC
+	uint32_t version; // MODULE_VERSION
+	uint32_t byte_order; // MODULE_BYTE_ORDER
+	uint32_t section_count;
+	uint32_t register_count; // size of the module's frame
+	uint32_t reserved;
+	uint64_t size; // of the whole file
+};
+
+struct ModuleSection {
+	uint32_t kind; // enum module_sections
+	uint32_t count; // number of records
+	uint64_t offset; // from the start of the file
+	uint64_t size; // in bytes
+};
+
+struct ModuleConstant {
+	uint32_t kind; // enum module_constants
+	uint32_t length; // of a string, in bytes excluding the null terminator
+	union {
+		int64_t int_value;
+		double float_value;
+		uint64_t string_offset; // into the strings section
+	};
+};
+
+struct ModuleExport {
+	uint32_t name; // constant index of the name string
+	uint32_t kind; // enum symbols
+	uint32_t address; // instruction index
+	uint32_t reserved;
+};
+
+/* a module loaded for reading. points into the loaded file. */
+struct Module {
+	struct Source file;
+	const uint32_t *code;
+	int code_count;
+	int register_count;
+	const struct ModuleConstant *constants;
+	int constant_count;
+	const char *strings;
+	size_t strings_size;
+	const struct ModuleExport *exports;
+	int export_count;
+	const uint32_t *imports;
+	int import_count;
+	const uint32_t *globals;
+	int global_count;
+};
+
+bool module_load(struct Module *module, const char *file_name, FILE *err);
+void module_unload(struct Module *module);
+
+const char *module_string(const struct Module *module, int constant);
+const struct ModuleExport *module_find_export(const struct Module *module, const char *name, int length);
+void module_print(const struct Module *module, FILE *out);
+void module_path(const char *file_name, char *path);
+
+DEFINE_VEC(InstructionVec, instructionvec, uint32_t)
+DEFINE_VEC(ConstantVec, constantvec, struct ModuleConstant)
+DEFINE_VEC(ExportVec, exportvec, struct ModuleExport)
+DEFINE_VEC(CharVec, charvec, char)
+DEFINE_VEC(IndexVec, indexvec, uint32_t)
+DEFINE_MAP(ConstantMap, constantmap, unsigned long, int, map_hash_int, map_int_equal)
+
+/* builds a module in memory and writes it out. */
+struct ModuleWriter {
+	InstructionVec code;
+	ConstantVec constants;
+	CharVec strings;
+	ExportVec exports;
+	IndexVec imports; // constant index of each included path
+	IndexVec globals; // kind of each global
+	int register_count; // one past the highest register the code uses
+	// constant index of each value already added, for deduplication
+	ConstantMap int_constants; // by value
+	ConstantMap float_constants; // by bits of the value
+	ConstantMap string_constants; // by StrId
+	ConstantMap variable_globals; // global index of each variable, by number and kind
+	Interner *interner;
+};
+
+void module_writer_init(struct ModuleWriter *writer, Interner *interner);
+void module_writer_deinit(struct ModuleWriter *writer);
+void module_writer_reset(struct ModuleWriter *writer);
+
+int module_writer_int(struct ModuleWriter *writer, int64_t value);
+int module_writer_float(struct ModuleWriter *writer, double value);
+int module_writer_string(struct ModuleWriter *writer, StrId string);
+int module_writer_global(struct ModuleWriter *writer, int variable, int kind);
+int module_writer_emit(struct ModuleWriter *writer, uint32_t instruction);
+void module_writer_patch(struct ModuleWriter *writer, int at, int target);
+bool module_writer_export(struct ModuleWriter *writer, StrId name, int kind, int address);
+bool module_writer_import(struct ModuleWriter *writer, StrId path);
+
+bool module_writer_write(struct ModuleWriter *writer, FILE *file);
+
+#endif
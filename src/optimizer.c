@@ -0,0 +1,235 @@
+/* optimizer.c
+ * Simplifies the expressions of parsed statements before their code is
+ * generated. Operations on constants are computed at compile time exactly as
+ * the VM computes them at run time: int arithmetic wraps around, and int
+ * division by zero is left to fail at run time. Int additions and
+ * multiplications by constants are regrouped so that their constants fold
+ * together, and multiplications and divisions by powers of two are reduced
+ * to shifts. A simplification may drop an operation, but never an operand,
+ * since evaluating it could fail at run time.
+ * author: Andrew Klinge
+*/
+
+#include <string.h>
+#include <stdint.h>
+
+#include "optimizer.h"
+
+static inline int64_t add_int(int64_t a, int64_t b) {
+	return (int64_t) ((uint64_t) a + (uint64_t) b);
+}
+
+static inline int64_t mul_int(int64_t a, int64_t b) {
+	return (int64_t) ((uint64_t) a * (uint64_t) b);
+}
+
+static inline int64_t neg_int(int64_t a) {
+	return (int64_t) -(uint64_t) a;
+}
+
+static inline void set_int(struct Expr *expr, int64_t value) {
+	expr->id = EXPR_INT;
+	expr->type = TYPE_INT;
+	expr->int_value = value;
+}
+
+static inline void set_float(struct Expr *expr, double value) {
+	expr->id = EXPR_FLOAT;
+	expr->type = TYPE_FLOAT;
+	expr->float_value = value;
+}
+
+/* Computes the unary operation if its operand is a literal. */
+static void fold_unary(struct Expr *nodes, struct Expr *expr) {
+	const struct Expr *operand = &nodes[expr->left];
+	if (expr->id == EXPR_NEG && operand->id == EXPR_NEG) {
+		*expr = nodes[operand->left]; // negation is its own inverse, even wrapping around
+		return;
+	}
+	if (expr->id == EXPR_NOT && (operand->id == EXPR_EQUAL || operand->id == EXPR_NOT_EQUAL)) {
+		*expr = *operand;
+		expr->id = (operand->id == EXPR_EQUAL) ? EXPR_NOT_EQUAL : EXPR_EQUAL;
+		return;
+	}
+	if (expr->id == EXPR_NOT && (operand->id == EXPR_LESS || operand->id == EXPR_LESS_EQUAL)
+		&& nodes[operand->left].type == TYPE_INT) {
+		// !(a < b) is b <= a and !(a <= b) is b < a, though not for NaN floats
+		*expr = *operand;
+		expr->id = (operand->id == EXPR_LESS) ? EXPR_LESS_EQUAL : EXPR_LESS;
+		expr->left = operand->right;
+		expr->right = operand->left;
+		return;
+	}
+	if (operand->id == EXPR_INT) {
+		int64_t value = operand->int_value;
+		if (expr->id == EXPR_NEG) set_int(expr, neg_int(value));
+		else if (expr->id == EXPR_NOT) set_int(expr, !value);
+		else set_float(expr, (double) value);
+	} else if (operand->id == EXPR_FLOAT && expr->id == EXPR_NEG) {
+		set_float(expr, -operand->float_value);
+	}
+}
+
+/* Computes the binary operation if both of its operands are literals.
+ * Returns: whether it was computed
+ */
+static bool fold_binary(struct Expr *nodes, struct Expr *expr) {
+	const struct Expr *left = &nodes[expr->left];
+	const struct Expr *right = &nodes[expr->right];
+	if (left->id == EXPR_INT && right->id == EXPR_INT) {
+		int64_t a = left->int_value;
+		int64_t b = right->int_value;
+		if ((expr->id == EXPR_DIV || expr->id == EXPR_MOD) && b == 0) return false;
+		switch (expr->id) {
+		case EXPR_ADD: set_int(expr, add_int(a, b)); break;
+		case EXPR_SUB: set_int(expr, add_int(a, neg_int(b))); break;
+		case EXPR_MUL: set_int(expr, mul_int(a, b)); break;
+		// INT64_MIN / -1 overflows, so negating is done unsigned
+		case EXPR_DIV: set_int(expr, (b == -1) ? neg_int(a) : a / b); break;
+		case EXPR_MOD: set_int(expr, (b == -1) ? 0 : a % b); break;
+		case EXPR_LESS: set_int(expr, a < b); break;
+		case EXPR_LESS_EQUAL: set_int(expr, a <= b); break;
+		case EXPR_EQUAL: set_int(expr, a == b); break;
+		case EXPR_NOT_EQUAL: set_int(expr, a != b); break;
+		default: return false;
+		}
+		return true;
+	} else if (left->id == EXPR_FLOAT && right->id == EXPR_FLOAT) {
+		double a = left->float_value;
+		double b = right->float_value;
+		switch (expr->id) {
+		case EXPR_ADD: set_float(expr, a + b); break;
+		case EXPR_SUB: set_float(expr, a - b); break;
+		case EXPR_MUL: set_float(expr, a * b); break;
+		case EXPR_DIV: set_float(expr, a / b); break;
+		case EXPR_LESS: set_int(expr, a < b); break;
+		case EXPR_LESS_EQUAL: set_int(expr, a <= b); break;
+		case EXPR_EQUAL: set_int(expr, a == b); break;
+		case EXPR_NOT_EQUAL: set_int(expr, a != b); break;
+		default: return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+/* Simplifies int arithmetic with a literal operand: moves the literal to
+ * the right, regroups it with the literal of a like operation on the left,
+ * and drops the operation if it is then an identity. x * 0 is not reduced
+ * to 0, since that would drop x.
+ */
+static void simplify_int(struct Expr *nodes, struct Expr *expr) {
+	if (expr->id != EXPR_ADD && expr->id != EXPR_SUB && expr->id != EXPR_MUL && expr->id != EXPR_DIV)
+		return;
+	if ((expr->id == EXPR_ADD || expr->id == EXPR_MUL) && nodes[expr->left].id == EXPR_INT) {
+		ExprId literal = expr->left;
+		expr->left = expr->right;
+		expr->right = literal;
+	}
+	struct Expr *left = &nodes[expr->left];
+	struct Expr *right = &nodes[expr->right];
+	if (right->id != EXPR_INT) return;
+
+	if (expr->id == EXPR_SUB) {
+		expr->id = EXPR_ADD;
+		right->int_value = neg_int(right->int_value);
+	}
+	// wrapping addition and multiplication are associative, so
+	// (x + a) + b = x + (a + b) and (x * a) * b = x * (a * b)
+	if ((expr->id == EXPR_ADD || expr->id == EXPR_MUL) && left->id == expr->id && nodes[left->right].id == EXPR_INT) {
+		right->int_value = (expr->id == EXPR_ADD)
+			? add_int(nodes[left->right].int_value, right->int_value)
+			: mul_int(nodes[left->right].int_value, right->int_value);
+		expr->left = left->left;
+		left = &nodes[expr->left];
+	}
+	if ((expr->id == EXPR_ADD && right->int_value == 0)
+		|| ((expr->id == EXPR_MUL || expr->id == EXPR_DIV) && right->int_value == 1))
+		*expr = *left;
+}
+
+/* Folds the node's constant operation, once its operands are folded. */
+static void fold(struct Expr *nodes, struct Expr *expr) {
+	switch (expr->id) {
+	case EXPR_INT:
+	case EXPR_FLOAT:
+	case EXPR_STRING:
+	case EXPR_VAR:
+		return;
+	case EXPR_NEG:
+	case EXPR_NOT:
+	case EXPR_INT_TO_FLOAT:
+		fold_unary(nodes, expr);
+		return;
+	default:
+		if (!fold_binary(nodes, expr) && nodes[expr->left].type == TYPE_INT)
+			simplify_int(nodes, expr);
+		return;
+	}
+}
+
+/* Returns the power of two the value is, from 1 to 62, 0 if it is not one. */
+static inline int power_of_two(int64_t value) {
+	return (value > 1 && (value & (value - 1)) == 0) ? __builtin_ctzll(value) : 0;
+}
+
+/* Returns whether the value is a power of two whose reciprocal is a normal
+ * float, so that dividing by the value is exactly multiplying by it.
+ */
+static inline bool exact_reciprocal(double value) {
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	int exponent = (bits >> 52) & 0x7FF;
+	return (bits & ((UINT64_C(1) << 52) - 1)) == 0 && exponent >= 1 && exponent <= 2045;
+}
+
+/* Reduces multiplications, divisions and remainders by powers of two to
+ * cheaper operations, throughout the folded expression. Folding leaves
+ * nodes that are no longer part of the expression, sharing operands with
+ * ones that are, so this walks the expression's tree rather than its nodes.
+ */
+static void reduce(struct Expr *nodes, ExprId id) {
+	struct Expr *expr = &nodes[id];
+	if (expr->id == EXPR_INT || expr->id == EXPR_FLOAT || expr->id == EXPR_STRING || expr->id == EXPR_VAR)
+		return;
+	reduce(nodes, expr->left);
+	if (expr->id == EXPR_NEG || expr->id == EXPR_NOT || expr->id == EXPR_INT_TO_FLOAT)
+		return;
+	reduce(nodes, expr->right);
+
+	struct Expr *right = &nodes[expr->right];
+	if (right->id == EXPR_INT) {
+		int power = power_of_two(right->int_value);
+		if (power == 0) return;
+		if (expr->id == EXPR_MUL) expr->id = EXPR_SHL;
+		else if (expr->id == EXPR_DIV) expr->id = EXPR_DIV_POW2;
+		else if (expr->id == EXPR_MOD) expr->id = EXPR_MOD_POW2;
+		else return;
+		right->int_value = power;
+	} else if (right->id == EXPR_FLOAT && expr->id == EXPR_DIV && exact_reciprocal(right->float_value)) {
+		expr->id = EXPR_MUL;
+		right->float_value = 1.0 / right->float_value;
+	}
+}
+
+/* Simplifies the statement's expression in place. Every node comes after
+ * its operands, so folding the nodes in order folds each operation after
+ * its operands.
+ */
+void optimizer_fold(struct Statement *statement) {
+	if (statement->expr == EXPR_ID_NONE) return;
+	for (ExprId id = 0; id <= statement->expr; id++) {
+		fold(statement->nodes, &statement->nodes[id]);
+	}
+	reduce(statement->nodes, statement->expr);
+}
+
+/* Returns whether the statement's condition is constant, storing whether it
+ * is true in value if so.
+ */
+bool optimizer_constant_condition(const struct Statement *statement, bool *value) {
+	const struct Expr *condition = &statement->nodes[statement->expr];
+	if (condition->id != EXPR_INT) return false;
+	*value = condition->int_value != 0;
+	return true;
+}
@@ -0,0 +1,16 @@
+/* optimizer.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __OPTIMIZER_H__
+#define __OPTIMIZER_H__
+
+#include <stdbool.h>
+
+#include "statement.h"
+
+void optimizer_fold(struct Statement *statement);
+
+bool optimizer_constant_condition(const struct Statement *statement, bool *value);
+
+#endif
@@ -1,5 +1,15 @@
 /* parser.c
- * Parses statements from sequences of tokens.
+ * Parses statements from a sequence of tokens, one token at a time. Each
+ * token moves the statement being parsed to its next state, so tokens are
+ * never buffered and a statement takes time in proportion to its tokens.
+ *
+ * Expressions are parsed by the binding power of their operators, as a Pratt
+ * parser does, with the parser's recursion kept in explicit stacks of
+ * operands and operators so that it can stop between any two tokens. An
+ * operator waits on its stack until one that binds less tightly arrives or
+ * the expression ends, and is then applied to the operands on top of theirs.
+ * The nodes of a statement's expressions are built into one array, each
+ * after its operands, and refer to their operands by 32-bit index.
  * author: Andrew Klinge
 */
 
@@ -7,60 +17,82 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "parser.h"
 #include "token.h"
 #include "symtable.h"
 
-#define PARSER_TOKENBUF_SIZE 4096
+#define PARSER_NODES_INITIAL_SIZE 64
+#define PARSER_STACK_INITIAL_SIZE 16
+
+// what the statement being parsed expects next
+enum parse_states {
+	STATE_START, // the first token of a statement
+	STATE_SKIP, // any token up to `;`, of a preprocessor command without effect
+	STATE_INCLUDE, // the path of `#include "path";`
+	STATE_BREAK, // `;` or the label of `break label;`
+	STATE_END, // the `;` ending the statement
+	STATE_NAME, // the name of the variable being declared
+	STATE_DECLARED, // `=` or `;` after the name of the variable being declared
+	STATE_ASSIGN, // `=` after the name of the variable being assigned
+	STATE_VALUE, // the tokens of the value, up to `;`
+	STATE_CONDITION_OPEN, // the `(` of an IF's or WHILE's condition
+	STATE_CONDITION, // the tokens of the condition, up to its `)`
+	STATE_BLOCK_OPEN // the `{` after an IF's or WHILE's condition, or after ELSE
+};
 
-void parser_init(struct Parser *parser) {
-	hashtable_init(&parser->included_files, 32, 0);
-	parser->tokenbuf = malloc(PARSER_TOKENBUF_SIZE * sizeof(struct Token));
-	parser->tokenbuf_count = 0;
+// how a token added to an expression affects it
+enum expression_results {
+	EXPRESSION_MORE, // the token is part of the expression
+	EXPRESSION_END, // the token follows the expression, which is complete
+	EXPRESSION_ERROR
+};
 
-	// so we don't free random memory when overwriting in tokenbuf
-	parser->tokenbuf[0].string = NULL;
+void parser_init(struct Parser *parser, Interner *interner, Arena *arena) {
+	exprvec_init(&parser->nodes, PARSER_NODES_INITIAL_SIZE);
+	expridvec_init(&parser->operands, PARSER_STACK_INITIAL_SIZE);
+	operatorvec_init(&parser->operators, PARSER_STACK_INITIAL_SIZE);
+	parser->blocks = malloc(SYMTABLE_MAX_SCOPES);
+	parser->state = STATE_START;
+	parser->closed_if = false;
+	parser->interner = interner;
+	parser->arena = arena;
+	parser->text = NULL;
+	parser->err = stderr;
 }
 
-/* Extracts the string contents from the string token.
- * example: "abc123" -> abc123
+/* Frees a Parser's resources. Does NOT free the parser. */
+void parser_deinit(struct Parser *parser) {
+	exprvec_deinit(&parser->nodes);
+	expridvec_deinit(&parser->operands);
+	operatorvec_deinit(&parser->operators);
+	free(parser->blocks);
+}
+
+/* Sets the source text that the tokens to be parsed were scanned from.
+ * Discards any incomplete statement from the previous source. Per-source
+ * data is allocated from the parser's arena, so it must be reset first.
  */
-static char *strtok_to_string(char *strtok) {
-	int new_length = strlen(strtok) - 2 + 1; // -2 for "", +1 for \0
-	char *string = malloc(sizeof(char) * new_length);
-	for (int i = 0; i < new_length - 1; i++) {
-		string[i] = strtok[i + 1];
-	}
-	strtok[new_length - 1] = '\0';
-	return string;
+void parser_set_source(struct Parser *parser, const struct Source *source) {
+	parser->text = source->data;
+	parser->state = STATE_START;
+	parser->closed_if = false;
+	exprvec_clear(&parser->nodes);
 }
 
-/* Prints the parser's current line info (formatted to be appended after some message). */
+/* Prints the parser's current line info (formatted to be appended after
+ * some message): the text of the statement being parsed, up to its last token.
+ */
 static void print_line_info(struct Parser *parser) {
-	// recreate string line of code from tokens buffer
-	int string_length;
-	for (int i = 0; i < parser->tokenbuf_count; i++) {
-		string_length += strlen(parser->tokenbuf[i].string) + 1; // +1 for spacing
-	}
-	
-	char string[string_length];
-	int string_index = 0;
-	for (int i = 0; i < parser->tokenbuf_count; i++) {
-		char *token_string = parser->tokenbuf[i].string;
-		int j = 0;
-		for (; token_string[j] != '\0'; j++) {
-			string[string_index + j] = token_string[j];
-		}
-		string[string_index + j] = ' ';
-		string_index += j + 1;
-	}
-	string[string_index - 1] = '\0';
-	fprintf(stderr, " at line %i: \n\t%s\n", parser->tokenbuf[0].ln, string);
+	int start = parser->first.site_offset;
+	int end = parser->last.site_offset + parser->last.site_length;
+	if (end < start) end = start;
+	fprintf(parser->err, " at line %i: \n\t%.*s\n", parser->first.ln, end - start, parser->text + start);
 }
 
 /* Checks if the condition is true, and if not, then prints the error message, along with the current line and token information.
- * Variable arguments at end are for error_string format args. 
+ * Variable arguments at end are for error_string format args.
  * Returns: whether the check failed (condition was false)
  */
 static bool assert(bool condition, struct Parser *parser, const char *error_string, ...) {
@@ -68,13 +100,455 @@ static bool assert(bool condition, struct Parser *parser, const char *error_stri
 
 	va_list va;
 	va_start(va, error_string);
-	vfprintf(stderr, error_string, va);
+	vfprintf(parser->err, error_string, va);
 	va_end(va);
 
 	print_line_info(parser);
 	return true;
 }
 
+static const char *const type_names[] = {
+	[TYPE_INT] = "int",
+	[TYPE_FLOAT] = "float",
+	[TYPE_STRING] = "string"
+};
+
+/* Returns whether the token is the operator. */
+static inline bool is_operator(struct Parser *parser, const struct Token *token, const char *operator) {
+	return (token->id == TOKEN_OPERATOR || token->id == TOKEN_OPERATOR_DIVIDE) && token->length == (int) strlen(operator)
+		&& memcmp(parser->text + token->offset, operator, token->length) == 0;
+}
+
+/* an operator, with how tightly it binds its operands (its binding power).
+ * `a > b` is parsed as `b < a`, and `a >= b` as `b <= a`.
+ */
+struct Operator {
+	const char *text;
+	int id; // enum expressions
+	int precedence;
+	bool prefix; // applies to the one operand after it, else to the operands on either side
+	bool swapped; // operands are swapped
+};
+
+static const struct Operator binary_operators[] = {
+	{ "==", EXPR_EQUAL, 1, false, false },
+	{ "!=", EXPR_NOT_EQUAL, 1, false, false },
+	{ "<", EXPR_LESS, 2, false, false },
+	{ "<=", EXPR_LESS_EQUAL, 2, false, false },
+	{ ">", EXPR_LESS, 2, false, true },
+	{ ">=", EXPR_LESS_EQUAL, 2, false, true },
+	{ "+", EXPR_ADD, 3, false, false },
+	{ "-", EXPR_SUB, 3, false, false },
+	{ "*", EXPR_MUL, 4, false, false },
+	{ "/", EXPR_DIV, 4, false, false },
+	{ "%", EXPR_MOD, 4, false, false }
+};
+
+// bind tighter than any binary operator
+static const struct Operator prefix_operators[] = {
+	{ "-", EXPR_NEG, 5, true, false },
+	{ "!", EXPR_NOT, 5, true, false }
+};
+
+/* Returns the token's operator from the table, NULL if it is none of them. */
+static const struct Operator *find_operator(struct Parser *parser, const struct Token *token,
+	const struct Operator *operators, int count) {
+	for (int i = 0; i < count; i++) {
+		if (is_operator(parser, token, operators[i].text)) return &operators[i];
+	}
+	return NULL;
+}
+
+/* Adds a node to the expressions of the statement being parsed.
+ * Returns: its index
+ */
+static ExprId new_expr(struct Parser *parser, int id, int type) {
+	exprvec_push(&parser->nodes, (struct Expr) { .id = id, .type = type });
+	return parser->nodes.count - 1;
+}
+
+/* Converts the expression to the type, if it converts implicitly.
+ * Returns: the converted expression, EXPR_ID_NONE if it does not convert
+ */
+static ExprId convert(struct Parser *parser, ExprId expr, int type) {
+	int from = parser->nodes.items[expr].type;
+	if (from == type) return expr;
+	if (from != TYPE_INT || type != TYPE_FLOAT) return EXPR_ID_NONE;
+	ExprId conversion = new_expr(parser, EXPR_INT_TO_FLOAT, TYPE_FLOAT);
+	parser->nodes.items[conversion].left = expr;
+	parser->nodes.items[conversion].right = EXPR_ID_NONE;
+	return conversion;
+}
+
+/* Returns: the prefix operator's expression of the operand, EXPR_ID_NONE
+ * (after printing an error) if the operator does not apply to it
+ */
+static ExprId new_unary(struct Parser *parser, const struct Operator *operator, ExprId operand) {
+	int type = parser->nodes.items[operand].type;
+	if (assert((operator->id == EXPR_NOT) ? type == TYPE_INT : type != TYPE_STRING, parser,
+		"Invalid operand %s of `%s`", type_names[type], operator->text))
+		return EXPR_ID_NONE;
+	ExprId expr = new_expr(parser, operator->id, type);
+	parser->nodes.items[expr].left = operand;
+	parser->nodes.items[expr].right = EXPR_ID_NONE;
+	return expr;
+}
+
+/* Returns: the binary expression of the operands, converted to a common type,
+ * EXPR_ID_NONE (after printing an error) if the operator does not apply to them
+ */
+static ExprId new_binary(struct Parser *parser, const struct Operator *operator, ExprId left, ExprId right) {
+	int left_type = parser->nodes.items[left].type;
+	int right_type = parser->nodes.items[right].type;
+	int type = (left_type == TYPE_FLOAT || right_type == TYPE_FLOAT) ? TYPE_FLOAT : TYPE_INT;
+	if (assert(left_type != TYPE_STRING && right_type != TYPE_STRING
+		&& !(operator->id == EXPR_MOD && type == TYPE_FLOAT), parser,
+		"Invalid operands %s and %s of `%s`", type_names[left_type], type_names[right_type], operator->text))
+		return EXPR_ID_NONE;
+	bool compare = operator->id == EXPR_LESS || operator->id == EXPR_LESS_EQUAL
+		|| operator->id == EXPR_EQUAL || operator->id == EXPR_NOT_EQUAL;
+	ExprId converted_left = convert(parser, operator->swapped ? right : left, type);
+	ExprId converted_right = convert(parser, operator->swapped ? left : right, type);
+	ExprId expr = new_expr(parser, operator->id, compare ? TYPE_INT : type);
+	parser->nodes.items[expr].left = converted_left;
+	parser->nodes.items[expr].right = converted_right;
+	return expr;
+}
+
+/* Returns: value of the integer literal, -1 (after printing an error) if it is
+ * too large
+ */
+static int64_t parse_int(struct Parser *parser, const struct Token *token) {
+	int64_t value = 0;
+	for (int i = 0; i < token->length; i++) {
+		int digit = parser->text[token->offset + i] - '0';
+		if (assert(value <= (INT64_MAX - digit) / 10, parser, "Integer literal too large"))
+			return -1;
+		value = value * 10 + digit;
+	}
+	return value;
+}
+
+/* Returns: the string literal's text, with its escape sequences replaced by
+ * the characters they stand for, STR_NONE (after printing an error) if it
+ * has an unknown escape sequence
+ */
+static StrId parse_string(struct Parser *parser, const struct Token *token) {
+	const char *text = interner_string(parser->interner, token->str);
+	int length = interner_length(parser->interner, token->str);
+	if (memchr(text, '\\', length) == NULL) return token->str;
+
+	char decoded[length];
+	int decoded_length = 0;
+	for (int i = 0; i < length; i++) {
+		char c = text[i];
+		if (c == '\\') {
+			// the scanner ends no literal in a backslash, so one follows
+			switch (text[++i]) {
+			case 'n': c = '\n'; break;
+			case 't': c = '\t'; break;
+			case 'r': c = '\r'; break;
+			case '"': c = '"'; break;
+			case '\'': c = '\''; break;
+			case '\\': c = '\\'; break;
+			default:
+				assert(false, parser, "Unknown escape sequence \\%c in string literal", text[i]);
+				return STR_NONE;
+			}
+		}
+		decoded[decoded_length++] = c;
+	}
+	return interner_intern(parser->interner, decoded, decoded_length);
+}
+
+/* Adds the expression of a literal or variable.
+ * Returns: its index, EXPR_ID_NONE (after printing an error) if the token
+ * is neither
+ */
+static ExprId parse_operand(struct Parser *parser, SymTable *symtable, const struct Token *token) {
+	ExprId expr;
+	switch (token->id) {
+	case TOKEN_INT_LITERAL: {
+		int64_t value = parse_int(parser, token);
+		if (value < 0) return EXPR_ID_NONE;
+		expr = new_expr(parser, EXPR_INT, TYPE_INT);
+		parser->nodes.items[expr].int_value = value;
+		return expr;
+	}
+	case TOKEN_FLOAT_LITERAL: {
+		char literal[token->length + 1];
+		memcpy(literal, parser->text + token->offset, token->length);
+		literal[token->length] = '\0';
+		expr = new_expr(parser, EXPR_FLOAT, TYPE_FLOAT);
+		parser->nodes.items[expr].float_value = strtod(literal, NULL);
+		return expr;
+	}
+	case TOKEN_STRING_LITERAL: {
+		StrId string = parse_string(parser, token);
+		if (string == STR_NONE && token->str != STR_NONE) return EXPR_ID_NONE;
+		expr = new_expr(parser, EXPR_STRING, TYPE_STRING);
+		parser->nodes.items[expr].string = string;
+		return expr;
+	}
+	case TOKEN_IDENTIFIER: {
+		Sym *sym = symtable_get(symtable, token->str);
+		if (assert(sym != NULL && sym->id == SYM_VAR, parser,
+			"Undefined variable: %s", interner_string(parser->interner, token->str)))
+			return EXPR_ID_NONE;
+		expr = new_expr(parser, EXPR_VAR, sym->type);
+		parser->nodes.items[expr].sym = sym;
+		return expr;
+	}
+	default:
+		assert(false, parser, "Expected an expression");
+		return EXPR_ID_NONE;
+	}
+}
+
+/* Starts parsing an expression from its next token. */
+static void start_expression(struct Parser *parser) {
+	expridvec_clear(&parser->operands);
+	operatorvec_clear(&parser->operators);
+	parser->operand_expected = true;
+}
+
+/* Applies the operators on top of the stack that bind at least as tightly
+ * as precedence, stopping at an open `(`.
+ * Returns: whether succeeded
+ */
+static bool apply_operators(struct Parser *parser, int precedence) {
+	while (parser->operators.count > 0) {
+		const struct Operator *operator = parser->operators.items[parser->operators.count - 1];
+		if (operator == NULL || operator->precedence < precedence) break;
+		parser->operators.count--;
+		ExprId right = expridvec_pop(&parser->operands);
+		ExprId expr = operator->prefix
+			? new_unary(parser, operator, right)
+			: new_binary(parser, operator, expridvec_pop(&parser->operands), right);
+		if (expr == EXPR_ID_NONE) return false;
+		expridvec_push(&parser->operands, expr);
+	}
+	return true;
+}
+
+/* Adds the next token to the expression being parsed.
+ * Returns: enum expression_results
+ */
+static int parse_expression(struct Parser *parser, SymTable *symtable, const struct Token *token) {
+	if (parser->operand_expected) {
+		const struct Operator *prefix = find_operator(parser, token, prefix_operators,
+			sizeof(prefix_operators) / sizeof(prefix_operators[0]));
+		if (prefix != NULL || token->id == TOKEN_GROUP_OPEN) {
+			operatorvec_push(&parser->operators, prefix); // NULL for `(`
+			return EXPRESSION_MORE;
+		}
+		ExprId operand = parse_operand(parser, symtable, token);
+		if (operand == EXPR_ID_NONE) return EXPRESSION_ERROR;
+		expridvec_push(&parser->operands, operand);
+		parser->operand_expected = false;
+		return EXPRESSION_MORE;
+	}
+
+	const struct Operator *binary = find_operator(parser, token, binary_operators,
+		sizeof(binary_operators) / sizeof(binary_operators[0]));
+	if (binary != NULL) {
+		// binary operators of equal precedence group to the left
+		if (!apply_operators(parser, binary->precedence)) return EXPRESSION_ERROR;
+		operatorvec_push(&parser->operators, binary);
+		parser->operand_expected = true;
+		return EXPRESSION_MORE;
+	}
+	if (token->id == TOKEN_GROUP_CLOSE) {
+		if (!apply_operators(parser, 0)) return EXPRESSION_ERROR;
+		if (parser->operators.count > 0) {
+			parser->operators.count--; // the `(` it closes
+			return EXPRESSION_MORE;
+		}
+	}
+	return EXPRESSION_END;
+}
+
+/* Ends the expression being parsed, applying every operator still waiting.
+ * Returns: the expression, EXPR_ID_NONE (after printing an error) if a `(`
+ * is not closed
+ */
+static ExprId end_expression(struct Parser *parser) {
+	if (!apply_operators(parser, 0)
+		|| assert(parser->operators.count == 0, parser, "Expected `)` to close `(`"))
+		return EXPR_ID_NONE;
+	return expridvec_pop(&parser->operands);
+}
+
+/* Ends the value being parsed, converted to the type if it is not -1.
+ * Returns: the value, EXPR_ID_NONE (after printing an error) if invalid
+ */
+static ExprId end_value(struct Parser *parser, int type) {
+	ExprId expr = end_expression(parser);
+	if (expr == EXPR_ID_NONE || type == -1) return expr;
+	int from = parser->nodes.items[expr].type;
+	ExprId converted = convert(parser, expr, type);
+	assert(converted != EXPR_ID_NONE, parser, "Cannot assign %s value to %s variable",
+		type_names[from], type_names[type]);
+	return converted;
+}
+
+/* Stores the completed statement in output, readying the parser for the next.
+ * Returns: PARSE_VALID
+ */
+static int complete(struct Parser *parser, int id, Sym *sym, ExprId expr, struct Statement *output) {
+	parser->state = STATE_START;
+	output->id = id;
+	output->args = (id == STATEMENT_INCLUDE || id == STATEMENT_BREAK_LABEL) ? &parser->arg : NULL;
+	output->arg_count = (output->args != NULL) ? 1 : 0;
+	output->sym = sym;
+	output->expr = expr;
+	output->nodes = parser->nodes.items;
+	return PARSE_VALID;
+}
+
+/* Completes a variable declaration, adding the variable to the symbol table.
+ * The value is parsed before the variable is added, so it sees any outer
+ * variable of the same name.
+ * Returns: PARSE_VALID
+ *
+ * value - the initial value, EXPR_ID_NONE to start the variable as zero
+ */
+static int declare(struct Parser *parser, SymTable *symtable, ExprId value, struct Statement *output) {
+	if (value == EXPR_ID_NONE) {
+		struct Expr zero = { .type = parser->type };
+		if (parser->type == TYPE_INT) {
+			zero.id = EXPR_INT;
+			zero.int_value = 0;
+		} else if (parser->type == TYPE_FLOAT) {
+			zero.id = EXPR_FLOAT;
+			zero.float_value = 0.0;
+		} else {
+			zero.id = EXPR_STRING;
+			zero.string = STR_NONE; // the empty string
+		}
+		exprvec_push(&parser->nodes, zero);
+		value = parser->nodes.count - 1;
+	}
+	Sym *sym = arena_alloc(parser->arena, sizeof(Sym));
+	sym->id = SYM_VAR;
+	sym->type = parser->type;
+	sym->name = parser->arg;
+	symtable_add(symtable, sym);
+	return complete(parser, STATEMENT_VAR_DECL, sym, value, output);
+}
+
+/* Opens a block at its `{`, for the statement before it.
+ * Returns: enum parse_code, PARSE_NULL for a block without a statement
+ *
+ * statement - enum statements, -1 if none
+ */
+static int open_block(struct Parser *parser, SymTable *symtable, int statement, struct Statement *output) {
+	if (assert(!symtable_push_scope(symtable), parser,
+		"Exceeded maximum number of nested scopes (%i)", SYMTABLE_MAX_SCOPES))
+		return PARSE_ERROR;
+	parser->blocks[symtable->depth - 1] = statement;
+	parser->state = STATE_START;
+	if (statement == -1) return PARSE_NULL;
+	return complete(parser, statement, NULL, (statement == STATEMENT_ELSE) ? EXPR_ID_NONE : parser->condition, output);
+}
+
+/* Closes the innermost block at its `}`.
+ * Returns: enum parse_code, PARSE_NULL for a block without a statement
+ */
+static int close_block(struct Parser *parser, SymTable *symtable, struct Statement *output) {
+	if (assert(!symtable_pop_scope(symtable), parser,
+		"Unexpected scope block closing statement, no scope to close!"))
+		return PARSE_ERROR;
+	int opener = parser->blocks[symtable->depth];
+	parser->closed_if = opener == STATEMENT_IF;
+	if (opener == -1) return PARSE_NULL;
+	return complete(parser, STATEMENT_END, NULL, EXPR_ID_NONE, output);
+}
+
+/* Starts a statement at its first token.
+ * Returns: enum parse_code
+ *
+ * closed_if - whether the token before closed the block of an IF
+ */
+static int parse_start(struct Parser *parser, SymTable *symtable, const struct Token *token, bool closed_if,
+	struct Statement *output) {
+	switch (token->id) {
+	case TOKEN_END_OF_STATEMENT:
+		return PARSE_NULL;
+	case TOKEN_BLOCK_OPEN:
+		return open_block(parser, symtable, -1, output);
+	case TOKEN_BLOCK_CLOSE:
+		return close_block(parser, symtable, output);
+	case TOKEN_DIRECTIVE_INCLUDE:
+		parser->statement = STATEMENT_INCLUDE;
+		parser->state = STATE_INCLUDE;
+		return PARSE_NULL;
+	case TOKEN_PREPROCESSOR_CMD: // #define was taken by the preprocessor
+		parser->state = STATE_SKIP;
+		return PARSE_NULL;
+	case TOKEN_KEYWORD_BREAK:
+		parser->statement = STATEMENT_BREAK;
+		parser->state = STATE_BREAK;
+		return PARSE_NULL;
+	case TOKEN_KEYWORD_PRINT:
+		parser->statement = STATEMENT_PRINT;
+		parser->state = STATE_VALUE;
+		start_expression(parser);
+		return PARSE_NULL;
+	case TOKEN_KEYWORD_INT:
+	case TOKEN_KEYWORD_FLOAT:
+	case TOKEN_KEYWORD_STRING:
+		parser->statement = STATEMENT_VAR_DECL;
+		parser->type = (token->id == TOKEN_KEYWORD_INT) ? TYPE_INT
+			: (token->id == TOKEN_KEYWORD_FLOAT) ? TYPE_FLOAT : TYPE_STRING;
+		parser->state = STATE_NAME;
+		return PARSE_NULL;
+	case TOKEN_KEYWORD_IF:
+	case TOKEN_KEYWORD_WHILE:
+		parser->statement = (token->id == TOKEN_KEYWORD_IF) ? STATEMENT_IF : STATEMENT_WHILE;
+		parser->state = STATE_CONDITION_OPEN;
+		return PARSE_NULL;
+	case TOKEN_KEYWORD_ELSE:
+		if (assert(closed_if, parser,
+			"Invalid else statement (expected `} else {` after the block of an if statement)"))
+			return PARSE_ERROR;
+		parser->statement = STATEMENT_ELSE;
+		parser->state = STATE_BLOCK_OPEN;
+		return PARSE_NULL;
+	case TOKEN_IDENTIFIER:
+		parser->sym = symtable_get(symtable, token->str);
+		if (assert(parser->sym != NULL && parser->sym->id == SYM_VAR, parser,
+			"Undefined variable: %s", interner_string(parser->interner, token->str)))
+			return PARSE_ERROR;
+		parser->statement = STATEMENT_ASSIGN;
+		parser->state = STATE_ASSIGN;
+		return PARSE_NULL;
+	default:
+		assert(false, parser, "Invalid statement");
+		return PARSE_ERROR;
+	}
+}
+
+/* Ends the statement at its `;`, after its tokens were parsed.
+ * Returns: enum parse_code
+ */
+static int parse_end(struct Parser *parser, SymTable *symtable, struct Statement *output) {
+	ExprId value;
+	switch (parser->statement) {
+	case STATEMENT_PRINT:
+		value = end_value(parser, -1);
+		return (value != EXPR_ID_NONE) ? complete(parser, STATEMENT_PRINT, NULL, value, output) : PARSE_ERROR;
+	case STATEMENT_ASSIGN:
+		value = end_value(parser, parser->sym->type);
+		return (value != EXPR_ID_NONE) ? complete(parser, STATEMENT_ASSIGN, parser->sym, value, output) : PARSE_ERROR;
+	case STATEMENT_VAR_DECL:
+		value = end_value(parser, parser->type);
+		return (value != EXPR_ID_NONE) ? declare(parser, symtable, value, output) : PARSE_ERROR;
+	default:
+		return complete(parser, parser->statement, NULL, EXPR_ID_NONE, output);
+	}
+}
+
 /* Gets the next statement given repeated calls providing a sequence of tokens.
  * Automatically updates the symbol table as well.
  * Returns:
@@ -82,103 +556,115 @@ static bool assert(bool condition, struct Parser *parser, const char *error_stri
  *   PARSE_ERROR ... error, invalid/illegal statement detected
  *   PARSE_VALID ... valid statement parsed
  *
- * token - the next token in the sequence
+ * token - the next token in the sequence, TOKEN_EOF after the last
  * output - where to store the resulting statement data
  */
 int parser_parse(struct Parser *parser, struct SymTable *symtable, struct Token *token, struct Statement *output) {
-	if (assert(parser->tokenbuf_count < PARSER_TOKENBUF_SIZE, parser, 
-		"Exceeded maximum number of tokens per statement (%i)", PARSER_TOKENBUF_SIZE))
+	if (parser->state == STATE_START) {
+		if (token->id == TOKEN_EOF) return PARSE_NULL;
+		parser->first = *token;
+		exprvec_clear(&parser->nodes);
+	}
+	parser->last = *token;
+	bool closed_if = parser->closed_if;
+	parser->closed_if = false;
+	if (assert(token->id != TOKEN_EOF, parser, "Unexpected end of file in statement"))
 		return PARSE_ERROR;
-	
-	if (token->id == TOKEN_BLOCK_OPEN) {
-		if (assert(!symtable_push_scope(symtable), parser, 
-			"Exceeded maximum number of nested scopes (%i)", SYMTABLE_MAX_SCOPES))
+
+	const char *block_name = (parser->statement == STATEMENT_IF) ? "if" : "while";
+	int result;
+	switch (parser->state) {
+	case STATE_START:
+		return parse_start(parser, symtable, token, closed_if, output);
+	case STATE_SKIP:
+		if (token->id == TOKEN_END_OF_STATEMENT) parser->state = STATE_START;
+		return PARSE_NULL;
+	case STATE_INCLUDE:
+		if (assert(token->id == TOKEN_STRING_LITERAL, parser,
+			"Invalid include statement (expected `#include \"path\";`)"))
+			return PARSE_ERROR;
+		parser->arg = token->str;
+		parser->state = STATE_END;
+		return PARSE_NULL;
+	case STATE_BREAK:
+		if (token->id == TOKEN_END_OF_STATEMENT) return parse_end(parser, symtable, output);
+		if (assert(token->id == TOKEN_IDENTIFIER, parser,
+			"Invalid break statement (expected label identifier, ex: `break label;`)")
+			|| assert(symtable_get(symtable, token->str) != NULL, parser,
+			"Undefined label identifier: %s", interner_string(parser->interner, token->str)))
 			return PARSE_ERROR;
+		parser->arg = token->str;
+		parser->statement = STATEMENT_BREAK_LABEL;
+		parser->state = STATE_END;
 		return PARSE_NULL;
-	} else if(token->id == TOKEN_BLOCK_CLOSE) {
-		if (assert(!symtable_pop_scope(symtable), parser, 
-			"Unexpected scope block closing statement, no scope to close!"))
+	case STATE_END:
+		if (assert(token->id == TOKEN_END_OF_STATEMENT, parser, "Expected `;` to end the statement"))
 			return PARSE_ERROR;
+		return parse_end(parser, symtable, output);
+	case STATE_NAME: {
+		if (assert(token->id == TOKEN_IDENTIFIER, parser,
+			"Invalid declaration (expected variable name)"))
+			return PARSE_ERROR;
+		Sym *declared = symtable_get(symtable, token->str);
+		if (assert(declared == NULL || declared->depth != symtable->depth, parser,
+			"Redeclared variable: %s", interner_string(parser->interner, token->str)))
+			return PARSE_ERROR;
+		parser->arg = token->str;
+		parser->state = STATE_DECLARED;
 		return PARSE_NULL;
 	}
-
-	// free string memory when overwriting previous token
-	free(parser->tokenbuf[parser->tokenbuf_count].string); 
-	parser->tokenbuf[parser->tokenbuf_count] = *token;
-	parser->tokenbuf_count++;
-
-	if (token->id == TOKEN_END_OF_STATEMENT) {
-		if (parser->tokenbuf_count == 1) {
-			parser->tokenbuf_count = 0;
-			return PARSE_NULL;
-		}
-		
-		switch (parser->tokenbuf[0].id) {
-		case TOKEN_PREPROCESSOR_CMD: {
-			const int token_count = parser->tokenbuf_count - 1;
-			const struct Token *buf = parser->tokenbuf;
-			const char *cmd = buf[0].string + 1;
-
-			if (strcmp("include", cmd) == 0) {
-				if (assert(token_count == 2 && buf[1].id == TOKEN_STRING_LITERAL, parser,
-					"Invalid include statement (expected `#include \"path\";`)"))
-					return PARSE_ERROR;
-
-				char *path = buf[1].string;
-				char *string = strtok_to_string(path);
-				hashtable_add(&parser->included_files, hash_string(string), string);
-			} else if (strcmp("define", cmd) == 0) {
-				// #define identifier definition...
-				// TODO
-			}
-
-			parser->tokenbuf_count = 0;
-			return PARSE_NULL;
-		}
-		case TOKEN_IDENTIFIER: {
-			const int token_count = parser->tokenbuf_count - 1;
-			struct Token *buf = parser->tokenbuf;
-			const char *identifier = buf[0].string;
-
-			if (strcmp("break", identifier) == 0) {
-				if (assert(token_count <= 2, parser, 
-					"Invalid break statement (expected `break;` or `break label;`)"))
-					return PARSE_ERROR;
-
-				if (token_count == 2) {
-					if (assert(buf[1].id == TOKEN_IDENTIFIER, parser,
-						"Invalid break statement (expected label identifier, ex: `break label;`)") ||
-						assert(symtable_get(symtable, buf[1].string) != NULL, parser,
-						"Undefined label identifier: %s", buf[1].string))
-						return PARSE_ERROR;
-
-					output->id = STATEMENT_BREAK_LABEL;
-					output->args = &buf[1].string;
-					output->arg_count = 1;
-					return PARSE_VALID;
-				} else {
-					output->id = STATEMENT_BREAK;
-					output->args = NULL;
-					output->arg_count = 0;
-					return PARSE_VALID;
-				}
-			} else {
-				if (token_count >= 2) {
-					if (buf[0].id == TOKEN_IDENTIFIER && buf[1].id == TOKEN_IDENTIFIER) {
-						if (token_count == 2) {
-							// uninitialized variable declaration
-							// TODO
-						}
-					}
-				}
-			}
-			// fall through to default case, error
-		}
-		default:
-			fprintf(stderr, "Invalid statement");
-			print_line_info(parser);
+	case STATE_DECLARED:
+		if (token->id == TOKEN_END_OF_STATEMENT) return declare(parser, symtable, EXPR_ID_NONE, output);
+		if (assert(is_operator(parser, token, "="), parser,
+			"Invalid declaration (expected `type name;` or `type name = value;`)"))
+			return PARSE_ERROR;
+		parser->state = STATE_VALUE;
+		start_expression(parser);
+		return PARSE_NULL;
+	case STATE_ASSIGN:
+		if (assert(is_operator(parser, token, "="), parser, "Invalid statement (expected `name = value;`)"))
+			return PARSE_ERROR;
+		parser->state = STATE_VALUE;
+		start_expression(parser);
+		return PARSE_NULL;
+	case STATE_VALUE:
+		result = parse_expression(parser, symtable, token);
+		if (result != EXPRESSION_END) return (result == EXPRESSION_MORE) ? PARSE_NULL : PARSE_ERROR;
+		if (assert(token->id == TOKEN_END_OF_STATEMENT, parser, "Unexpected token in expression"))
+			return PARSE_ERROR;
+		return parse_end(parser, symtable, output);
+	case STATE_CONDITION_OPEN:
+		if (assert(token->id == TOKEN_GROUP_OPEN, parser,
+			"Invalid %s statement (expected `%s (condition) {`)", block_name, block_name))
+			return PARSE_ERROR;
+		parser->state = STATE_CONDITION;
+		start_expression(parser);
+		return PARSE_NULL;
+	case STATE_CONDITION:
+		result = parse_expression(parser, symtable, token);
+		if (result != EXPRESSION_END) return (result == EXPRESSION_MORE) ? PARSE_NULL : PARSE_ERROR;
+		if (assert(token->id == TOKEN_GROUP_CLOSE, parser,
+			"Invalid %s statement (expected `%s (condition) {`)", block_name, block_name))
+			return PARSE_ERROR;
+		parser->condition = end_expression(parser);
+		if (parser->condition == EXPR_ID_NONE
+			|| assert(parser->nodes.items[parser->condition].type == TYPE_INT, parser,
+				"Invalid condition of type %s (expected int)",
+				type_names[(int) parser->nodes.items[parser->condition].type]))
+			return PARSE_ERROR;
+		parser->state = STATE_BLOCK_OPEN;
+		return PARSE_NULL;
+	case STATE_BLOCK_OPEN:
+		if (parser->statement == STATEMENT_ELSE) {
+			if (assert(token->id == TOKEN_BLOCK_OPEN, parser,
+				"Invalid else statement (expected `} else {` after the block of an if statement)"))
+				return PARSE_ERROR;
+		} else if (assert(token->id == TOKEN_BLOCK_OPEN, parser,
+			"Invalid %s statement (expected `%s (condition) {`)", block_name, block_name)) {
 			return PARSE_ERROR;
 		}
+		return open_block(parser, symtable, parser->statement, output);
+	default:
+		return PARSE_ERROR;
 	}
-	return PARSE_NULL;
 }
@@ -6,11 +6,14 @@
 #define __PARSER_H__
 
 #include <stdio.h>
+#include <stdbool.h>
 
 #include "token.h"
+#include "source.h"
 #include "symtable.h"
 #include "statement.h"
-#include "utils/hashtable.h"
+#include "utils/interner.h"
+#include "utils/arena.h"
 
 enum parse_code {
 	PARSE_NULL,
@@ -18,13 +21,37 @@ enum parse_code {
 	PARSE_VALID
 };
 
+struct Operator;
+DEFINE_VEC(OperatorVec, operatorvec, const struct Operator*)
+
+/* parses statements incrementally, one token at a time: each token advances
+ * the statement being parsed, and its expression is built as its tokens
+ * arrive rather than once the statement ends.
+ */
 struct Parser {
-    struct HashTable included_files;
-    struct Token *tokenbuf;
-    int tokenbuf_count;
+    int state; // what the statement being parsed expects next
+    int statement; // enum statements, of the statement being parsed
+    int type; // of the variable being declared
+    StrId arg; // name declared, label broken to or path included
+    Sym *sym; // variable being assigned
+    ExprId condition; // of the IF or WHILE being parsed, once its `)` is reached
+    ExprVec nodes; // expressions of the statement being parsed
+    ExprIdVec operands; // expressions waiting to be operands of an operator
+    OperatorVec operators; // operators waiting for their operands, NULL for an open `(`
+    bool operand_expected; // the expression being parsed expects an operand next, else an operator
+    struct Token first; // first token of the statement being parsed
+    struct Token last; // last token given to the parser
+    char *blocks; // statement that opened each open block (enum statements), -1 if none
+    bool closed_if; // the last token closed the block of an IF, so an ELSE may follow
+    Interner *interner;
+    Arena *arena; // per-source allocations
+    const char *text; // source text that tokens are spans of
+    FILE *err; // where errors are reported
 };
 
-void parser_init(struct Parser *parser);
+void parser_init(struct Parser *parser, Interner *interner, Arena *arena);
+void parser_deinit(struct Parser *parser);
+void parser_set_source(struct Parser *parser, const struct Source *source);
 
 int parser_parse(struct Parser *parser, struct SymTable *tbl, struct Token *next_token, struct Statement *output);
 
@@ -0,0 +1,153 @@
+/* peephole.c
+ * Rewrites short sequences of instructions into fewer ones as they are
+ * emitted, and shortens chains of jumps once a module's code is complete.
+ * The sequences fused into superinstructions are the most frequent pairs of
+ * opcodes dispatched by bench/programs (see bench/opcode_pairs.c): an
+ * immediate value loaded and then added, and a comparison and the
+ * conditional jump testing it, with or without an immediate operand.
+ *
+ * A fused instruction drops the write of a temporary, a register above
+ * every variable's. The code of an expression reads each temporary it
+ * writes exactly once, so the instruction reading it is the only one that
+ * needs the value. Nothing is fused across the fence, the last jump target,
+ * since code jumping there would skip half of the fused sequence.
+ * author: Andrew Klinge
+*/
+
+#include <stdbool.h>
+
+#include "peephole.h"
+
+// fused instructions of each int comparison: { branch on registers a and b,
+// branch on a and an immediate right operand, branch on a and an immediate
+// left operand }. OP_NOP for instructions that are not a comparison
+static const int branch_ops[OPCODES_COUNT][3] = {
+	[OP_LESS_INT] = { OP_BRANCH_LESS_INT, OP_BRANCH_LESS_INT_IMM, OP_BRANCH_GREATER_INT_IMM },
+	[OP_LESS_EQUAL_INT] = { OP_BRANCH_LESS_EQUAL_INT, OP_BRANCH_LESS_EQUAL_INT_IMM, OP_BRANCH_GREATER_EQUAL_INT_IMM },
+	[OP_EQUAL_INT] = { OP_BRANCH_EQUAL_INT, OP_BRANCH_EQUAL_INT_IMM, OP_BRANCH_EQUAL_INT_IMM },
+	[OP_NOT_EQUAL_INT] = { OP_BRANCH_NOT_EQUAL_INT, OP_BRANCH_NOT_EQUAL_INT_IMM, OP_BRANCH_NOT_EQUAL_INT_IMM }
+};
+
+/* Returns: whether the instruction at the index is op writing a temporary,
+ * after the fence, so that it can be fused with the instruction reading it
+ */
+static inline bool fusable(const struct ModuleWriter *writer, int at, int op, int fence, int temps) {
+	if (at < fence || at < 0) return false;
+	uint32_t instruction = writer->code.items[at];
+	return INSTRUCTION_OP(instruction) == op && OPERAND_A(instruction) >= (unsigned) temps;
+}
+
+/* Fuses an ADD_INT or SUB_INT of an immediate value loaded just before into
+ * an ADD_INT_IMM, if the value fits.
+ * Returns: index of the fused instruction, -1 if it is not fused
+ */
+static int fuse_add(struct ModuleWriter *writer, uint32_t instruction, int fence, int temps) {
+	int load = writer->code.count - 1;
+	if (!fusable(writer, load, OP_INT, fence, temps)) return -1;
+	unsigned temp = OPERAND_A(writer->code.items[load]);
+	int value = OPERAND_SBX(writer->code.items[load]);
+	unsigned b = OPERAND_B(instruction);
+	unsigned c = OPERAND_C(instruction);
+
+	unsigned operand;
+	if (c == temp && b != temp) {
+		operand = b;
+		if (INSTRUCTION_OP(instruction) == OP_SUB_INT) value = -value;
+	} else if (b == temp && c != temp && INSTRUCTION_OP(instruction) == OP_ADD_INT) {
+		operand = c;
+	} else {
+		return -1;
+	}
+	if (value < MODULE_MIN_SMALL_IMMEDIATE || value > MODULE_MAX_SMALL_IMMEDIATE) return -1;
+	writer->code.count--;
+	return module_writer_emit(writer, INSTRUCTION(OP_ADD_INT_IMM, OPERAND_A(instruction), operand, (uint8_t) value));
+}
+
+/* Fuses a JUMP_IF_FALSE testing an int comparison just before it into a
+ * BRANCH and its JUMP, taking an immediate operand loaded before the
+ * comparison into the BRANCH too.
+ * Returns: index of the JUMP, -1 if it is not fused or the code is full
+ */
+static int fuse_branch(struct ModuleWriter *writer, uint32_t jump, int fence, int temps) {
+	int compare = writer->code.count - 1;
+	if (compare < fence || compare < 0) return -1;
+	uint32_t instruction = writer->code.items[compare];
+	int op = INSTRUCTION_OP(instruction);
+	if (branch_ops[op][0] == OP_NOP || OPERAND_A(instruction) != OPERAND_A(jump)
+		|| OPERAND_A(instruction) < (unsigned) temps)
+		return -1;
+
+	unsigned b = OPERAND_B(instruction);
+	unsigned c = OPERAND_C(instruction);
+	uint32_t branch = INSTRUCTION(branch_ops[op][0], b, c, 0);
+	writer->code.count--;
+	if (fusable(writer, compare - 1, OP_INT, fence, temps)) {
+		unsigned temp = OPERAND_A(writer->code.items[compare - 1]);
+		int value = OPERAND_SBX(writer->code.items[compare - 1]);
+		if (c == temp && b != temp) {
+			branch = INSTRUCTION_BX(branch_ops[op][1], b, value);
+			writer->code.count--;
+		} else if (b == temp && c != temp) {
+			branch = INSTRUCTION_BX(branch_ops[op][2], c, value);
+			writer->code.count--;
+		}
+	}
+	if (module_writer_emit(writer, branch) == -1) return -1;
+	return module_writer_emit(writer, INSTRUCTION_AX(OP_JUMP, OPERAND_BX(jump)));
+}
+
+/* Appends the instruction to the module's code, fused with the instructions
+ * before it if they form a sequence with a superinstruction. A MOVE undoing
+ * the MOVE just before it is dropped.
+ * Returns: index of the instruction it became (the JUMP of a BRANCH), -1 if
+ * the code is full
+ *
+ * fence - index of the first instruction that may be rewritten, which is
+ *      at or after the last jump target
+ * temps - the first temporary register: every register from it on is
+ *      written and then read once by the code of a single expression
+ */
+int peephole_emit(struct ModuleWriter *writer, uint32_t instruction, int fence, int temps) {
+	int fused = -1;
+	int last = writer->code.count - 1;
+	switch (INSTRUCTION_OP(instruction)) {
+	case OP_ADD_INT:
+	case OP_SUB_INT:
+		fused = fuse_add(writer, instruction, fence, temps);
+		break;
+	case OP_JUMP_IF_FALSE:
+		fused = fuse_branch(writer, instruction, fence, temps);
+		break;
+	case OP_MOVE:
+		if (last >= fence && last >= 0
+			&& writer->code.items[last] == INSTRUCTION(OP_MOVE, OPERAND_B(instruction), OPERAND_A(instruction), 0))
+			return last;
+		break;
+	}
+	return (fused != -1) ? fused : module_writer_emit(writer, instruction);
+}
+
+/* Returns: the first instruction a jump to target runs that is not a JUMP */
+static int follow_jumps(const struct ModuleWriter *writer, int target) {
+	// a chain longer than the code is a loop of jumps, which never ends anyway
+	for (int hops = 0; hops < writer->code.count; hops++) {
+		// a jump to the end of the code lands on the HALT written after it
+		if (target >= writer->code.count) break;
+		uint32_t instruction = writer->code.items[target];
+		if (INSTRUCTION_OP(instruction) != OP_JUMP) break;
+		target = OPERAND_AX(instruction);
+	}
+	return target;
+}
+
+/* Points every jump to a JUMP straight at where the chain of jumps ends. */
+void peephole_thread_jumps(struct ModuleWriter *writer) {
+	for (int at = 0; at < writer->code.count; at++) {
+		uint32_t instruction = writer->code.items[at];
+		if (INSTRUCTION_OP(instruction) == OP_JUMP) {
+			module_writer_patch(writer, at, follow_jumps(writer, OPERAND_AX(instruction)));
+		} else if (INSTRUCTION_OP(instruction) == OP_JUMP_IF_FALSE) {
+			module_writer_patch(writer, at, follow_jumps(writer, OPERAND_BX(instruction)));
+		}
+	}
+}
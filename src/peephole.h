@@ -0,0 +1,15 @@
+/* peephole.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __PEEPHOLE_H__
+#define __PEEPHOLE_H__
+
+#include <stdint.h>
+
+#include "module.h"
+
+int peephole_emit(struct ModuleWriter *writer, uint32_t instruction, int fence, int temps);
+void peephole_thread_jumps(struct ModuleWriter *writer);
+
+#endif
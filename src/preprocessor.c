@@ -0,0 +1,498 @@
+/* preprocessor.c
+ * Expands macros in the token stream between the scanner and the parser.
+ * `#define name value;` defines an object-like macro and
+ * `#define name(a, b) value;` a function-like one, whose `(` directly
+ * follows its name. A definition's body is kept as the tokens the scanner
+ * made of it, so expanding a macro copies tokens into the stream without
+ * scanning or interning its text again.
+ *
+ * Expansion follows Prosser's algorithm, as C preprocessors do: each token
+ * carries the hide-set of macros whose expansion it came from, and is not
+ * expanded by a macro in its hide-set. Expanded tokens are pushed back onto
+ * the stream to be read again, so that the macros in them expand in turn.
+ * The arguments of a call are expanded on their own before being
+ * substituted. Every token is read from the stream a bounded number of times
+ * per expansion it is part of, so expanding takes time in proportion to the
+ * tokens it produces.
+ *
+ * Expanded tokens keep their own text, but take the line and the site (see
+ * struct Token) of the macro's name, or of its whole call, so that errors in
+ * them show where the macro was used.
+ *
+ * The full expansion of an object-like macro is cached on its first use
+ * outside of any expansion, and copied from the cache after that. Defining
+ * another macro makes every cached expansion stale.
+ * author: Andrew Klinge
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "preprocessor.h"
+#include "scanner.h"
+#include "utils/stats.h"
+
+#define PREPROCESSOR_INITIAL_SIZE 64
+
+// result of expanding the next token of the stream
+enum expand_results {
+	EXPAND_ERROR,
+	EXPAND_VALID,
+	EXPAND_UNFINISHED // a call was cut short by the end of a nested expansion's tokens
+};
+
+void preprocessor_init(struct Preprocessor *preprocessor, Interner *interner, Arena *arena) {
+	macrovec_init(&preprocessor->definitions, PREPROCESSOR_INITIAL_SIZE);
+	macrotokenvec_init(&preprocessor->bodies, PREPROCESSOR_INITIAL_SIZE);
+	macrotokenvec_init(&preprocessor->pending, PREPROCESSOR_INITIAL_SIZE);
+	macrotokenvec_init(&preprocessor->args, PREPROCESSOR_INITIAL_SIZE);
+	macrotokenvec_init(&preprocessor->cache, PREPROCESSOR_INITIAL_SIZE);
+	hidesetvec_init(&preprocessor->hide_sets, PREPROCESSOR_INITIAL_SIZE);
+	preprocessor->interner = interner;
+	preprocessor->arena = arena;
+	preprocessor->text = NULL;
+	preprocessor->err = stderr;
+}
+
+/* Frees a Preprocessor's resources. Does NOT free the preprocessor. */
+void preprocessor_deinit(struct Preprocessor *preprocessor) {
+	macrovec_deinit(&preprocessor->definitions);
+	macrotokenvec_deinit(&preprocessor->bodies);
+	macrotokenvec_deinit(&preprocessor->pending);
+	macrotokenvec_deinit(&preprocessor->args);
+	macrotokenvec_deinit(&preprocessor->cache);
+	hidesetvec_deinit(&preprocessor->hide_sets);
+}
+
+/* Sets the source whose tokens are to be preprocessed, read from it by read,
+ * forgetting the macros of the previous source. Per-source data is allocated
+ * from the preprocessor's arena, so it must be reset first.
+ */
+void preprocessor_set_source(struct Preprocessor *preprocessor, const struct Source *source,
+	TokenReader read, void *read_context) {
+	macromap_init(&preprocessor->macros, 32, preprocessor->arena);
+	macrovec_clear(&preprocessor->definitions);
+	macrotokenvec_clear(&preprocessor->bodies);
+	macrotokenvec_clear(&preprocessor->pending);
+	macrotokenvec_clear(&preprocessor->args);
+	macrotokenvec_clear(&preprocessor->cache);
+	hidesetvec_clear(&preprocessor->hide_sets);
+	hidesetvec_push(&preprocessor->hide_sets, (struct HideSetNode) { 0, 0 }); // the empty set
+	preprocessor->union_of[0] = 0;
+	preprocessor->union_of[1] = 0;
+	preprocessor->union_result = 0;
+	preprocessor->floor = -1;
+	preprocessor->generation = 0;
+	preprocessor->read = read;
+	preprocessor->read_context = read_context;
+	preprocessor->ended = false;
+	preprocessor->text = source->data;
+}
+
+/* Checks if the condition is true, and if not, then prints the error message,
+ * along with the text from the first token of the definition or call being
+ * preprocessed to the last token read.
+ * Variable arguments at end are for error_string format args.
+ * Returns: whether the check failed (condition was false)
+ */
+static bool assert(bool condition, struct Preprocessor *preprocessor, const char *error_string, ...) {
+	if (condition) return false;
+
+	va_list va;
+	va_start(va, error_string);
+	vfprintf(preprocessor->err, error_string, va);
+	va_end(va);
+
+	int start = preprocessor->first.site_offset;
+	int end = preprocessor->last.site_offset + preprocessor->last.site_length;
+	if (end < start) end = start;
+	fprintf(preprocessor->err, " at line %i: \n\t%.*s\n", preprocessor->first.ln, end - start,
+		preprocessor->text + start);
+	return true;
+}
+
+/* Returns whether the hide-set holds the macro name. */
+static bool hideset_has(struct Preprocessor *preprocessor, HideSet set, StrId macro) {
+	const struct HideSetNode *nodes = preprocessor->hide_sets.items;
+	for (; set != 0; set = nodes[set].next) {
+		if (nodes[set].macro == macro) return true;
+	}
+	return false;
+}
+
+/* Returns: the set of the hide-set's names and the macro name */
+static HideSet hideset_add(struct Preprocessor *preprocessor, HideSet set, StrId macro) {
+	if (hideset_has(preprocessor, set, macro)) return set;
+	hidesetvec_push(&preprocessor->hide_sets, (struct HideSetNode) { macro, set });
+	return preprocessor->hide_sets.count - 1;
+}
+
+/* Returns: the union of the hide-sets. The last union is remembered, since
+ * the tokens of an argument mostly share one hide-set.
+ */
+static HideSet hideset_union(struct Preprocessor *preprocessor, HideSet a, HideSet b) {
+	if (a == 0 || a == b) return b;
+	if (b == 0) return a;
+	if (preprocessor->union_of[0] == a && preprocessor->union_of[1] == b) return preprocessor->union_result;
+	HideSet set = b;
+	for (HideSet node = a; node != 0; node = preprocessor->hide_sets.items[node].next) {
+		set = hideset_add(preprocessor, set, preprocessor->hide_sets.items[node].macro);
+	}
+	preprocessor->union_of[0] = a;
+	preprocessor->union_of[1] = b;
+	preprocessor->union_result = set;
+	return set;
+}
+
+/* Returns: the intersection of the hide-sets */
+static HideSet hideset_intersect(struct Preprocessor *preprocessor, HideSet a, HideSet b) {
+	if (a == b) return a;
+	HideSet set = 0;
+	for (HideSet node = a; node != 0; node = preprocessor->hide_sets.items[node].next) {
+		StrId macro = preprocessor->hide_sets.items[node].macro;
+		if (hideset_has(preprocessor, b, macro)) set = hideset_add(preprocessor, set, macro);
+	}
+	return set;
+}
+
+/* Reads the next token of the stream: the last pending token, else the
+ * reader's next. Past the end of the source, or of a nested expansion's
+ * tokens (see floor), the token is TOKEN_EOF.
+ * Returns: whether successful
+ */
+static bool read_token(struct Preprocessor *preprocessor, struct MacroToken *token) {
+	if (preprocessor->pending.count > preprocessor->floor && preprocessor->pending.count > 0) {
+		*token = macrotokenvec_pop(&preprocessor->pending);
+	} else if (preprocessor->floor >= 0) {
+		struct Token end = preprocessor->last;
+		end.id = TOKEN_EOF;
+		end.length = 0;
+		end.site_length = 0;
+		end.str = STR_NONE;
+		*token = (struct MacroToken) { end, 0, -1, true };
+	} else if (preprocessor->ended) {
+		*token = (struct MacroToken) { preprocessor->eof, 0, -1, true };
+	} else {
+		if (preprocessor->read(preprocessor->read_context, &token->token) != SCAN_VALID) return false;
+		token->hide = 0;
+		token->param = -1;
+		token->expanded = false;
+		if (token->token.id == TOKEN_EOF) {
+			preprocessor->ended = true;
+			preprocessor->eof = token->token;
+		}
+	}
+	preprocessor->last = token->token;
+	return true;
+}
+
+/* Puts the token back, to be read next. */
+static void unread_token(struct Preprocessor *preprocessor, const struct MacroToken *token) {
+	if (token->token.id != TOKEN_EOF) macrotokenvec_push(&preprocessor->pending, *token);
+}
+
+/* Pushes a copy of the tokens onto the stream, in reverse so that the first
+ * is read next, with the hide-set added to their own.
+ *
+ * site - the expansion, whose line and site the tokens are given. NULL keeps their own
+ */
+static void push_tokens(struct Preprocessor *preprocessor, const struct MacroToken *tokens, int count,
+	HideSet hide, const struct Token *site) {
+	macrotokenvec_reserve(&preprocessor->pending, preprocessor->pending.count + count);
+	for (int i = count - 1; i >= 0; i--) {
+		struct MacroToken token = tokens[i];
+		token.hide = hideset_union(preprocessor, token.hide, hide);
+		token.param = -1;
+		token.expanded = false;
+		if (site != NULL) {
+			token.token.ln = site->ln;
+			token.token.site_offset = site->site_offset;
+			token.token.site_length = site->site_length;
+		}
+		preprocessor->pending.items[preprocessor->pending.count++] = token;
+	}
+}
+
+static int expand_next(struct Preprocessor *preprocessor, struct MacroToken *output);
+
+/* Expands the tokens on top of the pending ones on their own, as if nothing
+ * followed them, appending the result to out.
+ * Returns: enum expand_results
+ *
+ * count - number of the pending tokens
+ */
+static int expand_nested(struct Preprocessor *preprocessor, int count, MacroTokenVec *out) {
+	int floor = preprocessor->floor;
+	preprocessor->floor = preprocessor->pending.count - count;
+	int result;
+	while (true) {
+		struct MacroToken token;
+		result = expand_next(preprocessor, &token);
+		if (result != EXPAND_VALID || token.token.id == TOKEN_EOF) break;
+		macrotokenvec_push(out, token);
+	}
+	preprocessor->pending.count = preprocessor->floor; // left over if unfinished
+	preprocessor->floor = floor;
+	return result;
+}
+
+/* Returns whether the token names a function-like macro that may expand it. */
+static bool names_call(struct Preprocessor *preprocessor, const struct MacroToken *token) {
+	if (token->token.id != TOKEN_IDENTIFIER) return false;
+	int *index = macromap_get(&preprocessor->macros, token->token.str);
+	return index != NULL && preprocessor->definitions.items[*index].param_count >= 0
+		&& !hideset_has(preprocessor, token->hide, token->token.str);
+}
+
+/* Caches the full expansion of the object-like macro, unless it depends on
+ * the tokens after it: when it ends in the name of a function-like macro,
+ * or in a call left unfinished.
+ * Returns: whether successful
+ *
+ * name - the macro's name where it expands, outside of any expansion
+ */
+static bool cache_expansion(struct Preprocessor *preprocessor, struct Macro *macro, const struct MacroToken *name) {
+	macro->generation = preprocessor->generation;
+	macro->cache = preprocessor->cache.count;
+	HideSet hide = hideset_add(preprocessor, 0, name->token.str);
+	push_tokens(preprocessor, preprocessor->bodies.items + macro->body, macro->body_count, hide, &name->token);
+	int result = expand_nested(preprocessor, macro->body_count, &preprocessor->cache);
+	if (result == EXPAND_ERROR) return false;
+	macro->cache_count = preprocessor->cache.count - macro->cache;
+	if (result == EXPAND_UNFINISHED || (macro->cache_count > 0
+		&& names_call(preprocessor, &preprocessor->cache.items[preprocessor->cache.count - 1]))) {
+		preprocessor->cache.count = macro->cache;
+		macro->cache = -1;
+	}
+	return true;
+}
+
+/* Expands the object-like macro named by the token onto the stream.
+ * Returns: whether successful
+ */
+static bool expand_object(struct Preprocessor *preprocessor, struct Macro *macro, const struct MacroToken *name) {
+	STATS_ADD(STATS_MACRO_EXPANSIONS, 1);
+	if (name->hide == 0) {
+		if (preprocessor->generation != macro->generation
+			&& !cache_expansion(preprocessor, macro, name))
+			return false;
+		if (macro->cache >= 0) {
+			const struct MacroToken *cached = preprocessor->cache.items + macro->cache;
+			macrotokenvec_reserve(&preprocessor->pending, preprocessor->pending.count + macro->cache_count);
+			for (int i = macro->cache_count - 1; i >= 0; i--) {
+				struct MacroToken token = cached[i];
+				token.token.ln = name->token.ln;
+				token.token.site_offset = name->token.site_offset;
+				token.token.site_length = name->token.site_length;
+				token.expanded = true;
+				preprocessor->pending.items[preprocessor->pending.count++] = token;
+			}
+			return true;
+		}
+	}
+	HideSet hide = hideset_add(preprocessor, name->hide, name->token.str);
+	push_tokens(preprocessor, preprocessor->bodies.items + macro->body, macro->body_count, hide, &name->token);
+	return true;
+}
+
+/* Expands the call of the function-like macro named by the token, from its
+ * `(` up to its `)`, onto the stream.
+ * Returns: enum expand_results
+ */
+static int expand_call(struct Preprocessor *preprocessor, struct Macro *macro, const struct MacroToken *name) {
+	STATS_ADD(STATS_MACRO_EXPANSIONS, 1);
+	const char *macro_name = interner_string(preprocessor->interner, name->token.str);
+	int param_count = macro->param_count;
+	int base = preprocessor->args.count;
+	// arguments are at args[starts[i]] to args[starts[i + 1]], then expanded
+	// at args[starts[param_count + 1 + i]] to args[starts[param_count + 2 + i]]
+	int starts[2 * param_count + 2];
+	starts[0] = base;
+	int arg_count = 0;
+	int depth = 0; // of parentheses
+	struct MacroToken token;
+	while (true) {
+		if (!read_token(preprocessor, &token)) return EXPAND_ERROR;
+		if (token.token.id == TOKEN_EOF) {
+			preprocessor->args.count = base;
+			if (preprocessor->floor >= 0) return EXPAND_UNFINISHED;
+			preprocessor->first = name->token;
+			assert(false, preprocessor, "Unfinished call of macro %s (expected `)`)", macro_name);
+			return EXPAND_ERROR;
+		}
+		if (token.token.id == TOKEN_DIRECTIVE_DEFINE) {
+			preprocessor->first = name->token;
+			assert(false, preprocessor, "Invalid call of macro %s (#define in its arguments)", macro_name);
+			return EXPAND_ERROR;
+		}
+		if (token.token.id == TOKEN_GROUP_CLOSE && depth == 0) break;
+		if (token.token.id == TOKEN_LIST_SEPARATOR && depth == 0) {
+			arg_count++;
+			if (arg_count < param_count) starts[arg_count] = preprocessor->args.count;
+			continue;
+		}
+		if (token.token.id == TOKEN_GROUP_OPEN) depth++;
+		if (token.token.id == TOKEN_GROUP_CLOSE) depth--;
+		macrotokenvec_push(&preprocessor->args, token);
+	}
+	// `f()` has no arguments, unless f has a parameter
+	if (param_count > 0 || arg_count > 0 || preprocessor->args.count > base) arg_count++;
+	if (arg_count != param_count) {
+		preprocessor->first = name->token;
+		assert(false, preprocessor, "Macro %s expects %i arguments, given %i", macro_name, param_count, arg_count);
+		return EXPAND_ERROR;
+	}
+	starts[param_count] = preprocessor->args.count;
+
+	for (int i = 0; i < param_count; i++) {
+		int count = starts[i + 1] - starts[i];
+		push_tokens(preprocessor, preprocessor->args.items + starts[i], count, 0, NULL);
+		int result = expand_nested(preprocessor, count, &preprocessor->args);
+		if (result == EXPAND_UNFINISHED) {
+			preprocessor->first = name->token;
+			assert(false, preprocessor, "Unfinished call in argument %i of macro %s", i + 1, macro_name);
+		}
+		if (result != EXPAND_VALID) return EXPAND_ERROR;
+		starts[param_count + 1 + i] = preprocessor->args.count;
+	}
+
+	HideSet hide = hideset_add(preprocessor, hideset_intersect(preprocessor, name->hide, token.hide), name->token.str);
+	// the call, from its name to its `)`
+	struct Token site = name->token;
+	int call_end = token.token.site_offset + token.token.site_length;
+	if (call_end > site.site_offset + site.site_length) site.site_length = call_end - site.site_offset;
+	const struct MacroToken *body = preprocessor->bodies.items + macro->body;
+	for (int i = macro->body_count - 1; i >= 0; i--) {
+		int param = body[i].param;
+		if (param < 0) {
+			push_tokens(preprocessor, &body[i], 1, hide, &site);
+			continue;
+		}
+		int start = (param == 0) ? starts[param_count] : starts[param_count + param];
+		int end = starts[param_count + 1 + param];
+		push_tokens(preprocessor, preprocessor->args.items + start, end - start, hide, &site);
+	}
+	preprocessor->args.count = base;
+	return EXPAND_VALID;
+}
+
+/* Reads the next token of the stream, expanding the macros it starts with
+ * until one that does not.
+ * Returns: enum expand_results
+ */
+static int expand_next(struct Preprocessor *preprocessor, struct MacroToken *output) {
+	while (true) {
+		if (!read_token(preprocessor, output)) return EXPAND_ERROR;
+		if (output->expanded || output->token.id != TOKEN_IDENTIFIER || preprocessor->macros.count == 0)
+			return EXPAND_VALID;
+		int *index = macromap_get(&preprocessor->macros, output->token.str);
+		if (index == NULL || hideset_has(preprocessor, output->hide, output->token.str)) return EXPAND_VALID;
+		struct Macro *macro = &preprocessor->definitions.items[*index];
+		if (macro->param_count < 0) {
+			if (!expand_object(preprocessor, macro, output)) return EXPAND_ERROR;
+			continue;
+		}
+
+		// a function-like macro's name is left alone unless a call follows
+		struct MacroToken open;
+		if (!read_token(preprocessor, &open)) return EXPAND_ERROR;
+		if (open.token.id != TOKEN_GROUP_OPEN) {
+			unread_token(preprocessor, &open);
+			return EXPAND_VALID;
+		}
+		struct MacroToken name = *output;
+		int result = expand_call(preprocessor, macro, &name);
+		if (result != EXPAND_VALID) return result;
+	}
+}
+
+/* Parses the definition after a `#define` token and adds its macro.
+ * Returns: whether successful
+ */
+static bool define(struct Preprocessor *preprocessor, const struct Token *directive) {
+	preprocessor->first = *directive;
+	struct MacroToken name, token;
+	if (!read_token(preprocessor, &name)) return false;
+	if (assert(name.token.id == TOKEN_IDENTIFIER, preprocessor,
+		"Invalid macro definition (expected `#define name value;` or `#define name(params) value;`)"))
+		return false;
+	if (assert(macromap_get(&preprocessor->macros, name.token.str) == NULL, preprocessor,
+		"Redefined macro: %s", interner_string(preprocessor->interner, name.token.str)))
+		return false;
+	if (!read_token(preprocessor, &token)) return false;
+
+	StrId params[PREPROCESSOR_MAX_PARAMS];
+	int param_count = -1;
+	if (token.token.id == TOKEN_GROUP_OPEN && token.token.offset == name.token.offset + name.token.length) {
+		// function-like: its parameters are listed right after its name
+		param_count = 0;
+		if (!read_token(preprocessor, &token)) return false;
+		while (param_count > 0 || token.token.id != TOKEN_GROUP_CLOSE) {
+			if (assert(token.token.id == TOKEN_IDENTIFIER, preprocessor,
+				"Invalid macro definition (expected parameter name)")
+				|| assert(param_count < PREPROCESSOR_MAX_PARAMS, preprocessor,
+				"Too many macro parameters (max %i)", PREPROCESSOR_MAX_PARAMS))
+				return false;
+			for (int i = 0; i < param_count; i++) {
+				if (assert(params[i] != token.token.str, preprocessor, "Duplicate macro parameter: %s",
+					interner_string(preprocessor->interner, token.token.str)))
+					return false;
+			}
+			params[param_count++] = token.token.str;
+			if (!read_token(preprocessor, &token)) return false;
+			if (token.token.id == TOKEN_GROUP_CLOSE) break;
+			if (assert(token.token.id == TOKEN_LIST_SEPARATOR, preprocessor,
+				"Invalid macro definition (expected `,` or `)` after parameter)")
+				|| !read_token(preprocessor, &token))
+				return false;
+		}
+		if (!read_token(preprocessor, &token)) return false;
+	}
+
+	struct Macro macro = {
+		.param_count = param_count,
+		.body = preprocessor->bodies.count,
+		.generation = -1
+	};
+	while (token.token.id != TOKEN_END_OF_STATEMENT) {
+		if (assert(token.token.id != TOKEN_EOF, preprocessor, "Expected `;` to end the macro definition")
+			|| assert(token.token.id != TOKEN_PREPROCESSOR_CMD && token.token.id != TOKEN_DIRECTIVE_INCLUDE
+			&& token.token.id != TOKEN_DIRECTIVE_DEFINE, preprocessor,
+			"Invalid macro definition (preprocessor command in its value)"))
+			return false;
+		if (token.token.id == TOKEN_IDENTIFIER) {
+			for (int i = 0; i < param_count; i++) {
+				if (params[i] == token.token.str) token.param = i;
+			}
+		}
+		macrotokenvec_push(&preprocessor->bodies, token);
+		if (!read_token(preprocessor, &token)) return false;
+	}
+	macro.body_count = preprocessor->bodies.count - macro.body;
+	macrovec_push(&preprocessor->definitions, macro);
+	macromap_put(&preprocessor->macros, name.token.str, preprocessor->definitions.count - 1);
+	// the new macro may expand in any cached expansion
+	preprocessor->generation++;
+	macrotokenvec_clear(&preprocessor->cache);
+	return true;
+}
+
+/* Gets the next token of the source, after expanding macros and removing
+ * definitions.
+ * Returns: enum preprocess_code
+ *
+ * token - where to store the token. TOKEN_EOF at the end of the source,
+ *      and after it
+ */
+int preprocessor_next(struct Preprocessor *preprocessor, struct Token *token) {
+	while (true) {
+		struct MacroToken next;
+		if (expand_next(preprocessor, &next) != EXPAND_VALID) return PREPROCESS_ERROR;
+		if (next.token.id != TOKEN_DIRECTIVE_DEFINE) {
+			*token = next.token;
+			return PREPROCESS_VALID;
+		}
+		if (!define(preprocessor, &next.token)) return PREPROCESS_ERROR;
+	}
+}
@@ -0,0 +1,98 @@
+/* preprocessor.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __PREPROCESSOR_H__
+#define __PREPROCESSOR_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "token.h"
+#include "source.h"
+#include "utils/map.h"
+#include "utils/vec.h"
+#include "utils/interner.h"
+#include "utils/arena.h"
+
+#define PREPROCESSOR_MAX_PARAMS 64 // of a function-like macro
+
+enum preprocess_code {
+	PREPROCESS_ERROR,
+	PREPROCESS_VALID
+};
+
+// a set of macro names, as the index of its first node in
+// Preprocessor.hide_sets. 0 is the empty set
+typedef uint32_t HideSet;
+
+/* a node of a hide-set: the set holds macro and every name of the set next. */
+struct HideSetNode {
+	StrId macro;
+	HideSet next;
+};
+
+/* a token being expanded, or of a macro's body. */
+struct MacroToken {
+	struct Token token;
+	HideSet hide; // macros that may not expand the token, as it came from their expansion
+	int param; // in a macro's body, index of the parameter the token names, else -1
+	bool expanded; // is already the full expansion of its macros, so needs no rescan
+};
+
+/* a #define. Its body is tokens of Preprocessor.bodies, already scanned and
+ * interned, which are copied into the token stream wherever it expands.
+ */
+struct Macro {
+	int param_count; // -1 if object-like
+	int body; // index of the first token of its body
+	int body_count;
+	int generation; // of the preprocessor, when its expansion was cached. -1 if never
+	int cache; // index of the first token of its cached expansion, -1 if it cannot be cached
+	int cache_count;
+};
+
+DEFINE_MAP(MacroMap, macromap, StrId, int, map_hash_int, map_int_equal)
+DEFINE_VEC(MacroVec, macrovec, struct Macro)
+DEFINE_VEC(MacroTokenVec, macrotokenvec, struct MacroToken)
+DEFINE_VEC(HideSetVec, hidesetvec, struct HideSetNode)
+
+/* reads the next token of the source being preprocessed, like scanner_scan.
+ * Returns: SCAN_VALID or SCAN_ERROR (after reporting it)
+ */
+typedef int (*TokenReader)(void *context, struct Token *token);
+
+/* expands macros in a stream of tokens, between the scanner and the parser. */
+struct Preprocessor {
+	MacroMap macros; // name -> index in definitions
+	MacroVec definitions;
+	MacroTokenVec bodies; // of every definition
+	MacroTokenVec pending; // tokens to read before the reader's, the next one last
+	int floor; // count of pending tokens that a nested expansion may not read, -1 if none
+	MacroTokenVec args; // arguments of the calls being expanded, the innermost call's last
+	MacroTokenVec cache; // expansions of object-like macros
+	int generation; // count of definitions. cached expansions of an older generation are stale
+	HideSetVec hide_sets;
+	HideSet union_of[2]; // the last hide-sets united, and union_result their union
+	HideSet union_result;
+	TokenReader read;
+	void *read_context;
+	bool ended; // the reader reached the end of the source, at eof
+	struct Token eof;
+	struct Token first; // first token of the definition or call being preprocessed
+	struct Token last; // last token read
+	Interner *interner;
+	Arena *arena; // per-source allocations
+	const char *text; // source text that tokens are spans of
+	FILE *err; // where errors are reported
+};
+
+void preprocessor_init(struct Preprocessor *preprocessor, Interner *interner, Arena *arena);
+void preprocessor_deinit(struct Preprocessor *preprocessor);
+void preprocessor_set_source(struct Preprocessor *preprocessor, const struct Source *source,
+	TokenReader read, void *read_context);
+
+int preprocessor_next(struct Preprocessor *preprocessor, struct Token *token);
+
+#endif
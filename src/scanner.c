@@ -4,171 +4,491 @@
 */
 
 #include <stdio.h>
-#include <stdlib.h>
 #include <stdbool.h>
-#include <string.h>
-#include <sys/types.h>
-#include <ctype.h>
 #include <stdarg.h>
-#include <regex.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+// whether whitespace, comments and identifiers are skipped with SIMD
+// instructions, where the CPU has them, rather than a character at a time
+#ifndef SCAN_SIMD
+#define SCAN_SIMD 1
+#endif
 
 #include "scanner.h"
 #include "token.h"
+#include "utils/stats.h"
 
-// maximum expression length (in chars for a token)
-#define CHARBUF_SIZE 4096
-#define REGEX_FLAGS (REG_EXTENDED | REG_NOSUB)
-#define CSLIM_TOKEN_REGEXES_COUNT 15
+_Static_assert(TOKENS_COUNT <= STATS_TOKEN_KINDS, "STATS_TOKEN_KINDS too small to count every kind of token");
 
-static struct TokenRegex token_regexes[CSLIM_TOKEN_REGEXES_COUNT];
-static int token_regexes_count = 0;
+// character classes, the input alphabet of the scanner's state machine
+enum char_classes {
+	CHAR_INVALID,
+	CHAR_SPACE, // whitespace and control characters
+	CHAR_ALPHA, // [a-zA-Z_]
+	CHAR_DIGIT,
+	CHAR_QUOTE,
+	CHAR_BACKSLASH,
+	CHAR_HASH,
+	CHAR_SLASH,
+	CHAR_SINGLE, // complete token by itself, see single_char_tokens
+	CHAR_COMPARE, // operator that may be followed by '=': = ! < >
+	CHAR_EOF
+};
 
-/* Attempts to compile a regular expression string to store in token_regexes.
- * Exits if fails.
- *
- * tokenID - corresponding token that the regex will identify in code
- * regexstr - the regular expression to match code
+// scanner states. each token class has its own path through these states
+enum scan_states {
+	STATE_START,
+	STATE_SLASH, // '/' seen, either division or start of a comment
+	STATE_COMPARE, // CHAR_COMPARE seen, either alone or followed by '='
+	STATE_COMMENT,
+	STATE_IDENTIFIER,
+	STATE_INT,
+	STATE_FRACTION_START, // int followed by '.', expecting a digit
+	STATE_FRACTION,
+	STATE_STRING,
+	STATE_STRING_ESCAPE,
+	STATE_PREPROCESSOR_START, // '#' seen, expecting a letter
+	STATE_PREPROCESSOR
+};
+
+static const unsigned char char_classes[256] = {
+	[0 ... ' '] = CHAR_SPACE,
+	['a' ... 'z'] = CHAR_ALPHA,
+	['A' ... 'Z'] = CHAR_ALPHA,
+	['_'] = CHAR_ALPHA,
+	['0' ... '9'] = CHAR_DIGIT,
+	['"'] = CHAR_QUOTE,
+	['\\'] = CHAR_BACKSLASH,
+	['#'] = CHAR_HASH,
+	['/'] = CHAR_SLASH,
+	['.'] = CHAR_SINGLE,
+	[';'] = CHAR_SINGLE,
+	[','] = CHAR_SINGLE,
+	['('] = CHAR_SINGLE,
+	[')'] = CHAR_SINGLE,
+	['{'] = CHAR_SINGLE,
+	['}'] = CHAR_SINGLE,
+	['['] = CHAR_SINGLE,
+	[']'] = CHAR_SINGLE,
+	['-'] = CHAR_SINGLE,
+	['~'] = CHAR_SINGLE,
+	['!'] = CHAR_COMPARE,
+	['$'] = CHAR_SINGLE,
+	['%'] = CHAR_SINGLE,
+	['^'] = CHAR_SINGLE,
+	['&'] = CHAR_SINGLE,
+	['*'] = CHAR_SINGLE,
+	['+'] = CHAR_SINGLE,
+	['='] = CHAR_COMPARE,
+	['<'] = CHAR_COMPARE,
+	['>'] = CHAR_COMPARE,
+	['|'] = CHAR_SINGLE,
+	[':'] = CHAR_SINGLE,
+	['?'] = CHAR_SINGLE
+};
+
+static const unsigned char single_char_tokens[256] = {
+	['.'] = TOKEN_OPERATOR,
+	[';'] = TOKEN_END_OF_STATEMENT,
+	[','] = TOKEN_LIST_SEPARATOR,
+	['('] = TOKEN_GROUP_OPEN,
+	[')'] = TOKEN_GROUP_CLOSE,
+	['{'] = TOKEN_BLOCK_OPEN,
+	['}'] = TOKEN_BLOCK_CLOSE,
+	['['] = TOKEN_LIST_OPEN,
+	[']'] = TOKEN_LIST_CLOSE,
+	['-'] = TOKEN_OPERATOR,
+	['~'] = TOKEN_OPERATOR,
+	['$'] = TOKEN_OPERATOR,
+	['%'] = TOKEN_OPERATOR,
+	['^'] = TOKEN_OPERATOR,
+	['&'] = TOKEN_OPERATOR,
+	['*'] = TOKEN_OPERATOR,
+	['+'] = TOKEN_OPERATOR,
+	['|'] = TOKEN_OPERATOR,
+	[':'] = TOKEN_OPERATOR,
+	['?'] = TOKEN_OPERATOR
+};
+
+/* Kernels that skip a run of characters of one kind, which is most of what
+ * the scanner reads: whitespace between tokens, the text of a comment and the
+ * rest of an identifier. Each returns the first character after the run,
+ * or end. The SIMD versions classify 16 or 32 characters at once and finish
+ * the last, partial block with the scalar version, since the source is not
+ * padded to read past its end.
  */
-static void register_token_regex(int tokenID, const char *regexstr) {
-	struct TokenRegex *tr = &token_regexes[token_regexes_count];
-	tr->tokenID = tokenID;
-	int error = regcomp(&tr->regex, regexstr, REGEX_FLAGS);
-	if (error) {
-		fprintf(stderr, "Regex creation failed! %s\n", regexstr);
-		const int errStrSize = 1024;
-		char errStr[errStrSize];
-		regerror(error, &tr->regex, errStr, errStrSize);
-		fprintf(stderr, "%s\n", errStr);
-		exit(EXIT_FAILURE);
+struct ScanKernels {
+	// skips whitespace, adding the newlines in it to *ln
+	const char *(*skip_space)(const char *cursor, const char *end, int *ln);
+	// skips to the end of the line, at its newline
+	const char *(*skip_line)(const char *cursor, const char *end);
+	// skips [a-zA-Z0-9_]
+	const char *(*skip_word)(const char *cursor, const char *end);
+};
+
+static const char *skip_space_scalar(const char *cursor, const char *end, int *ln) {
+	while (cursor < end && char_classes[(unsigned char) *cursor] == CHAR_SPACE) {
+		if (*cursor == '\n') *ln += 1;
+		cursor++;
+	}
+	return cursor;
+}
+
+static const char *skip_line_scalar(const char *cursor, const char *end) {
+	while (cursor < end && *cursor != '\n') cursor++;
+	return cursor;
+}
+
+static const char *skip_word_scalar(const char *cursor, const char *end) {
+	while (cursor < end) {
+		int class = char_classes[(unsigned char) *cursor];
+		if (class != CHAR_ALPHA && class != CHAR_DIGIT) break;
+		cursor++;
 	}
-	token_regexes_count++;
+	return cursor;
 }
 
-/* One-time initialization of scanner resources (namely token regexes).
- * These are the same for every C-Slim Scanner. Calling more than once does nothing.
+#if SCAN_SIMD && defined(__SSE2__)
+#define SCAN_HAS_SSE2 1
+
+/* Returns a bitmask of the 16 characters that are whitespace (at most ' '). */
+static inline unsigned space_mask_sse2(__m128i chars) {
+	__m128i space = _mm_set1_epi8(' ');
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(chars, space), space));
+}
+
+/* Returns a bitmask of the 16 characters that are in [a-zA-Z0-9_]. Bytes
+ * above 0x7f compare as negative, so they fall outside every range.
  */
-void scanner_global_init() {
-	if (token_regexes_count != 0) return;
-	register_token_regex(TOKEN_END_OF_STATEMENT, "^;");
-	register_token_regex(TOKEN_OPERATOR_DIVIDE, "^/[^/]");
-	register_token_regex(TOKEN_OPERATOR, "^[-.~!$%^&*+=|:?]");
-	register_token_regex(TOKEN_LIST_SEPARATOR, "^,");
-	register_token_regex(TOKEN_GROUP_OPEN, "^\\(");
-	register_token_regex(TOKEN_GROUP_CLOSE, "^\\)");
-	register_token_regex(TOKEN_BLOCK_OPEN, "^\\{");
-	register_token_regex(TOKEN_BLOCK_CLOSE, "^\\}");
-	register_token_regex(TOKEN_IDENTIFIER, "^[a-zA-Z_][a-zA-Z0-9_]*[^a-zA-Z0-9_]$");
-	register_token_regex(TOKEN_FLOAT_LITERAL, "^([0-9]+)[.]([0-9]+)[^0-9]$");
-	register_token_regex(TOKEN_INT_LITERAL, "^([0-9]+)[^0-9.]$");
-	register_token_regex(TOKEN_STRING_LITERAL, "^\"([^\\\"]|\\\\.)*\"");
-	register_token_regex(TOKEN_LIST_OPEN, "^\\[");
-	register_token_regex(TOKEN_LIST_CLOSE, "^\\]");
-	register_token_regex(TOKEN_PREPROCESSOR_CMD, "^#([a-zA-Z]+) ");
-}
-
-void scanner_init(struct Scanner *scanner) {
-	scanner->buf = malloc(sizeof(char) * CHARBUF_SIZE);
-	scanner->token_regexes = token_regexes;
-	scanner->token_regexes_count = token_regexes_count;
+static inline unsigned word_mask_sse2(__m128i chars) {
+	// setting bit 5 folds [A-Z] onto [a-z]
+	__m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+		_mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+		_mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+	__m128i underscore = _mm_cmpeq_epi8(chars, _mm_set1_epi8('_'));
+	return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), underscore));
+}
+
+static const char *skip_space_sse2(const char *cursor, const char *end, int *ln) {
+	for (; end - cursor >= 16; cursor += 16) {
+		__m128i chars = _mm_loadu_si128((const __m128i*) cursor);
+		unsigned spaces = space_mask_sse2(chars);
+		unsigned newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\n')));
+		if (spaces != 0xffff) {
+			int run = __builtin_ctz(~spaces);
+			*ln += __builtin_popcount(newlines & ((1u << run) - 1));
+			return cursor + run;
+		}
+		*ln += __builtin_popcount(newlines);
+	}
+	return skip_space_scalar(cursor, end, ln);
+}
+
+static const char *skip_line_sse2(const char *cursor, const char *end) {
+	for (; end - cursor >= 16; cursor += 16) {
+		__m128i chars = _mm_loadu_si128((const __m128i*) cursor);
+		unsigned newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\n')));
+		if (newlines != 0) return cursor + __builtin_ctz(newlines);
+	}
+	return skip_line_scalar(cursor, end);
+}
+
+static const char *skip_word_sse2(const char *cursor, const char *end) {
+	for (; end - cursor >= 16; cursor += 16) {
+		unsigned words = word_mask_sse2(_mm_loadu_si128((const __m128i*) cursor));
+		if (words != 0xffff) return cursor + __builtin_ctz(~words);
+	}
+	return skip_word_scalar(cursor, end);
+}
+
+static const struct ScanKernels sse2_kernels = {
+	skip_space_sse2, skip_line_sse2, skip_word_sse2
+};
+
+#if defined(__GNUC__) && defined(__x86_64__)
+// AVX2 is not part of the x86-64 baseline, so these are compiled for it
+// alone and only called if the CPU supports it (see scanner_init)
+#define SCAN_AVX2 __attribute__((target("avx2")))
+#define SCAN_HAS_AVX2 1
+
+SCAN_AVX2 static inline unsigned space_mask_avx2(__m256i chars) {
+	__m256i space = _mm256_set1_epi8(' ');
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(chars, space), space));
+}
+
+SCAN_AVX2 static inline unsigned word_mask_avx2(__m256i chars) {
+	__m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+	__m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+	__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+	__m256i underscore = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('_'));
+	return _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(alpha, digit), underscore));
+}
+
+SCAN_AVX2 static const char *skip_space_avx2(const char *cursor, const char *end, int *ln) {
+	for (; end - cursor >= 32; cursor += 32) {
+		__m256i chars = _mm256_loadu_si256((const __m256i*) cursor);
+		unsigned spaces = space_mask_avx2(chars);
+		unsigned newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\n')));
+		if (spaces != 0xffffffff) {
+			int run = __builtin_ctz(~spaces);
+			*ln += __builtin_popcount(newlines & ((1u << run) - 1));
+			return cursor + run;
+		}
+		*ln += __builtin_popcount(newlines);
+	}
+	return skip_space_sse2(cursor, end, ln);
+}
+
+SCAN_AVX2 static const char *skip_line_avx2(const char *cursor, const char *end) {
+	for (; end - cursor >= 32; cursor += 32) {
+		__m256i chars = _mm256_loadu_si256((const __m256i*) cursor);
+		unsigned newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\n')));
+		if (newlines != 0) return cursor + __builtin_ctz(newlines);
+	}
+	return skip_line_sse2(cursor, end);
+}
+
+SCAN_AVX2 static const char *skip_word_avx2(const char *cursor, const char *end) {
+	for (; end - cursor >= 32; cursor += 32) {
+		unsigned words = word_mask_avx2(_mm256_loadu_si256((const __m256i*) cursor));
+		if (words != 0xffffffff) return cursor + __builtin_ctz(~words);
+	}
+	return skip_word_sse2(cursor, end);
+}
+
+static const struct ScanKernels avx2_kernels = {
+	skip_space_avx2, skip_line_avx2, skip_word_avx2
+};
+#endif
+#else
+static const struct ScanKernels scalar_kernels = {
+	skip_space_scalar, skip_line_scalar, skip_word_scalar
+};
+#endif
+
+void scanner_init(struct Scanner *scanner, Interner *interner) {
+	scanner->interner = interner;
+	scanner->err = stderr;
+	scanner->start = NULL;
+	scanner->cursor = NULL;
+	scanner->end = NULL;
+#if SCAN_HAS_AVX2
+	scanner->kernels = __builtin_cpu_supports("avx2") ? &avx2_kernels : &sse2_kernels;
+#elif SCAN_HAS_SSE2
+	scanner->kernels = &sse2_kernels;
+#else
+	scanner->kernels = &scalar_kernels;
+#endif
+}
+
+/* Sets the text to scan tokens from, starting at its beginning. */
+void scanner_set_source(struct Scanner *scanner, const struct Source *source) {
+	scanner->start = source->data;
+	scanner->cursor = source->data;
+	scanner->end = source->data + source->size;
 }
 
 /* Checks if the condition is true, and if not, then prints the error message, along with the current line and token information.
- * Variable arguments at end are for error_string format args. 
+ * Variable arguments at end are for error_string format args.
  * Returns: whether the check failed (condition was false)
+ *
+ * at - position of the error in the source text
  */
-static bool assert(bool condition, char *buf, int buflen, int ln, const char *error_string, ...) {
+static bool assert(bool condition, struct Scanner *scanner, const char *at, int ln, const char *error_string, ...) {
 	if (condition) return false;
 
 	// only print current line
-	char *next_newline = index(buf, '\n');
-	if (next_newline != NULL) {
-		*next_newline = '\0';
-	} else {
-		buf[buflen] = '\0';
-	}
+	const char *line_start = at;
+	while (line_start > scanner->start && line_start[-1] != '\n') line_start--;
+	const char *line_end = at;
+	while (line_end < scanner->end && *line_end != '\n') line_end++;
 
 	va_list va;
 	va_start(va, error_string);
-	vfprintf(stderr, error_string, va);
+	vfprintf(scanner->err, error_string, va);
 	va_end(va);
 
-	fprintf(stderr, " at line %i: \n\t%s\n", ln, buf);
+	fprintf(scanner->err, " at line %i: \n\t%.*s\n", ln, (int) (line_end - line_start), line_start);
 	return true;
 }
 
-/* Reads characters until getting the next token from the file.
+/* Outputs the token of the given type starting at token_start. cursor is at
+ * the character that completed the token: it either ends the token's text or,
+ * for tokens whose end is marked by the next token, is left to be scanned again
+ * as the start of the next token. Identifiers that are keywords, and
+ * preprocessor commands that are directives, are output as their own tokens.
+ */
+static int accept(struct Scanner *scanner, const char *token_start, const char *cursor,
+	int start_ln, int tokenID, struct Token *output) {
+	const char *token_end = token_end_marked_by_next(tokenID) ? cursor : cursor + 1;
+	scanner->cursor = token_end;
+
+	int length = token_end - token_start;
+	output->str = STR_NONE;
+	switch (tokenID) {
+	case TOKEN_IDENTIFIER:
+		tokenID = token_keyword(token_start, length);
+		if (tokenID == TOKEN_IDENTIFIER)
+			output->str = interner_intern(scanner->interner, token_start, length);
+		break;
+	case TOKEN_STRING_LITERAL: // without quotes
+		output->str = interner_intern(scanner->interner, token_start + 1, length - 2);
+		break;
+	case TOKEN_PREPROCESSOR_CMD: // without #
+		tokenID = token_directive(token_start + 1, length - 1);
+		if (tokenID == TOKEN_PREPROCESSOR_CMD)
+			output->str = interner_intern(scanner->interner, token_start + 1, length - 1);
+		break;
+	}
+	output->id = tokenID;
+	STATS_TOKEN(tokenID);
+	output->ln = start_ln;
+	output->offset = token_start - scanner->start;
+	output->length = length;
+	output->site_offset = output->offset;
+	output->site_length = length;
+	return SCAN_VALID;
+}
+
+/* Reads characters until getting the next token from the source.
+ * Every token class is recognized by a single deterministic state machine
+ * over char_classes, looking at each character once. Runs of whitespace,
+ * comments and identifiers are skipped in blocks by the scanner's kernels.
  * Returns:
  *   SCAN_NULL ...  no token scanned yet
  *   SCAN_ERROR ... error, invalid/illegal token detected
  *   SCAN_VALID ... valid token scanned
  *
- * file - the file to scan from
  * ln - pointer to current line number, updated as lines are counted
  * output - where to store scanned token data
  */
-int scanner_scan(struct Scanner *scanner, FILE *file, int *ln, struct Token *output) {
-	char *buf = scanner->buf;
-	int buf_index = 0;
+int scanner_scan(struct Scanner *scanner, int *ln, struct Token *output) {
+	const char *cursor = scanner->cursor;
+	const char *end = scanner->end;
+	const char *token_start = cursor;
 	int start_ln = *ln;
-	bool commented = false;
-	bool leading_whitespace = true;
+	int state = STATE_START;
 
 	while (true) {
-		char c = fgetc(file);
-		if (c == '\n') {
-			*ln += 1;
-			commented = false;
-			if (leading_whitespace) {
-				start_ln++;
+		int c = (cursor < end) ? (unsigned char) *cursor : EOF;
+		int class = (c == EOF) ? CHAR_EOF : char_classes[c];
+
+		switch (state) {
+		case STATE_START:
+			if (class == CHAR_SPACE) {
+				// most tokens are apart by a single space, not worth a block
+				if (cursor + 1 < end && char_classes[(unsigned char) cursor[1]] != CHAR_SPACE) break;
+				cursor = scanner->kernels->skip_space(cursor, end, ln);
+				continue;
 			}
-		}
-		if (commented) continue;
-		if (buf_index == 0 && c <= ' ') {
-			if (c == EOF) {
+			token_start = cursor;
+			start_ln = *ln;
+			switch (class) {
+			case CHAR_EOF:
+				scanner->cursor = cursor;
 				output->id = TOKEN_EOF;
+				STATS_TOKEN(TOKEN_EOF);
 				output->ln = start_ln;
-				output->string = NULL;
+				output->offset = cursor - scanner->start;
+				output->length = 0;
+				output->site_offset = output->offset;
+				output->site_length = 0;
+				output->str = STR_NONE;
 				return SCAN_VALID;
+			case CHAR_ALPHA:
+				state = STATE_IDENTIFIER;
+				break;
+			case CHAR_DIGIT:
+				state = STATE_INT;
+				break;
+			case CHAR_QUOTE:
+				state = STATE_STRING;
+				break;
+			case CHAR_HASH:
+				state = STATE_PREPROCESSOR_START;
+				break;
+			case CHAR_SLASH:
+				state = STATE_SLASH;
+				break;
+			case CHAR_SINGLE:
+				return accept(scanner, token_start, cursor, start_ln, single_char_tokens[c], output);
+			case CHAR_COMPARE:
+				state = STATE_COMPARE;
+				break;
+			default:
+				assert(false, scanner, cursor, start_ln, "Invalid expression");
+				return SCAN_ERROR;
 			}
-			leading_whitespace = true;
-			continue;
-		} else {
-			leading_whitespace = false;
-		}
-		if (buf_index >= 1 && c == '/' && buf[buf_index - 1] == '/') {
-			commented = true;
-			buf_index--;
+			break;
+		case STATE_SLASH:
+			if (c == '/') {
+				state = STATE_COMMENT;
+				break;
+			}
+			return accept(scanner, token_start, cursor, start_ln, TOKEN_OPERATOR_DIVIDE, output);
+		case STATE_COMPARE:
+			if (c == '=')
+				return accept(scanner, token_start, cursor, start_ln, TOKEN_OPERATOR, output);
+			// the operator alone, completed by its own character
+			return accept(scanner, token_start, token_start, start_ln, TOKEN_OPERATOR, output);
+		case STATE_COMMENT:
+			// the newline is consumed as leading whitespace of the next token
+			cursor = scanner->kernels->skip_line(cursor, end);
+			state = STATE_START;
 			continue;
-		}
-
-		buf[buf_index] = c;
-		buf[buf_index + 1] = '\0';
-		
-		for (int i = 0; i < scanner->token_regexes_count; i++) {
-			struct TokenRegex *tr = &scanner->token_regexes[i];
-			if (regexec(&tr->regex, buf, 0, NULL, 0) != 0) continue;
-
-			int token_string_size = buf_index + 2;
-			if (token_end_marked_by_next(tr->tokenID)) {
-				buf[buf_index] = '\0';
-				token_string_size--;
-				fseek(file, -1, SEEK_CUR); 
+		case STATE_IDENTIFIER:
+			cursor = scanner->kernels->skip_word(cursor, end);
+			return accept(scanner, token_start, cursor, start_ln, TOKEN_IDENTIFIER, output);
+		case STATE_INT:
+			if (class == CHAR_DIGIT) break;
+			if (c == '.') {
+				state = STATE_FRACTION_START;
+				break;
 			}
-
-			output->id = tr->tokenID;
-			output->ln = start_ln;
-			char *token_string = malloc(sizeof(char) * token_string_size);
-			strncpy(token_string, buf, token_string_size);
-			output->string = token_string;
-			return SCAN_VALID;
+			return accept(scanner, token_start, cursor, start_ln, TOKEN_INT_LITERAL, output);
+		case STATE_FRACTION_START:
+			if (assert(class == CHAR_DIGIT, scanner, token_start, start_ln, "Invalid expression"))
+				return SCAN_ERROR;
+			state = STATE_FRACTION;
+			break;
+		case STATE_FRACTION:
+			if (class == CHAR_DIGIT) break;
+			return accept(scanner, token_start, cursor, start_ln, TOKEN_FLOAT_LITERAL, output);
+		case STATE_STRING:
+			if (class == CHAR_QUOTE)
+				return accept(scanner, token_start, cursor, start_ln, TOKEN_STRING_LITERAL, output);
+			if (assert(class != CHAR_EOF, scanner, token_start, start_ln, "Invalid expression"))
+				return SCAN_ERROR;
+			if (class == CHAR_BACKSLASH)
+				state = STATE_STRING_ESCAPE;
+			break;
+		case STATE_STRING_ESCAPE:
+			if (assert(class != CHAR_EOF, scanner, token_start, start_ln, "Invalid expression"))
+				return SCAN_ERROR;
+			state = STATE_STRING;
+			break;
+		case STATE_PREPROCESSOR_START:
+			if (assert(class == CHAR_ALPHA && c != '_', scanner, token_start, start_ln, "Invalid expression"))
+				return SCAN_ERROR;
+			state = STATE_PREPROCESSOR;
+			break;
+		case STATE_PREPROCESSOR:
+			if (class == CHAR_ALPHA && c != '_') break;
+			if (assert(c == ' ', scanner, token_start, start_ln, "Invalid expression"))
+				return SCAN_ERROR;
+			return accept(scanner, token_start, cursor, start_ln, TOKEN_PREPROCESSOR_CMD, output);
 		}
-		if (assert(c != EOF, buf, buf_index, start_ln, "Invalid expression"))
-			return SCAN_ERROR;
 
-		buf_index++;
-		if (assert(buf_index < CHARBUF_SIZE - 2, buf, buf_index, start_ln,
-			"Expression exceeds maximum length (%i)", CHARBUF_SIZE))
-			return SCAN_ERROR;
+		// consume character
+		if (c == '\n') *ln += 1;
+		cursor++;
 	}
 	return SCAN_NULL;
 }
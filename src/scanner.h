@@ -6,9 +6,12 @@
 #define __SCANNER_H__
 
 #include <stdio.h>
-#include <regex.h>
 
 #include "token.h"
+#include "source.h"
+#include "utils/interner.h"
+
+struct ScanKernels;
 
 enum scan_code {
 	SCAN_NULL,
@@ -16,20 +19,18 @@ enum scan_code {
 	SCAN_VALID
 };
 
-struct TokenRegex {
-	int tokenID;
-	regex_t regex;
-};
-
 struct Scanner {
-	struct TokenRegex *token_regexes;
-	int token_regexes_count;
-    char *buf; // input character buffer
+	const char *start; // beginning of the source text
+	const char *cursor; // next character to scan
+	const char *end; // one past the last character of the source text
+	Interner *interner; // for token text
+	FILE *err; // where errors are reported
+	const struct ScanKernels *kernels; // fastest for the CPU, see scanner.c
 };
 
-void scanner_global_init();
-void scanner_init(struct Scanner *scanner);
+void scanner_init(struct Scanner *scanner, Interner *interner);
+void scanner_set_source(struct Scanner *scanner, const struct Source *source);
 
-int scanner_scan(struct Scanner *scanner, FILE *file, int *ln, struct Token *output);
+int scanner_scan(struct Scanner *scanner, int *ln, struct Token *output);
 
 #endif
@@ -0,0 +1,92 @@
+/* source.c
+ * Loads whole input files into memory for scanning. Regular files are
+ * memory-mapped; pipes, terminals and stdin are read into a heap buffer.
+ * author: Andrew Klinge
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "source.h"
+#include "utils/stats.h"
+
+// initial buffer size when reading input of unknown length
+#define SOURCE_READ_SIZE 65536
+
+/* Reads everything from the file descriptor into a heap buffer.
+ * Returns: whether succeeded
+ */
+static bool read_all(struct Source *source, int fd) {
+	size_t size = 0;
+	size_t capacity = SOURCE_READ_SIZE;
+	char *data = malloc(capacity);
+	while (true) {
+		if (size == capacity) {
+			capacity *= 2;
+			data = realloc(data, capacity);
+		}
+		ssize_t count = read(fd, data + size, capacity - size);
+		if (count == 0) break;
+		if (count < 0) {
+			free(data);
+			return false;
+		}
+		size += count;
+	}
+	source->data = data;
+	source->size = size;
+	source->mapped = false;
+	STATS_ADD(STATS_BYTES_READ, size);
+	return true;
+}
+
+/* Loads the contents of the file with the given path. A path of "-" reads
+ * from stdin.
+ * Returns: whether succeeded
+ */
+bool source_open(struct Source *source, const char *file_name) {
+	if (strcmp(file_name, "-") == 0)
+		return read_all(source, STDIN_FILENO);
+
+	int fd = open(file_name, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return false;
+	}
+
+	bool success;
+	if (S_ISREG(info.st_mode) && info.st_size > 0) {
+		void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		success = data != MAP_FAILED;
+		if (success) {
+			madvise(data, info.st_size, MADV_SEQUENTIAL);
+			source->data = data;
+			source->size = info.st_size;
+			source->mapped = true;
+			STATS_ADD(STATS_BYTES_READ, info.st_size);
+		}
+	} else {
+		success = read_all(source, fd);
+	}
+	close(fd);
+	return success;
+}
+
+/* Releases the source's contents. Does NOT free the source. */
+void source_close(struct Source *source) {
+	if (source->mapped) {
+		munmap((void*) source->data, source->size);
+	} else {
+		free((void*) source->data);
+	}
+	source->data = NULL;
+	source->size = 0;
+}
@@ -0,0 +1,21 @@
+/* source.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __SOURCE_H__
+#define __SOURCE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* the entire text of one input file, in memory. */
+struct Source {
+	const char *data; // NOT null-terminated, see size
+	size_t size;
+	bool mapped; // whether data is a memory mapping rather than a heap buffer
+};
+
+bool source_open(struct Source *source, const char *file_name);
+void source_close(struct Source *source);
+
+#endif
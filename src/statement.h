@@ -5,17 +5,87 @@
 #ifndef __STATEMENT_H__
 #define __STATEMENT_H__
 
+#include <stdint.h>
+
+#include "symtable.h"
+#include "utils/interner.h"
+#include "utils/vec.h"
+
+enum expressions {
+	EXPR_INT,
+	EXPR_FLOAT,
+	EXPR_STRING,
+	EXPR_VAR,
+	// unary, operand is left
+	EXPR_NEG,
+	EXPR_NOT,
+	EXPR_INT_TO_FLOAT,
+	// binary
+	EXPR_ADD,
+	EXPR_SUB,
+	EXPR_MUL,
+	EXPR_DIV,
+	EXPR_MOD,
+	EXPR_LESS,
+	EXPR_LESS_EQUAL,
+	EXPR_EQUAL,
+	EXPR_NOT_EQUAL,
+	// int left operand and the power of two of an int literal right operand,
+	// from strength reduction of MUL, DIV and MOD
+	EXPR_SHL,
+	EXPR_DIV_POW2,
+	EXPR_MOD_POW2
+};
+
+// index of an expression in the nodes of its statement
+typedef uint32_t ExprId;
+#define EXPR_ID_NONE UINT32_MAX
+
+/* node of an expression tree. both operands of a binary expression have the
+ * same type, the parser converting them where needed, which is also the
+ * expression's type except for comparisons: those are ints, 1 if true.
+ * nodes are kept in an array, each after its operands, and refer to their
+ * operands by index.
+ */
+struct Expr {
+	char id; // enum expressions
+	char type; // enum types
+	union {
+		int64_t int_value;
+		double float_value;
+		StrId string;
+		Sym *sym; // a variable
+		struct {
+			ExprId left;
+			ExprId right;
+		};
+	};
+};
+
+DEFINE_VEC(ExprVec, exprvec, struct Expr)
+DEFINE_VEC(ExprIdVec, expridvec, ExprId)
+
 struct Statement {
     int id; // enum statements
     int arg_count;
-    char **args;
+    StrId *args; // valid until the parser is next called
+    Sym *sym; // variable declared or assigned, else NULL
+    ExprId expr; // value assigned or printed, else EXPR_ID_NONE. the last of its nodes
+    struct Expr *nodes; // nodes of expr. valid until the parser starts the next statement
 };
 
 enum statements { 
     STATEMENT_BREAK,
     STATEMENT_BREAK_LABEL,
-    STATEMENT_VAR_DECL,
-    STATEMENT_FUNC_DECL
+    STATEMENT_VAR_DECL, // sym, expr: the initial value, zero if none was given
+    STATEMENT_FUNC_DECL,
+    STATEMENT_INCLUDE, // args: the included path
+    STATEMENT_ASSIGN, // sym, expr
+    STATEMENT_PRINT, // expr
+    STATEMENT_IF, // expr: the condition. starts a block
+    STATEMENT_ELSE, // starts a block, right after the END of an IF's
+    STATEMENT_WHILE, // expr: the condition. starts a block
+    STATEMENT_END // ends the block of an IF, ELSE or WHILE
 };
 
 #endif
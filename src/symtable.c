@@ -1,63 +1,109 @@
 /* symtable.c
+ * Symbol table as a single hashtable of each name's innermost binding plus
+ * an undo log. Entering a scope only records the log position, and leaving
+ * it unwinds the log back to there, restoring the bindings its symbols
+ * shadowed. Looking up a name is one hashtable probe at any scope depth.
+ *
+ * Each variable is also given a slot of the frame it will live in at run
+ * time, numbered in the order variables are declared. Slots of a scope are
+ * freed when it is popped, for reuse by the variables of the next.
  * author: Andrew Klinge
 */
 
 #include <stdlib.h>
 
 #include "symtable.h"
-#include "utils/hashtable.h"
+#include "utils/stats.h"
 
 // max number of nested scopes
 const int SYMTABLE_MAX_SCOPES = 127;
 
-/* Initializes a SymTable's resources. */
+/* Initializes a SymTable's resources. Symbols added to the table are owned by
+ * the caller and must outlive their scope.
+ */
 void symtable_init(SymTable *tbl) {
-	array_init(&tbl->scopes, 8);
+	symmap_init(&tbl->bindings, 64, NULL);
+	symvec_init(&tbl->log, 64);
+	tbl->scopes = malloc(sizeof(struct SymScope) * SYMTABLE_MAX_SCOPES);
+	tbl->depth = 0;
+	tbl->slot_count = 0;
 }
 
 /* Deinitializes a SymTable's resources. Does NOT free the table. */
 void symtable_deinit(SymTable *tbl) {
-	array_deinit(&tbl->scopes);
+	symmap_deinit(&tbl->bindings);
+	symvec_deinit(&tbl->log);
+	free(tbl->scopes);
+}
+
+/* Removes the symbols added since the log had the given count, restoring
+ * whatever they shadowed.
+ */
+static void unwind(SymTable *tbl, int log_count) {
+	while (tbl->log.count > log_count) {
+		Sym *sym = symvec_pop(&tbl->log);
+		if (sym->shadowed != NULL) {
+			*symmap_get(&tbl->bindings, sym->name) = sym->shadowed;
+		} else {
+			symmap_remove(&tbl->bindings, sym->name, NULL);
+		}
+	}
+}
+
+/* Removes all symbols and scopes, including file scope. */
+void symtable_reset(SymTable *tbl) {
+	unwind(tbl, 0);
+	tbl->depth = 0;
+	tbl->slot_count = 0;
 }
 
 /* Returns 1 if error (max # scopes exceeded) else 0. */
 int symtable_push_scope(SymTable *tbl) {
-	if (tbl->scopes.count >= SYMTABLE_MAX_SCOPES) return 1;
-	HashTable *hashtbl = malloc(sizeof(HashTable));
-	array_add(&tbl->scopes, hashtbl);
-	hashtable_init(hashtbl, 8, 0);
+	if (tbl->depth >= SYMTABLE_MAX_SCOPES) return 1;
+	tbl->scopes[tbl->depth].log_count = tbl->log.count;
+	tbl->scopes[tbl->depth].slot_count = tbl->slot_count;
+	tbl->depth++;
+	STATS_SCOPE_DEPTH(tbl->depth);
 	return 0;
 }
 
 /* Removes the current scope. Returns 1 if error (no scopes to remove) else 0.
 */
 int symtable_pop_scope(SymTable *tbl) {
-	if (tbl->scopes.count <= 0) return 1;
-	HashTable *scope = (HashTable*) tbl->scopes.items[tbl->scopes.count - 1];
-	hashtable_deinit(scope);
-	free(scope);
-	tbl->scopes.count--;
+	if (tbl->depth <= 0) return 1;
+	STATS_BEGIN(STATS_PHASE_SYMTAB);
+	tbl->depth--;
+	unwind(tbl, tbl->scopes[tbl->depth].log_count);
+	tbl->slot_count = tbl->scopes[tbl->depth].slot_count;
+	STATS_END();
 	return 0;
 }
 
-/* Adds a symbol to the current scope. Does nothing if no scopes. */
+/* Adds a symbol to the current scope (file scope if no scopes are open),
+ * giving a variable the next free frame slot.
+ */
 void symtable_add(SymTable *tbl, Sym *sym) {
-	if (tbl->scopes.count <= 0) return;
-	HashTable *scope = (HashTable*) tbl->scopes.items[tbl->scopes.count - 1];
-	hashtable_add(scope, hash_string(sym->name), sym);
+	STATS_BEGIN(STATS_PHASE_SYMTAB);
+	sym->depth = tbl->depth;
+	sym->slot = (sym->id == SYM_VAR) ? tbl->slot_count++ : -1;
+	Sym **binding = symmap_get(&tbl->bindings, sym->name);
+	if (binding != NULL) {
+		sym->shadowed = *binding;
+		*binding = sym;
+	} else {
+		sym->shadowed = NULL;
+		symmap_put(&tbl->bindings, sym->name, sym);
+	}
+	symvec_push(&tbl->log, sym);
+	STATS_END();
 }
 
 /* Gets the symbol by name, searching first in local scope and continuing to
  * up to global scope. Returns null if nothing found.
  */
-Sym *symtable_get(SymTable *tbl, char *sym_name) {
-	if (tbl->scopes.count <= 0) return NULL;
-	Sym *sym = NULL;
-	int hashcode = hash_string(sym_name);
-	int at = tbl->scopes.count - 1;
-	while ((sym = hashtable_get((HashTable*) tbl->scopes.items[at], hashcode)) == NULL) {
-		at--;
-		if (at < 0) break; // searched all scopes 
-	}
-	return sym;
+Sym *symtable_get(SymTable *tbl, StrId sym_name) {
+	STATS_BEGIN(STATS_PHASE_SYMTAB);
+	Sym **binding = symmap_get(&tbl->bindings, sym_name);
+	STATS_END();
+	return (binding != NULL) ? *binding : NULL;
 }
@@ -5,7 +5,9 @@
 #ifndef __SYMTABLE_H__
 #define __SYMTABLE_H__
 
-#include "utils/array.h"
+#include "utils/map.h"
+#include "utils/vec.h"
+#include "utils/interner.h"
 
 extern const int SYMTABLE_MAX_SCOPES;
 
@@ -15,25 +17,49 @@ enum symbols {
 	SYM_STRUCT
 };
 
-/* group of code symbols within scopes. */
-typedef struct SymTable {
-	// Array scopes -> HashTable decl -> Sym decl
-	Array scopes; // lists of symbols, one per scope. highest scope is first
-} SymTable;
+// types of values
+enum types {
+	TYPE_INT,
+	TYPE_FLOAT,
+	TYPE_STRING
+};
 
 /* an entry in the symbol table. */
 typedef struct Sym {
 	char id; // enum symbols
-	char *name;
+	char type; // enum types, of a variable
+	StrId name;
+	int depth; // depth of the scope the symbol was added to
+	int slot; // frame slot holding a variable's value, -1 if not a variable
+	struct Sym *shadowed; // outer symbol of the same name this one hides, NULL if none
 } Sym;
 
+/* where the table was when a scope was pushed, to return to on popping it. */
+struct SymScope {
+	int log_count;
+	int slot_count;
+};
+
+DEFINE_MAP(SymMap, symmap, StrId, Sym*, map_hash_int, map_int_equal)
+DEFINE_VEC(SymVec, symvec, Sym*)
+
+/* group of code symbols within scopes. */
+typedef struct SymTable {
+	SymMap bindings; // name -> innermost visible Sym of that name
+	SymVec log; // undo log, every visible Sym in the order added
+	struct SymScope *scopes; // each open scope, innermost last
+	int depth; // number of open scopes. 0 is file scope
+	int slot_count; // frame slots held by visible variables
+} SymTable;
+
 void symtable_init(SymTable *tbl);
 void symtable_deinit(SymTable *tbl);
+void symtable_reset(SymTable *tbl);
 void symtable_add(SymTable *tbl, Sym *sym);
 
 int symtable_push_scope(SymTable *tbl);
 int symtable_pop_scope(SymTable *tbl);
 
-Sym *symtable_get(SymTable *tbl, char *sym_name);
+Sym *symtable_get(SymTable *tbl, StrId sym_name);
 
 #endif
@@ -2,8 +2,82 @@
  * author: Andrew Klinge
 */
 
+#include <string.h>
+
 #include "token.h"
 
+// slots of the keyword and directive tables, a power of 2
+#define KEYWORD_SLOTS 16
+
+/* a word that the scanner gives a token of its own. */
+struct Keyword {
+	const char *text; // NULL in an empty slot
+	int length;
+	int id; // enum tokens
+};
+
+// a gperf-style perfect hash: a word's slot is its length plus the values
+// here of its first and last characters, modulo KEYWORD_SLOTS. The values
+// were searched for so that no two keywords, and no two directives, share a
+// slot. Unlisted characters are 0. A new keyword needs new values if its
+// slot is taken
+static const unsigned char keyword_char_values[256] = {
+	['b'] = 6, ['e'] = 6, ['f'] = 7, ['i'] = 1, ['k'] = 1, ['p'] = 4,
+	['s'] = 1, ['t'] = 2, ['w'] = 2
+};
+
+static const struct Keyword keywords[KEYWORD_SLOTS] = {
+	[0] = { "else", 4, TOKEN_KEYWORD_ELSE },
+	[6] = { "int", 3, TOKEN_KEYWORD_INT },
+	[7] = { "string", 6, TOKEN_KEYWORD_STRING },
+	[10] = { "if", 2, TOKEN_KEYWORD_IF },
+	[11] = { "print", 5, TOKEN_KEYWORD_PRINT },
+	[12] = { "break", 5, TOKEN_KEYWORD_BREAK },
+	[13] = { "while", 5, TOKEN_KEYWORD_WHILE },
+	[14] = { "float", 5, TOKEN_KEYWORD_FLOAT }
+};
+
+// preprocessor commands, without #
+static const struct Keyword directives[KEYWORD_SLOTS] = {
+	[12] = { "define", 6, TOKEN_DIRECTIVE_DEFINE },
+	[14] = { "include", 7, TOKEN_DIRECTIVE_INCLUDE }
+};
+
+static const char *token_names[] = {
+	[TOKEN_INT_LITERAL] = "int literal",
+	[TOKEN_FLOAT_LITERAL] = "float literal",
+	[TOKEN_IDENTIFIER] = "identifier",
+	[TOKEN_KEYWORD_BREAK] = "break",
+	[TOKEN_KEYWORD_INT] = "int",
+	[TOKEN_KEYWORD_FLOAT] = "float",
+	[TOKEN_KEYWORD_STRING] = "string",
+	[TOKEN_KEYWORD_PRINT] = "print",
+	[TOKEN_KEYWORD_IF] = "if",
+	[TOKEN_KEYWORD_ELSE] = "else",
+	[TOKEN_KEYWORD_WHILE] = "while",
+	[TOKEN_PREPROCESSOR_CMD] = "preprocessor command",
+	[TOKEN_DIRECTIVE_INCLUDE] = "#include",
+	[TOKEN_DIRECTIVE_DEFINE] = "#define",
+	[TOKEN_OPERATOR_DIVIDE] = "/",
+	[TOKEN_END_OF_STATEMENT] = ";",
+	[TOKEN_EOF] = "end of file",
+	[TOKEN_STRING_LITERAL] = "string literal",
+	[TOKEN_LIST_SEPARATOR] = ",",
+	[TOKEN_GROUP_OPEN] = "(",
+	[TOKEN_GROUP_CLOSE] = ")",
+	[TOKEN_BLOCK_OPEN] = "{",
+	[TOKEN_BLOCK_CLOSE] = "}",
+	[TOKEN_LIST_OPEN] = "[",
+	[TOKEN_LIST_CLOSE] = "]",
+	[TOKEN_OPERATOR] = "operator"
+};
+
+/* Returns the name of the kind of token, NULL if tokenID is not one. */
+const char *token_name(int tokenID) {
+	if (tokenID < 0 || tokenID >= (int) (sizeof(token_names) / sizeof(token_names[0]))) return NULL;
+	return token_names[tokenID];
+}
+
 /* Returns whether the tokenID corresponds with a regex string
  * that is ended by the first character of the next token, which will need
  * to be rescanned. See scanner for implementation detail.
@@ -12,3 +86,35 @@ inline bool token_end_marked_by_next(int tokenID) {
 	return tokenID > TOKSEC_END_MARKED_BY_NEXT_START
 		&& tokenID < TOKSEC_END_MARKED_BY_NEXT_END;
 }
+
+/* Returns: the token id of the table's entry in the word's slot if it holds
+ * the word, else otherwise
+ */
+static inline int find_keyword(const struct Keyword *table, const char *text, int length, int otherwise) {
+	int slot = (length + keyword_char_values[(unsigned char) text[0]]
+		+ keyword_char_values[(unsigned char) text[length - 1]]) & (KEYWORD_SLOTS - 1);
+	const struct Keyword *keyword = &table[slot];
+	if (keyword->length == length && memcmp(keyword->text, text, length) == 0) return keyword->id;
+	return otherwise;
+}
+
+/* Returns: the keyword's token id of the identifier's text,
+ * TOKEN_IDENTIFIER if it is no keyword
+ */
+int token_keyword(const char *text, int length) {
+	return find_keyword(keywords, text, length, TOKEN_IDENTIFIER);
+}
+
+/* Returns: the directive's token id of the preprocessor command's text
+ * (without #), TOKEN_PREPROCESSOR_CMD if it is no directive
+ */
+int token_directive(const char *text, int length) {
+	return find_keyword(directives, text, length, TOKEN_PREPROCESSOR_CMD);
+}
+
+/* Interns the empty string so that its StrId is STR_NONE.
+ * Must be called before anything else is interned.
+ */
+void token_intern_empty(Interner *interner) {
+	interner_intern(interner, "", 0);
+}
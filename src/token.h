@@ -7,18 +7,37 @@
 
 #include <stdbool.h>
 
+#include "utils/interner.h"
+#include "utils/vec.h"
+
 struct Token {
 	int id; // see enum tokens
 	int ln; // line number this token originated from
-	char *string; // the origin text 
+	int offset; // start of the origin text in the source
+	int length; // length of the origin text
+	int site_offset; // start of the text the token stands for: its own, or its macro's use if expanded
+	int site_length;
+	StrId str; // interned text for identifiers, string literal contents and unknown preprocessor commands. else STR_NONE
 };
 
+DEFINE_VEC(TokenVec, tokenvec, struct Token)
+
 enum tokens { 
 	TOKSEC_END_MARKED_BY_NEXT_START,
 		TOKEN_INT_LITERAL,
 		TOKEN_FLOAT_LITERAL,
 		TOKEN_IDENTIFIER,
-		TOKEN_PREPROCESSOR_CMD,
+		TOKEN_KEYWORD_BREAK,
+		TOKEN_KEYWORD_INT,
+		TOKEN_KEYWORD_FLOAT,
+		TOKEN_KEYWORD_STRING,
+		TOKEN_KEYWORD_PRINT,
+		TOKEN_KEYWORD_IF,
+		TOKEN_KEYWORD_ELSE,
+		TOKEN_KEYWORD_WHILE,
+		TOKEN_PREPROCESSOR_CMD, // a command other than the directives below
+		TOKEN_DIRECTIVE_INCLUDE,
+		TOKEN_DIRECTIVE_DEFINE,
 		TOKEN_OPERATOR_DIVIDE,
 	TOKSEC_END_MARKED_BY_NEXT_END,  	
 
@@ -32,9 +51,18 @@ enum tokens {
 	TOKEN_BLOCK_CLOSE,
 	TOKEN_LIST_OPEN,
 	TOKEN_LIST_CLOSE,
-	TOKEN_OPERATOR
+	TOKEN_OPERATOR,
+	TOKENS_COUNT
 };
 
+// StrId of the empty string, interned before any other string
+#define STR_NONE 0
+
 bool token_end_marked_by_next(int tokenID);
+const char *token_name(int tokenID);
+int token_keyword(const char *text, int length);
+int token_directive(const char *text, int length);
+
+void token_intern_empty(Interner *interner);
 
 #endif
@@ -0,0 +1,108 @@
+/* trace.c
+ * Records what the compiler does, for debugging it, in a compact binary form
+ * cheap enough to leave in every build. Tracing is off unless trace_open is
+ * given flags. Each thread appends fixed-size records to a buffer of its
+ * own, without locking, and writes the buffer to the trace file in one go
+ * when it fills up or the thread is done, so a record costs a few stores.
+ * Threads' buffers may be written in any order, but a thread's records stay
+ * in order and each record names its file. cslim_trace decodes a trace
+ * file to text (see trace_decoder.c).
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+#define TRACE_BUFFER_RECORDS 4096
+#define TRACE_MAX_PATH 4096 // longer paths are cut short, so that a FILE record fits in a buffer
+
+int trace_flags = 0; // set by trace_open, before any thread but the main one starts
+
+static FILE *trace_out;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER; // held while writing to trace_out
+static atomic_int file_count; // files started, by every thread
+
+static _Thread_local struct TraceRecord *buffer; // allocated by the thread's first record
+static _Thread_local int buffered; // number of records in buffer
+static _Thread_local int current_file; // index of the file the thread is compiling
+
+/* Starts tracing what flags selects into a new file at path.
+ * Returns: whether successful
+ */
+bool trace_open(const char *path, int flags) {
+	trace_out = fopen(path, "wb");
+	if (trace_out == NULL) return false;
+	uint32_t version = TRACE_VERSION;
+	fwrite(TRACE_MAGIC, sizeof(char), 4, trace_out);
+	fwrite(&version, sizeof(version), 1, trace_out);
+	atomic_init(&file_count, 0);
+	trace_flags = flags;
+	return true;
+}
+
+/* Writes the calling thread's buffered records to the trace file. */
+static void write_buffer() {
+	if (buffered == 0) return;
+	pthread_mutex_lock(&trace_lock);
+	fwrite(buffer, sizeof(struct TraceRecord), buffered, trace_out);
+	pthread_mutex_unlock(&trace_lock);
+	buffered = 0;
+}
+
+/* Makes room for count records in the calling thread's buffer, writing the
+ * buffer out if need be, so that they are written out together.
+ * Returns: the first of the records
+ */
+static struct TraceRecord *next_records(int count) {
+	if (buffer == NULL) buffer = malloc(sizeof(struct TraceRecord) * TRACE_BUFFER_RECORDS);
+	if (buffered + count > TRACE_BUFFER_RECORDS) write_buffer();
+	buffered += count;
+	return &buffer[buffered - count];
+}
+
+/* Writes out the calling thread's records and frees its buffer. Called by
+ * each thread that traced anything once it is done.
+ */
+void trace_flush() {
+	write_buffer();
+	free(buffer);
+	buffer = NULL;
+}
+
+/* Flushes the calling thread's records and stops tracing. */
+void trace_close() {
+	if (trace_out == NULL) return;
+	trace_flush();
+	fclose(trace_out);
+	trace_out = NULL;
+	trace_flags = 0;
+}
+
+/* Records that the calling thread starts on the file, which the records
+ * it traces next belong to.
+ */
+void trace_file(const char *file_name) {
+	if (trace_flags == 0) return;
+	current_file = atomic_fetch_add(&file_count, 1);
+	int length = strlen(file_name);
+	if (length > TRACE_MAX_PATH) length = TRACE_MAX_PATH;
+	// the path's records follow the FILE record directly, even in the file
+	int path_records = (length + sizeof(struct TraceRecord) - 1) / sizeof(struct TraceRecord);
+	struct TraceRecord *record = next_records(1 + path_records);
+	record[0] = (struct TraceRecord) { TRACE_KIND_FILE, 0, current_file, 0, 0, length };
+	memset(record + 1, 0, sizeof(struct TraceRecord) * path_records);
+	memcpy(record + 1, file_name, length);
+}
+
+/* Records a token or statement of the current file.
+ *
+ * offset, length - span of its text in the source
+ */
+void trace_event(int kind, int id, int ln, int offset, int length) {
+	*next_records(1) = (struct TraceRecord) { kind, id, current_file, ln, offset, length };
+}
@@ -0,0 +1,48 @@
+/* trace.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRACE_MAGIC "CSTR"
+#define TRACE_VERSION 1
+
+// what is traced, as bits of trace_flags
+enum trace_flags {
+	TRACE_TOKENS = 1, // each token parsed
+	TRACE_STATEMENTS = 2, // each statement parsed
+	TRACE_MODULES = 4 // each module written, listed as text to the compiler's output
+};
+
+enum trace_kinds {
+	TRACE_KIND_FILE, // a file started: the path follows the record (see struct TraceRecord)
+	TRACE_KIND_TOKEN,
+	TRACE_KIND_STATEMENT
+};
+
+/* one traced event, as written to the trace file in the native byte order.
+ * A FILE record is followed by its path, padded with zeros to a multiple of
+ * the record size.
+ */
+struct TraceRecord {
+	uint8_t kind; // enum trace_kinds
+	uint8_t id; // enum tokens or enum statements
+	uint16_t file; // index of the file, in the order they started
+	uint32_t ln; // line number, of a token's or statement's first character
+	uint32_t offset; // of the text in the file's source
+	uint32_t length; // of the text, or of a FILE record's path
+};
+
+extern int trace_flags;
+
+bool trace_open(const char *path, int flags);
+void trace_close();
+void trace_file(const char *file_name);
+void trace_event(int kind, int id, int ln, int offset, int length);
+void trace_flush();
+
+#endif
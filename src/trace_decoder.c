@@ -0,0 +1,128 @@
+/* trace_decoder.c
+ * C-Slim trace decoder. Prints the records of a trace file written by the
+ * compiler's --trace as text: each file's path, then each token as
+ * "@line [token id] text" and each statement as "@line  |-> [statement id]
+ * text". The text of a record is read from its source file, so the sources
+ * must not have changed since they were traced.
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "source.h"
+#include "token.h"
+#include "version.h"
+
+/* a source file traced, opened once its first record is decoded. */
+struct TracedFile {
+	char *path;
+	struct Source source;
+	bool opened; // source holds the file's text
+};
+
+/* Returns the text of the record's span, NULL if its source could not be read
+ * or does not contain the span.
+ */
+static const char *span_text(struct TracedFile *file, const struct TraceRecord *record) {
+	if (file == NULL) return NULL;
+	if (!file->opened) {
+		file->opened = source_open(&file->source, file->path);
+		if (!file->opened) {
+			fprintf(stderr, "Failed to open traced file %s\n", file->path);
+			file->path[0] = '\0'; // reported once
+		}
+	}
+	if (!file->opened || (size_t) record->offset + record->length > file->source.size) return NULL;
+	return file->source.data + record->offset;
+}
+
+/* Prints every record of the trace.
+ * Returns: whether the whole trace was decoded
+ */
+static bool decode(FILE *in, FILE *out) {
+	struct TracedFile *files = NULL;
+	int file_count = 0;
+	bool success = true;
+	struct TraceRecord record;
+	while (fread(&record, sizeof(record), 1, in) == 1) {
+		if (record.kind == TRACE_KIND_FILE) {
+			if (record.file >= file_count) {
+				files = realloc(files, sizeof(struct TracedFile) * (record.file + 1));
+				memset(files + file_count, 0, sizeof(struct TracedFile) * (record.file + 1 - file_count));
+				file_count = record.file + 1;
+			}
+			size_t padded = (record.length + sizeof(record) - 1) / sizeof(record) * sizeof(record);
+			struct TracedFile *file = &files[record.file];
+			if (file->opened) source_close(&file->source);
+			free(file->path);
+			file->path = calloc(padded + 1, sizeof(char));
+			file->opened = false;
+			if (fread(file->path, sizeof(char), padded, in) != padded) {
+				success = false;
+				break;
+			}
+			fprintf(out, "== %s\n", file->path);
+			continue;
+		}
+
+		struct TracedFile *file = (record.file < file_count) ? &files[record.file] : NULL;
+		const char *text = span_text(file, &record);
+		if (record.kind == TRACE_KIND_TOKEN) {
+			fprintf(out, "@%u [%u] ", (unsigned) record.ln, (unsigned) record.id);
+		} else if (record.kind == TRACE_KIND_STATEMENT) {
+			fprintf(out, "@%u  |-> [%u] ", (unsigned) record.ln, (unsigned) record.id);
+		} else {
+			success = false;
+			break;
+		}
+		if (text != NULL)
+			fprintf(out, "%.*s\n", (int) record.length, text);
+		else
+			fprintf(out, "<%u bytes at %u>\n", (unsigned) record.length, (unsigned) record.offset);
+	}
+	if (!feof(in)) success = false;
+
+	for (int i = 0; i < file_count; i++) {
+		if (files[i].opened) source_close(&files[i].source);
+		free(files[i].path);
+	}
+	free(files);
+	return success;
+}
+
+int main(int arg_count, char **args) {
+	if (arg_count != 2 || strcmp(args[1], "--help") == 0) {
+		printf("C-Slim trace decoder usage:\n"
+			"\targs: <trace file> (written by cslim_compiler --trace=...)\n"
+			"\t--version ... print version\n");
+		return (arg_count == 2) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (strcmp(args[1], "--version") == 0) {
+		printf("C-Slim trace decoder version %s\n", VERSION);
+		return EXIT_SUCCESS;
+	}
+
+	FILE *in = fopen(args[1], "rb");
+	if (in == NULL) {
+		fprintf(stderr, "Failed to open file %s\n", args[1]);
+		return EXIT_FAILURE;
+	}
+	char magic[4];
+	uint32_t version;
+	if (fread(magic, sizeof(char), 4, in) != 4 || memcmp(magic, TRACE_MAGIC, 4) != 0
+		|| fread(&version, sizeof(version), 1, in) != 1 || version != TRACE_VERSION) {
+		fprintf(stderr, "%s is not a trace file of version %i\n", args[1], TRACE_VERSION);
+		fclose(in);
+		return EXIT_FAILURE;
+	}
+	bool success = decode(in, stdout);
+	fclose(in);
+	if (!success) {
+		fprintf(stderr, "Trace file %s is cut short or corrupt\n", args[1]);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
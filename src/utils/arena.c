@@ -0,0 +1,89 @@
+/* arena.c
+ * Bump allocator for data with a shared lifetime. Allocating is a pointer
+ * increment in the common case, and everything is released by one reset.
+ * Blocks are kept across resets and reused, so an arena that is reset after
+ * each unit of work stops calling malloc once it has grown to fit the
+ * largest unit.
+ * author: Andrew Klinge
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "stats.h"
+
+#define ARENA_ALIGNMENT (sizeof(max_align_t))
+
+/* Initializes an arena with no blocks.
+ * block_size - default size of each block allocated by the arena
+ */
+void arena_init(Arena *arena, size_t block_size) {
+	arena->first = NULL;
+	arena->current = NULL;
+	arena->block_size = block_size;
+}
+
+/* Frees all of the arena's blocks. Does NOT free the arena. */
+void arena_deinit(Arena *arena) {
+	ArenaBlock *block = arena->first;
+	while (block != NULL) {
+		ArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->first = NULL;
+	arena->current = NULL;
+}
+
+/* Releases every allocation made from the arena. Keeps its blocks for reuse. */
+void arena_reset(Arena *arena) {
+	arena->current = arena->first;
+	if (arena->current != NULL)
+		arena->current->used = 0;
+}
+
+/* Moves on to the block after the current one, reusing it if it has room for
+ * size bytes or else inserting a new block before it.
+ */
+static ArenaBlock *next_block(Arena *arena, size_t size) {
+	ArenaBlock *current = arena->current;
+	ArenaBlock *next = (current != NULL) ? current->next : arena->first;
+	if (next == NULL || next->size < size) {
+		size_t block_size = (size > arena->block_size) ? size : arena->block_size;
+		ArenaBlock *block = malloc(sizeof(ArenaBlock) + block_size);
+		STATS_ADD(STATS_ALLOCATIONS, 1);
+		block->size = block_size;
+		block->next = next;
+		if (current != NULL) {
+			current->next = block;
+		} else {
+			arena->first = block;
+		}
+		next = block;
+	}
+	next->used = 0;
+	arena->current = next;
+	return next;
+}
+
+/* Allocates size bytes from the arena, aligned for any type.
+ * Returns: pointer to the (uninitialized) memory
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+	size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+	ArenaBlock *block = arena->current;
+	if (block == NULL || block->size - block->used < size)
+		block = next_block(arena, size);
+
+	void *memory = (char*) block->data + block->used;
+	block->used += size;
+	return memory;
+}
+
+/* Allocates zeroed memory for count items of the given size from the arena. */
+void *arena_calloc(Arena *arena, size_t count, size_t size) {
+	void *memory = arena_alloc(arena, count * size);
+	memset(memory, 0, count * size);
+	return memory;
+}
@@ -0,0 +1,33 @@
+/* arena.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+// a chunk of arena memory. allocations are carved from data in order
+typedef struct ArenaBlock {
+	struct ArenaBlock *next;
+	size_t size; // bytes in data
+	size_t used;
+	max_align_t data[];
+} ArenaBlock;
+
+// region allocator. individual allocations are never freed; instead all of
+// them are released at once by arena_reset
+typedef struct Arena {
+	ArenaBlock *first;
+	ArenaBlock *current; // block being allocated from, NULL if none yet
+	size_t block_size; // default size of new blocks
+} Arena;
+
+void arena_init(Arena *arena, size_t block_size);
+void arena_deinit(Arena *arena);
+void arena_reset(Arena *arena);
+
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_calloc(Arena *arena, size_t count, size_t size);
+
+#endif
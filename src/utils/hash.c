@@ -0,0 +1,156 @@
+/* hash.c
+ * Hashes strings of bytes: to unsigned longs, for hashtables keyed by text,
+ * and to 128 bits, for identifying files by their contents.
+ * author: Andrew Klinge
+*/
+
+#include <string.h>
+
+#include "hash.h"
+
+/* Computes hash for a null-terminated string (see hash_bytes). */
+unsigned long hash_string(char *str) {
+	return hash_bytes(str, strlen(str));
+}
+
+// reads unaligned little-endian words for hash_bytes
+static inline unsigned long read64(const char *bytes) {
+	unsigned long word;
+	memcpy(&word, bytes, sizeof(word));
+	return word;
+}
+
+static inline unsigned long read32(const char *bytes) {
+	unsigned int word;
+	memcpy(&word, bytes, sizeof(word));
+	return word;
+}
+
+/* Multiplies two words to a 128-bit product and folds its halves together. */
+static inline unsigned long fold_multiply(unsigned long a, unsigned long b) {
+	__uint128_t product = (__uint128_t) a * b;
+	return (unsigned long) product ^ (unsigned long) (product >> 64);
+}
+
+#define HASH_SECRET0 0xa0761d6478bd642fUL
+#define HASH_SECRET1 0xe7037ed1a0b428dbUL
+#define HASH_SEED 0x8ebc6af09c88c6e3UL
+
+/* Computes hash for a string of known length, which need not be
+ * null-terminated. Reads the string a word at a time, after wyhash by
+ * Wang Yi (https://github.com/wangyi-fudan/wyhash): short strings take two
+ * overlapping reads and one multiply, and longer ones one multiply per 16
+ * bytes. Hashes depend on byte order, so they must not be stored across
+ * machines.
+ */
+unsigned long hash_bytes(const char *bytes, int length) {
+	unsigned long seed = HASH_SEED ^ fold_multiply(HASH_SEED ^ HASH_SECRET0, HASH_SECRET1);
+	unsigned long a, b;
+	if (length <= 16) {
+		if (length >= 4) {
+			// two (possibly overlapping) pairs of 4-byte reads cover 4..16 bytes
+			int middle = (length >> 3) << 2;
+			a = (read32(bytes) << 32) | read32(bytes + middle);
+			b = (read32(bytes + length - 4) << 32) | read32(bytes + length - 4 - middle);
+		} else if (length > 0) {
+			a = ((unsigned long) (unsigned char) bytes[0] << 16)
+				| ((unsigned long) (unsigned char) bytes[length >> 1] << 8)
+				| (unsigned char) bytes[length - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		int left = length;
+		const char *cursor = bytes;
+		while (left > 16) {
+			seed = fold_multiply(read64(cursor) ^ HASH_SECRET1, read64(cursor + 8) ^ seed);
+			cursor += 16;
+			left -= 16;
+		}
+		// the last 16 bytes, overlapping those already hashed
+		a = read64(cursor + left - 16);
+		b = read64(cursor + left - 8);
+	}
+	a ^= HASH_SECRET1;
+	b ^= seed;
+	__uint128_t product = (__uint128_t) a * b;
+	a = (unsigned long) product;
+	b = (unsigned long) (product >> 64);
+	return fold_multiply(a ^ HASH_SECRET0 ^ length, b ^ HASH_SECRET1);
+}
+
+// reads little-endian words on any machine, for hash_bytes_128
+static inline uint64_t read64_le(const char *bytes) {
+	uint64_t word;
+	memcpy(&word, bytes, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+static inline uint64_t rotate_left(uint64_t word, int bits) {
+	return word << bits | word >> (64 - bits);
+}
+
+/* Mixes the bits of a word so that each depends on all of them. */
+static inline uint64_t finish_mix(uint64_t word) {
+	word ^= word >> 33;
+	word *= 0xff51afd7ed558ccdUL;
+	word ^= word >> 33;
+	word *= 0xc4ceb9fe1a85ec53UL;
+	word ^= word >> 33;
+	return word;
+}
+
+#define HASH_128_MULTIPLIER1 0x87c37b91114253d5UL
+#define HASH_128_MULTIPLIER2 0x4cf5ad432745937fUL
+
+/* Computes a 128-bit hash of the bytes, which is the same on every machine,
+ * so it may be stored in files to identify the bytes by. This is
+ * MurmurHash3's x64_128 variant by Austin Appleby
+ * (https://github.com/aappleby/smhasher): one pass over 16-byte blocks, read
+ * as little-endian words whatever the machine's byte order.
+ *
+ * seed - hashes of the same bytes with different seeds are unrelated
+ */
+struct Hash128 hash_bytes_128(const char *bytes, size_t length, uint64_t seed) {
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+	size_t blocks = length / 16;
+	for (size_t i = 0; i < blocks; i++) {
+		uint64_t k1 = read64_le(bytes + i * 16);
+		uint64_t k2 = read64_le(bytes + i * 16 + 8);
+		h1 ^= rotate_left(k1 * HASH_128_MULTIPLIER1, 31) * HASH_128_MULTIPLIER2;
+		h1 = (rotate_left(h1, 27) + h2) * 5 + 0x52dce729;
+		h2 ^= rotate_left(k2 * HASH_128_MULTIPLIER2, 33) * HASH_128_MULTIPLIER1;
+		h2 = (rotate_left(h2, 31) + h1) * 5 + 0x38495ab5;
+	}
+
+	// the last 0..15 bytes, as little-endian words padded with zeros
+	const unsigned char *tail = (const unsigned char*) bytes + blocks * 16;
+	int tail_length = length & 15;
+	uint64_t k1 = 0, k2 = 0;
+	for (int i = 0; i < tail_length; i++) {
+		if (i < 8) {
+			k1 |= (uint64_t) tail[i] << (8 * i);
+		} else {
+			k2 |= (uint64_t) tail[i] << (8 * (i - 8));
+		}
+	}
+	if (tail_length > 8)
+		h2 ^= rotate_left(k2 * HASH_128_MULTIPLIER2, 33) * HASH_128_MULTIPLIER1;
+	if (tail_length > 0)
+		h1 ^= rotate_left(k1 * HASH_128_MULTIPLIER1, 31) * HASH_128_MULTIPLIER2;
+
+	h1 ^= length;
+	h2 ^= length;
+	h1 += h2;
+	h2 += h1;
+	h1 = finish_mix(h1);
+	h2 = finish_mix(h2);
+	h1 += h2;
+	h2 += h1;
+	return (struct Hash128) { h1, h2 };
+}
@@ -0,0 +1,22 @@
+/* hash.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* a 128-bit hash, as two 64-bit halves. */
+struct Hash128 {
+	uint64_t low;
+	uint64_t high;
+};
+
+unsigned long hash_string(char *str);
+unsigned long hash_bytes(const char *bytes, int length);
+
+struct Hash128 hash_bytes_128(const char *bytes, size_t length, uint64_t seed);
+
+#endif
@@ -0,0 +1,118 @@
+/* interner.c
+ * Maps strings to small integer ids so that equal strings can be compared and
+ * hashed as integers. Interned strings are copied, so they remain valid after
+ * the text they were interned from is released.
+ * author: Andrew Klinge
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "interner.h"
+#include "hash.h"
+#include "stats.h"
+
+#define INTERNER_INITIAL_SIZE 256
+#define INTERNER_BLOCK_SIZE 16384
+
+/* Initializes an interner with no strings. */
+void interner_init(Interner *interner) {
+	memset(interner->blocks, 0, sizeof(interner->blocks));
+	interner->blocks[0] = malloc(sizeof(InternEntry) * INTERNER_INITIAL_SIZE);
+	interner->count = 0;
+	interner->slots_size = INTERNER_INITIAL_SIZE * 2;
+	interner->slots = calloc(interner->slots_size, sizeof(StrId));
+	arena_init(&interner->strings, INTERNER_BLOCK_SIZE);
+}
+
+/* Frees an Interner's resources (including strings!). Does NOT free the interner. */
+void interner_deinit(Interner *interner) {
+	arena_deinit(&interner->strings);
+	for (int block = 0; block < INTERNER_MAX_BLOCKS; block++) {
+		free(interner->blocks[block]);
+	}
+	free(interner->slots);
+}
+
+/* Returns: the entry of the id. Block b starts at id
+ * INTERNER_INITIAL_SIZE * (2^b - 1), so b is the top bit of id / INTERNER_INITIAL_SIZE + 1.
+ */
+static inline InternEntry *entry_of(const Interner *interner, StrId id) {
+	unsigned long top = (unsigned long) id / INTERNER_INITIAL_SIZE + 1;
+	int block = (int) (sizeof(long) * 8 - 1) - __builtin_clzl(top);
+	return &interner->blocks[block][id - INTERNER_INITIAL_SIZE * ((1UL << block) - 1)];
+}
+
+/* Doubles the hash index and reinserts every entry into it. */
+static void grow_slots(Interner *interner) {
+	free(interner->slots);
+	interner->slots_size *= 2;
+	interner->slots = calloc(interner->slots_size, sizeof(StrId));
+	STATS_ADD(STATS_ALLOCATIONS, 1);
+	STATS_ADD(STATS_HASH_RESIZES, 1);
+
+	unsigned long mask = interner->slots_size - 1;
+	for (int id = 0; id < interner->count; id++) {
+		unsigned long index = entry_of(interner, id)->hash & mask;
+		while (interner->slots[index] != 0) {
+			index = (index + 1) & mask;
+		}
+		interner->slots[index] = id + 1;
+	}
+}
+
+/* Gets the id of the string, adding a copy of it if not yet interned.
+ *
+ * string - text to intern, need not be null-terminated
+ * length - number of chars in string
+ */
+StrId interner_intern(Interner *interner, const char *string, int length) {
+	unsigned long hash = hash_bytes(string, length);
+	unsigned long mask = interner->slots_size - 1;
+	unsigned long index = hash & mask;
+	while (interner->slots[index] != 0) {
+		STATS_ADD(STATS_HASH_PROBES, 1);
+		StrId id = interner->slots[index] - 1;
+		InternEntry *entry = entry_of(interner, id);
+		if (entry->hash == hash && entry->length == length
+			&& memcmp(entry->string, string, length) == 0)
+			return id;
+		index = (index + 1) & mask;
+	}
+
+	// not found, add new entry at the open slot. a full last block is
+	// followed by one twice its size instead of being moved
+	StrId id = interner->count;
+	unsigned long top = (unsigned long) id / INTERNER_INITIAL_SIZE + 1;
+	if (id > 0 && id % INTERNER_INITIAL_SIZE == 0 && (top & (top - 1)) == 0) {
+		int block = __builtin_ctzl(top);
+		interner->blocks[block] = malloc(sizeof(InternEntry) * ((unsigned long) INTERNER_INITIAL_SIZE << block));
+		STATS_ADD(STATS_ALLOCATIONS, 1);
+	}
+	char *copy = arena_alloc(&interner->strings, sizeof(char) * (length + 1));
+	memcpy(copy, string, length);
+	copy[length] = '\0';
+
+	InternEntry *entry = entry_of(interner, id);
+	entry->string = copy;
+	entry->length = length;
+	entry->hash = hash;
+	interner->slots[index] = id + 1;
+	interner->count++;
+
+	// keep hash index load factor at most 1/2
+	if (interner->count * 2 > interner->slots_size)
+		grow_slots(interner);
+	return id;
+}
+
+/* Returns the null-terminated text of the interned string. */
+const char *interner_string(Interner *interner, StrId id) {
+	return entry_of(interner, id)->string;
+}
+
+/* Returns the length of the interned string. */
+int interner_length(Interner *interner, StrId id) {
+	return entry_of(interner, id)->length;
+}
@@ -0,0 +1,43 @@
+/* interner.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __INTERNER_H__
+#define __INTERNER_H__
+
+#include "arena.h"
+
+// identifies an interned string. equal strings always have equal ids
+typedef unsigned int StrId;
+
+// an interned string. string is null-terminated and never moves
+typedef struct InternEntry {
+	const char *string;
+	int length;
+	unsigned long hash;
+} InternEntry;
+
+// number of blocks of entries an interner can have. block b holds
+// INTERNER_INITIAL_SIZE << b entries, enough for any StrId
+#define INTERNER_MAX_BLOCKS 32
+
+// set of unique strings, each mapped to a StrId. entries are never moved once
+// added, so a thread may read the entry of a StrId it was handed while
+// another thread interns more strings
+typedef struct Interner {
+	InternEntry *blocks[INTERNER_MAX_BLOCKS]; // entries, in order of StrId. NULL once unused
+	int count;
+	StrId *slots; // hash index into entries. stores id + 1, 0 if empty
+	int slots_size; // always a power of two
+	Arena strings; // storage for the text of entries
+} Interner;
+
+void interner_init(Interner *interner);
+void interner_deinit(Interner *interner);
+
+StrId interner_intern(Interner *interner, const char *string, int length);
+
+const char *interner_string(Interner *interner, StrId id);
+int interner_length(Interner *interner, StrId id);
+
+#endif
@@ -0,0 +1,287 @@
+/* map.h
+ * Macro template for hashtables with a given key and value type. Keys and
+ * values are stored inline, next to each other, so a lookup touches one
+ * entry instead of a key array and a value array. Hashing and key comparison
+ * are specialized for the key type, and every operation is defined in this
+ * header so that lookups are inlined at their call sites.
+ *
+ * Open addressing in the style of a "swiss table": besides its entry, each
+ * slot has a one-byte control value in a separate array, holding either a
+ * 7-bit fragment of its key's hash or an empty marker. Slots are probed in
+ * groups of MAP_GROUP_SIZE, comparing all of a group's control bytes against
+ * the hash fragment at once (with SSE2 when available), so keys are only
+ * compared for slots that very likely match.
+ *
+ * Entries are placed by linear probing from their home slot, with Robin Hood
+ * insertion: an entry displaced further from its home takes the slot of one
+ * displaced less, which keeps probe lengths short and even. Removal shifts
+ * the entries that follow back by one slot (backward-shift deletion), so
+ * there are no tombstones, and no operation other than growing on insert
+ * ever rehashes the map.
+ *
+ * DEFINE_MAP(SymMap, symmap, StrId, struct Sym*, map_hash_int, map_int_equal)
+ * defines the types SymMap and SymMapEntry and the functions symmap_init,
+ * symmap_deinit, symmap_clear, symmap_get, symmap_put and symmap_remove.
+ * hash_fn(key) must return an unsigned long whose bits all depend on the
+ * key, and equal_fn(a, b) whether two keys are equal.
+ * author: Andrew Klinge
+*/
+
+#ifndef __MAP_H__
+#define __MAP_H__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "arena.h"
+#include "stats.h"
+
+// number of slots whose control bytes are checked at once
+#define MAP_GROUP_SIZE 16
+
+// control byte of an empty slot. a full slot's control byte is the low 7
+// bits of its key's hash, so it is never negative
+#define MAPCTRL_EMPTY ((signed char) -128)
+
+/* Hashes an integer key, mixing its bits so that both the home slot (high
+ * bits) and the control byte (low 7 bits) depend on all of it.
+ */
+static inline unsigned long map_hash_int(unsigned long key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdUL;
+	key ^= key >> 33;
+	return key;
+}
+
+static inline bool map_int_equal(unsigned long a, unsigned long b) {
+	return a == b;
+}
+
+static inline signed char map_ctrl(unsigned long hash) {
+	return hash & 0x7F;
+}
+
+/* Returns the slot a key with the hash is placed in when there is no
+ * collision. size must be a power of two.
+ */
+static inline int map_home(unsigned long hash, int size) {
+	return (hash >> 7) & (unsigned) (size - 1);
+}
+
+// maximum number of full slots. linear probing degrades quickly past a load
+// of 3/4, as runs of full slots merge
+static inline int map_max_used(int size) {
+	return size - size / 4;
+}
+
+/* Returns the smallest power of two that is at least size and MAP_GROUP_SIZE. */
+static inline int map_round_size(int size) {
+	int rounded = MAP_GROUP_SIZE;
+	while (rounded < size) rounded *= 2;
+	return rounded;
+}
+
+/* Returns a bitmask of the slots in the group whose control byte is value. */
+static inline unsigned map_group_match(const signed char *ctrl, signed char value) {
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i*) ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+#else
+	unsigned mask = 0;
+	for (int i = 0; i < MAP_GROUP_SIZE; i++) {
+		mask |= (unsigned) (ctrl[i] == value) << i;
+	}
+	return mask;
+#endif
+}
+
+/* Returns a bitmask of the slots of a group, from skip on, that may hold a
+ * key: those whose control byte is ctrl and that precede the first empty
+ * slot, which ends the key's run of slots.
+ *
+ * done - set to whether the group has an empty slot, ending the search
+ */
+static inline unsigned map_candidates(const signed char *group_ctrl, signed char ctrl,
+	int skip, bool *done) {
+	unsigned match = map_group_match(group_ctrl, ctrl) >> skip << skip;
+	unsigned empty = map_group_match(group_ctrl, MAPCTRL_EMPTY) >> skip << skip;
+	*done = (empty != 0);
+	if (empty != 0) match &= (empty & -empty) - 1;
+	return match;
+}
+
+#define DEFINE_MAP(Name, name, Key, Value, hash_fn, equal_fn) \
+\
+typedef struct Name##Entry { \
+	Key key; \
+	Value value; \
+} Name##Entry; \
+\
+typedef struct Name { \
+	signed char *ctrl; /* control byte for each slot (see MAPCTRL_EMPTY) */ \
+	Name##Entry *entries; \
+	int size; /* number of slots. a power of two, at least MAP_GROUP_SIZE */ \
+	int count; \
+	int max_probe; /* longest distance of an entry from its home slot since last resize */ \
+	Arena *arena; /* where slots are allocated. NULL if from heap */ \
+} Name; \
+\
+/* Allocates empty slots for the map, replacing (without freeing) its old ones. */ \
+static inline void name##_allocate(Name *map, int size) { \
+	size_t bytes = size * (sizeof(Name##Entry) + sizeof(signed char)); \
+	char *memory = (map->arena != NULL) ? arena_alloc(map->arena, bytes) : malloc(bytes); \
+	if (map->arena == NULL) STATS_ADD(STATS_ALLOCATIONS, 1); \
+	map->entries = (Name##Entry*) memory; \
+	map->ctrl = (signed char*) (memory + size * sizeof(Name##Entry)); \
+	memset(map->ctrl, MAPCTRL_EMPTY, size); \
+	map->size = size; \
+	map->max_probe = 0; \
+} \
+\
+/* Initializes an empty map with room for about size entries. \
+ * arena - the arena to allocate from, in which case the map needs no \
+ *      deinit. NULL allocates from the heap. \
+ */ \
+static inline void name##_init(Name *map, int size, Arena *arena) { \
+	map->arena = arena; \
+	map->count = 0; \
+	name##_allocate(map, map_round_size(size)); \
+} \
+\
+/* Frees a map's slots (unless they belong to an arena). Does NOT free the map. */ \
+static inline void name##_deinit(Name *map) { \
+	if (map->arena == NULL) free(map->entries); \
+} \
+\
+/* Removes every entry, keeping the map's slots for reuse. */ \
+static inline void name##_clear(Name *map) { \
+	memset(map->ctrl, MAPCTRL_EMPTY, map->size); \
+	map->count = 0; \
+	map->max_probe = 0; \
+} \
+\
+/* Returns how many slots the entry at index is past its home slot. */ \
+static inline int name##_probe_length(Name *map, int index) { \
+	int home = map_home(hash_fn(map->entries[index].key), map->size); \
+	return (index - home) & (map->size - 1); \
+} \
+\
+/* Finds the slot holding the key. \
+ * Returns: index of the slot, -1 if key is not present \
+ */ \
+static inline int name##_find(Name *map, Key key) { \
+	unsigned long hash = hash_fn(key); \
+	int home = map_home(hash, map->size); \
+	int group = home & ~(MAP_GROUP_SIZE - 1); \
+	int skip = home - group; /* slots of the first group that precede home */ \
+	for (;;) { \
+		STATS_ADD(STATS_HASH_PROBES, 1); \
+		bool done; \
+		unsigned match = map_candidates(map->ctrl + group, map_ctrl(hash), skip, &done); \
+		for (; match != 0; match &= match - 1) { \
+			int index = group + __builtin_ctz(match); \
+			if (equal_fn(map->entries[index].key, key)) return index; \
+		} \
+		if (done) return -1; \
+		group = (group + MAP_GROUP_SIZE) & (map->size - 1); \
+		skip = 0; \
+	} \
+} \
+\
+/* Places an entry whose key is not yet in the map, displacing entries that \
+ * are nearer to their home slots (Robin Hood insertion). The map must have \
+ * an empty slot. \
+ */ \
+static inline void name##_place(Name *map, Name##Entry entry) { \
+	unsigned long hash = hash_fn(entry.key); \
+	signed char ctrl = map_ctrl(hash); \
+	int mask = map->size - 1; \
+	int index = map_home(hash, map->size); \
+	int probe = 0; \
+	while (map->ctrl[index] != MAPCTRL_EMPTY) { \
+		int resident_probe = name##_probe_length(map, index); \
+		if (resident_probe < probe) { \
+			/* swap with the resident, which continues the search instead */ \
+			Name##Entry swap_entry = map->entries[index]; \
+			signed char swap_ctrl = map->ctrl[index]; \
+			map->entries[index] = entry; \
+			map->ctrl[index] = ctrl; \
+			if (probe > map->max_probe) map->max_probe = probe; \
+			entry = swap_entry; \
+			ctrl = swap_ctrl; \
+			probe = resident_probe; \
+		} \
+		index = (index + 1) & mask; \
+		probe++; \
+	} \
+	map->entries[index] = entry; \
+	map->ctrl[index] = ctrl; \
+	if (probe > map->max_probe) map->max_probe = probe; \
+} \
+\
+/* Moves every entry into new slots of double the size. */ \
+static inline void name##_grow(Name *map) { \
+	signed char *old_ctrl = map->ctrl; \
+	Name##Entry *old_entries = map->entries; \
+	int old_size = map->size; \
+	STATS_ADD(STATS_HASH_RESIZES, 1); \
+	name##_allocate(map, old_size * 2); \
+	for (int i = 0; i < old_size; i++) { \
+		if (old_ctrl[i] >= 0) name##_place(map, old_entries[i]); \
+	} \
+	if (map->arena == NULL) free(old_entries); \
+} \
+\
+/* Fetches the value stored under the key. \
+ * Returns: pointer to the value, valid until the map is next changed. NULL \
+ *      if key is not present \
+ */ \
+static inline Value *name##_get(Name *map, Key key) { \
+	int index = name##_find(map, key); \
+	return (index != -1) ? &map->entries[index].value : NULL; \
+} \
+\
+/* Stores the value under the key, replacing the value if the key is \
+ * already present. \
+ */ \
+static inline void name##_put(Name *map, Key key, Value value) { \
+	int index = name##_find(map, key); \
+	if (index != -1) { \
+		map->entries[index].value = value; \
+		return; \
+	} \
+	if (map->count >= map_max_used(map->size)) name##_grow(map); \
+	name##_place(map, (Name##Entry) { key, value }); \
+	map->count++; \
+} \
+\
+/* Removes the key's entry from the map, if present. \
+ * Returns: whether an entry was removed \
+ * \
+ * removed - where to store the removed value. may be NULL \
+ */ \
+static inline bool name##_remove(Name *map, Key key, Value *removed) { \
+	int index = name##_find(map, key); \
+	if (index == -1) return false; \
+	if (removed != NULL) *removed = map->entries[index].value; \
+	/* shift back the entries after it that are not at their home slots, so \
+	 * that no run of slots has a gap */ \
+	int mask = map->size - 1; \
+	int next = (index + 1) & mask; \
+	while (map->ctrl[next] != MAPCTRL_EMPTY && name##_probe_length(map, next) > 0) { \
+		map->entries[index] = map->entries[next]; \
+		map->ctrl[index] = map->ctrl[next]; \
+		index = next; \
+		next = (next + 1) & mask; \
+	} \
+	map->ctrl[index] = MAPCTRL_EMPTY; \
+	map->count--; \
+	return true; \
+}
+
+#endif
@@ -0,0 +1,79 @@
+/* ring.h
+ * Macro template for lock-free ring buffers of a given type, passing items
+ * from exactly one producer thread to exactly one consumer thread. Items are
+ * pushed and popped in batches: each side claims or releases a whole batch
+ * with a single atomic store, and the two indices are kept on separate cache
+ * lines so that the threads do not contend for one.
+ *
+ * DEFINE_RING(TokenRing, tokenring, struct Token) defines the type TokenRing
+ * and the functions tokenring_init, tokenring_deinit, tokenring_push and
+ * tokenring_pop.
+ * author: Andrew Klinge
+*/
+
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#define RING_CACHE_LINE 64
+
+#define DEFINE_RING(Name, name, Type) \
+\
+typedef struct Name { \
+	Type *items; \
+	unsigned int mask; /* size - 1. the size is a power of two */ \
+	_Alignas(RING_CACHE_LINE) atomic_uint head; /* count of items popped, written by the consumer */ \
+	_Alignas(RING_CACHE_LINE) atomic_uint tail; /* count of items pushed, written by the producer */ \
+} Name; \
+\
+/* Initializes an empty ring with room for size items, rounded up to a \
+ * power of two. \
+ */ \
+static inline void name##_init(Name *ring, unsigned int size) { \
+	unsigned int capacity = 1; \
+	while (capacity < size) capacity *= 2; \
+	ring->items = malloc(sizeof(Type) * capacity); \
+	ring->mask = capacity - 1; \
+	atomic_init(&ring->head, 0); \
+	atomic_init(&ring->tail, 0); \
+} \
+\
+/* Frees a ring's items. Does NOT free the ring. */ \
+static inline void name##_deinit(Name *ring) { \
+	free(ring->items); \
+} \
+\
+/* Copies as many of the items as there is room for into the ring. Called \
+ * only by the producer. \
+ * Returns: number of items pushed, 0 if the ring is full \
+ */ \
+static inline int name##_push(Name *ring, const Type *items, int count) { \
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed); \
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire); \
+	unsigned int room = ring->mask + 1 - (tail - head); \
+	if ((unsigned int) count > room) count = room; \
+	for (int i = 0; i < count; i++) { \
+		ring->items[(tail + i) & ring->mask] = items[i]; \
+	} \
+	atomic_store_explicit(&ring->tail, tail + count, memory_order_release); \
+	return count; \
+} \
+\
+/* Moves up to count of the oldest items out of the ring. Called only by \
+ * the consumer. \
+ * Returns: number of items popped, 0 if the ring is empty \
+ */ \
+static inline int name##_pop(Name *ring, Type *items, int count) { \
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed); \
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire); \
+	if ((unsigned int) count > tail - head) count = tail - head; \
+	for (int i = 0; i < count; i++) { \
+		items[i] = ring->items[(head + i) & ring->mask]; \
+	} \
+	atomic_store_explicit(&ring->head, head + count, memory_order_release); \
+	return count; \
+}
+
+#endif
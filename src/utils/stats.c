@@ -0,0 +1,100 @@
+/* stats.c
+ * author: Andrew Klinge
+*/
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "stats.h"
+
+_Thread_local struct Stats stats_thread;
+bool stats_timing = false; // set by stats_start, before any thread but the main one starts
+static double start_seconds; // when stats_start was called
+static uint64_t start_ticks;
+
+static struct Stats total; // of every thread that has merged its stats
+static pthread_mutex_t total_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *phase_names[STATS_PHASES_COUNT] = {
+	[STATS_PHASE_NONE] = "other",
+	[STATS_PHASE_READ] = "read",
+	[STATS_PHASE_SCAN] = "scan",
+	[STATS_PHASE_PARSE] = "parse",
+	[STATS_PHASE_SYMTAB] = "symtab",
+	[STATS_PHASE_EMIT] = "emit",
+	[STATS_PHASE_WRITE] = "write"
+};
+
+static const char *counter_names[STATS_COUNTERS_COUNT] = {
+	[STATS_BYTES_READ] = "bytes read",
+	[STATS_ALLOCATIONS] = "allocations",
+	[STATS_HASH_PROBES] = "hashtable probes",
+	[STATS_HASH_RESIZES] = "hashtable resizes",
+	[STATS_MACRO_EXPANSIONS] = "macro expansions"
+};
+
+/* Starts timing phases. Called before starting any other thread. */
+void stats_start() {
+	stats_timing = true;
+	start_seconds = stats_now();
+	start_ticks = stats_ticks();
+}
+
+/* Adds the calling thread's stats to the process's totals and clears them.
+ * Called by each thread once it has finished counting.
+ */
+void stats_merge() {
+	stats_enter(STATS_PHASE_NONE);
+	pthread_mutex_lock(&total_lock);
+	for (int i = 0; i < STATS_COUNTERS_COUNT; i++) {
+		total.counters[i] += stats_thread.counters[i];
+	}
+	for (int i = 0; i < STATS_TOKEN_KINDS; i++) {
+		total.tokens[i] += stats_thread.tokens[i];
+	}
+	for (int i = 0; i < STATS_PHASES_COUNT; i++) {
+		total.ticks[i] += stats_thread.ticks[i];
+	}
+	if (stats_thread.max_scope_depth > total.max_scope_depth)
+		total.max_scope_depth = stats_thread.max_scope_depth;
+	pthread_mutex_unlock(&total_lock);
+	memset(&stats_thread, 0, sizeof(stats_thread));
+}
+
+/* Prints the merged stats, with the wall time since stats_start and the
+ * process's CPU time so far. Phase times are summed over threads, so they
+ * may add up to more than the wall time.
+ *
+ * token_name - gets the name of a kind of token, NULL if it is none
+ */
+void stats_print(FILE *out, const char *(*token_name)(int id)) {
+	pthread_mutex_lock(&total_lock);
+	double seconds = stats_now() - start_seconds;
+	double seconds_per_tick = seconds / (double) (stats_ticks() - start_ticks);
+	fprintf(out, "wall ms: %.3f\n", seconds * 1e3);
+	fprintf(out, "phase        wall ms\n");
+	for (int i = 1; i < STATS_PHASES_COUNT; i++) {
+		fprintf(out, "  %-10s %9.3f\n", phase_names[i], total.ticks[i] * seconds_per_tick * 1e3);
+	}
+	fprintf(out, "  %-10s %9.3f\n", phase_names[STATS_PHASE_NONE],
+		total.ticks[STATS_PHASE_NONE] * seconds_per_tick * 1e3);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(out, "cpu ms: %.3f user, %.3f system\n",
+		usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3,
+		usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3);
+
+	for (int i = 0; i < STATS_COUNTERS_COUNT; i++) {
+		fprintf(out, "%s: %llu\n", counter_names[i], (unsigned long long) total.counters[i]);
+	}
+	fprintf(out, "max scope depth: %i\n", total.max_scope_depth);
+	fprintf(out, "tokens by kind:\n");
+	for (int i = 0; i < STATS_TOKEN_KINDS; i++) {
+		const char *name = token_name(i);
+		if (name != NULL && total.tokens[i] > 0)
+			fprintf(out, "  %-20s %llu\n", name, (unsigned long long) total.tokens[i]);
+	}
+	pthread_mutex_unlock(&total_lock);
+}
@@ -0,0 +1,125 @@
+/* stats.h
+ * Counters and phase timers showing where a compile spends its work (see
+ * the compiler's --stats). Each thread counts into its own Stats, so that
+ * counting never contends, and adds them to the process's totals with
+ * stats_merge once it is done. Phases are timed only after stats_start,
+ * since timing reads a clock at every change of phase. On x86 that clock is
+ * the time-stamp counter, which is several times cheaper to read than
+ * clock_gettime, and its ticks are converted to seconds when printed.
+ *
+ * Built with STATS=0, every macro here compiles to nothing.
+ * author: Andrew Klinge
+*/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef STATS
+#define STATS 1
+#endif
+
+// what a thread is doing, each timed separately. phases do not nest: a
+// phase entered during another stops the other's clock until it is left
+enum stats_phases {
+	STATS_PHASE_NONE, // none of the below
+	STATS_PHASE_READ, // loading sources
+	STATS_PHASE_SCAN,
+	STATS_PHASE_PARSE,
+	STATS_PHASE_SYMTAB, // looking up and adding symbols, while parsing
+	STATS_PHASE_EMIT, // optimizing statements and generating their code
+	STATS_PHASE_WRITE, // writing modules
+	STATS_PHASES_COUNT
+};
+
+enum stats_counters {
+	STATS_BYTES_READ,
+	STATS_ALLOCATIONS, // calls to malloc and realloc by arenas, vecs, maps and the interner
+	STATS_HASH_PROBES, // groups or slots a hashtable lookup examined
+	STATS_HASH_RESIZES,
+	STATS_MACRO_EXPANSIONS,
+	STATS_COUNTERS_COUNT
+};
+
+// kinds of token counted, indexed by enum tokens. the scanner asserts that
+// every kind fits
+#define STATS_TOKEN_KINDS 32
+
+struct Stats {
+	uint64_t counters[STATS_COUNTERS_COUNT];
+	uint64_t tokens[STATS_TOKEN_KINDS]; // count of each kind of token scanned
+	uint64_t ticks[STATS_PHASES_COUNT]; // wall time spent in each phase, see stats_ticks
+	int max_scope_depth;
+	int phase; // enum stats_phases, the one being timed
+	uint64_t phase_start; // ticks when the phase was entered
+};
+
+extern _Thread_local struct Stats stats_thread;
+extern bool stats_timing;
+
+static inline double stats_now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/* Returns: the time in ticks of a clock of constant rate */
+static inline uint64_t stats_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+}
+
+/* Stops timing the thread's current phase and starts timing the phase.
+ * Returns: the phase that was current, to enter again when this one ends
+ */
+static inline int stats_enter(int phase) {
+	int previous = stats_thread.phase;
+	if (stats_timing) {
+		uint64_t now = stats_ticks();
+		if (stats_thread.phase_start > 0) // else this is the thread's first phase
+			stats_thread.ticks[previous] += now - stats_thread.phase_start;
+		stats_thread.phase_start = now;
+	}
+	stats_thread.phase = phase;
+	return previous;
+}
+
+void stats_start();
+void stats_merge();
+void stats_print(FILE *out, const char *(*token_name)(int id));
+
+#if STATS
+// times what the thread does from here on as the phase
+#define STATS_PHASE(phase) stats_enter(phase)
+#define STATS_ADD(counter, count) (stats_thread.counters[counter] += (count))
+#define STATS_TOKEN(id) (stats_thread.tokens[id]++)
+#define STATS_SCOPE_DEPTH(depth) do { \
+	if ((depth) > stats_thread.max_scope_depth) stats_thread.max_scope_depth = (depth); \
+} while (0)
+// times the rest of the enclosing block, up to STATS_END, as the phase.
+// at most once per block
+#define STATS_BEGIN(phase) int stats_outer_phase = stats_enter(phase)
+#define STATS_END() stats_enter(stats_outer_phase)
+#else
+#define STATS_PHASE(phase)
+#define STATS_ADD(counter, count)
+#define STATS_TOKEN(id)
+#define STATS_SCOPE_DEPTH(depth)
+#define STATS_BEGIN(phase)
+#define STATS_END()
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+/* vec.h
+ * Macro template for automatically-resizing arrays of a given type.
+ * Elements are stored inline rather than as pointers to separately
+ * allocated objects, and every operation is defined in this header so that
+ * the hot ones are inlined at their call sites.
+ *
+ * DEFINE_VEC(TokenVec, tokenvec, struct Token) defines the type TokenVec and
+ * the functions tokenvec_init, tokenvec_deinit, tokenvec_reserve,
+ * tokenvec_push, tokenvec_pop and tokenvec_clear.
+ * author: Andrew Klinge
+*/
+
+#ifndef __VEC_H__
+#define __VEC_H__
+
+#include <stdlib.h>
+
+#include "stats.h"
+
+#define DEFINE_VEC(Name, name, Type) \
+\
+typedef struct Name { \
+	Type *items; \
+	int count; \
+	int size; /* number of items there is room for */ \
+} Name; \
+\
+/* Initializes an empty vec with room for size items (at least 1). */ \
+static inline void name##_init(Name *vec, int size) { \
+	if (size < 1) size = 1; \
+	vec->items = malloc(sizeof(Type) * size); \
+	STATS_ADD(STATS_ALLOCATIONS, 1); \
+	vec->count = 0; \
+	vec->size = size; \
+} \
+\
+/* Frees a vec's items. Does NOT free the vec. */ \
+static inline void name##_deinit(Name *vec) { \
+	free(vec->items); \
+} \
+\
+/* Makes room for at least size items. */ \
+static inline void name##_reserve(Name *vec, int size) { \
+	if (size <= vec->size) return; \
+	while (vec->size < size) vec->size *= 2; \
+	vec->items = realloc(vec->items, sizeof(Type) * vec->size); \
+	STATS_ADD(STATS_ALLOCATIONS, 1); \
+} \
+\
+/* Adds a copy of the item to the end of the vec, resizing if full. */ \
+static inline void name##_push(Name *vec, Type item) { \
+	if (vec->count >= vec->size) name##_reserve(vec, vec->count + 1); \
+	vec->items[vec->count] = item; \
+	vec->count++; \
+} \
+\
+/* Removes the last item of a non-empty vec. \
+ * Returns: the removed item \
+ */ \
+static inline Type name##_pop(Name *vec) { \
+	vec->count--; \
+	return vec->items[vec->count]; \
+} \
+\
+/* Removes every item, keeping the vec's memory for reuse. */ \
+static inline void name##_clear(Name *vec) { \
+	vec->count = 0; \
+}
+
+#endif
@@ -0,0 +1,11 @@
+/* version.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __VERSION_H__
+#define __VERSION_H__
+
+// version of the compiler and interpreter
+#define VERSION "0.2.3"
+
+#endif
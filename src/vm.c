@@ -0,0 +1,577 @@
+/* vm.c
+ * Register-based interpreter for modules. Runs a module's code in place, from
+ * the loaded file. Every variable has a register in the module's frame,
+ * assigned by the compiler, so an instruction names the registers it reads
+ * and writes and a statement like `x = y + z;` is a single instruction.
+ * Variables beyond the frame's 256 registers are globals of the module,
+ * copied to and from registers by GET_GLOBAL and SET_GLOBAL. Each module is
+ * verified once before it runs, checking its registers, globals, constants
+ * and jump targets, and that registers printed as strings hold strings on
+ * every path to them, so that instructions themselves need no bounds or
+ * type checks.
+ *
+ * With VM_COMPUTED_GOTO (the default with GCC), every instruction's handler
+ * ends by fetching the next instruction and jumping straight to its handler
+ * through a table of label addresses (GCC's &&label). Each handler then has
+ * its own indirect branch, which is predicted far better than the single
+ * shared branch of a switch. Building with VM_COMPUTED_GOTO=0 (see the
+ * makefile's VM_DISPATCH) uses a portable switch instead.
+ * author: Andrew Klinge
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+#ifndef VM_COMPUTED_GOTO
+#ifdef __GNUC__
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+#endif
+
+// counts dispatched instructions into the VM's profile. off by default, since
+// counting slows every dispatch
+#ifndef VM_PROFILE
+#define VM_PROFILE 0
+#endif
+
+/* Initializes a VM with no module. */
+void vm_init(struct VM *vm) {
+	vm->constants = NULL;
+	vm->constants_size = 0;
+	vm->globals = NULL;
+	vm->globals_size = 0;
+	vm->out = stdout;
+	vm->err = stderr;
+	vm->profile = NULL;
+}
+
+/* Frees a VM's resources. Does NOT free the VM. */
+void vm_deinit(struct VM *vm) {
+	free(vm->constants);
+	free(vm->globals);
+}
+
+/* Checks if the condition is true, and if not, then prints the error message
+ * for the instruction at the given index.
+ * Variable arguments at end are for error_string format args.
+ * Returns: whether the check failed (condition was false)
+ */
+static bool assert(bool condition, struct VM *vm, int at, const char *error_string, ...) {
+	if (condition) return false;
+
+	fprintf(vm->err, "Invalid module code at instruction %i: ", at);
+	va_list va;
+	va_start(va, error_string);
+	vfprintf(vm->err, error_string, va);
+	va_end(va);
+	fprintf(vm->err, "\n");
+	return true;
+}
+
+/* Decodes the module's constants into values that can be loaded as is.
+ * Returns: whether succeeded (fails if a constant is invalid)
+ */
+static bool decode_constants(struct VM *vm, const struct Module *module) {
+	if (module->constant_count > vm->constants_size) {
+		vm->constants_size = module->constant_count;
+		vm->constants = realloc(vm->constants, sizeof(union Value) * vm->constants_size);
+	}
+	for (int i = 0; i < module->constant_count; i++) {
+		const struct ModuleConstant *constant = &module->constants[i];
+		switch (constant->kind) {
+		case CONSTANT_INT:
+			vm->constants[i].int_value = constant->int_value;
+			break;
+		case CONSTANT_FLOAT:
+			vm->constants[i].float_value = constant->float_value;
+			break;
+		case CONSTANT_STRING:
+			vm->constants[i].string_value = module_string(module, i);
+			if (vm->constants[i].string_value == NULL) {
+				fprintf(vm->err, "Invalid module: string constant %i out of bounds\n", i);
+				return false;
+			}
+			break;
+		default:
+			fprintf(vm->err, "Invalid module: constant %i of unknown kind %u\n", i, constant->kind);
+			return false;
+		}
+	}
+	return true;
+}
+
+// a set of registers, as bits
+struct RegisterSet {
+	uint64_t bits[(MODULE_MAX_REGISTERS + 63) / 64];
+};
+
+static bool register_set_has(const struct RegisterSet *set, unsigned r) {
+	return set->bits[r / 64] >> (r % 64) & 1;
+}
+
+static void register_set_put(struct RegisterSet *set, unsigned r, bool member) {
+	if (member) set->bits[r / 64] |= (uint64_t) 1 << (r % 64);
+	else set->bits[r / 64] &= ~((uint64_t) 1 << (r % 64));
+}
+
+/* Returns: the count of instructions that may run after the one at, stored
+ * in next. Its operands must be verified already
+ */
+static int successors(const struct Module *module, int at, int next[2]) {
+	uint32_t instruction = module->code[at];
+	int op = INSTRUCTION_OP(instruction);
+	switch (op) {
+	case OP_HALT:
+	case OP_BREAK:
+	case OP_BREAK_LABEL:
+		return 0;
+	case OP_JUMP:
+		next[0] = OPERAND_AX(instruction);
+		return 1;
+	case OP_JUMP_IF_FALSE:
+		next[0] = at + 1;
+		next[1] = OPERAND_BX(instruction);
+		return 2;
+	}
+	int format = opcode_formats[op];
+	if (format == FORMAT_ABJ || format == FORMAT_AIJ) {
+		// skips the JUMP after it, or takes it without running it
+		next[0] = at + 2;
+		next[1] = OPERAND_AX(module->code[at + 1]);
+		return 2;
+	}
+	next[0] = at + 1;
+	return 1;
+}
+
+/* Verifies that the code never runs past its end, and only prints registers
+ * as strings where they hold strings. Registers start zeroed, which is no
+ * string, and hold one after CONST loads a string constant, MOVE copies one
+ * or GET_GLOBAL loads a global of strings. Which registers do is followed
+ * along every path through the code: a register holds a string at an
+ * instruction if it does after each instruction that may run before it. A
+ * global of strings always holds one, as it starts empty (see vm_run) and
+ * SET_GLOBAL may only store strings to it. The registers' operands must be
+ * verified already.
+ * Returns: whether the code is valid
+ */
+static bool verify_paths(struct VM *vm, const struct Module *module) {
+	int count = module->code_count;
+	struct RegisterSet *strings = malloc(sizeof(struct RegisterSet) * count); // before each instruction
+	bool *reached = calloc(count, sizeof(bool));
+	bool *queued = calloc(count, sizeof(bool));
+	int *work = malloc(sizeof(int) * count); // instructions whose strings changed, each queued once
+	int pending = 0;
+	memset(&strings[0], 0, sizeof(struct RegisterSet));
+	reached[0] = true;
+	queued[0] = true;
+	work[pending++] = 0;
+
+	bool valid = true;
+	while (valid && pending > 0) {
+		int at = work[--pending];
+		queued[at] = false;
+		uint32_t instruction = module->code[at];
+		int op = INSTRUCTION_OP(instruction);
+		unsigned a = OPERAND_A(instruction);
+		struct RegisterSet after = strings[at];
+		if (op == OP_PRINT_STRING && assert(register_set_has(&after, a), vm, at,
+			"register %u printed as a string may not hold one", a)) {
+			valid = false;
+			break;
+		}
+		if (op == OP_SET_GLOBAL && module->globals[OPERAND_BX(instruction)] == CONSTANT_STRING
+			&& assert(register_set_has(&after, a), vm, at,
+				"register %u stored to a global of strings may not hold one", a)) {
+			valid = false;
+			break;
+		}
+		switch (opcode_formats[op]) {
+		case FORMAT_AB:
+		case FORMAT_ABC:
+		case FORMAT_ABN:
+		case FORMAT_ABI:
+		case FORMAT_AK:
+		case FORMAT_AI: // writes a
+			register_set_put(&after, a,
+				(op == OP_CONST && module->constants[OPERAND_BX(instruction)].kind == CONSTANT_STRING)
+				|| (op == OP_MOVE && register_set_has(&after, OPERAND_B(instruction))));
+			break;
+		case FORMAT_AG:
+			if (op == OP_GET_GLOBAL)
+				register_set_put(&after, a, module->globals[OPERAND_BX(instruction)] == CONSTANT_STRING);
+			break;
+		}
+
+		int next[2];
+		int next_count = successors(module, at, next);
+		for (int i = 0; i < next_count; i++) {
+			int to = next[i];
+			if (assert(to < count, vm, at, "code runs past its end")) {
+				valid = false;
+				break;
+			}
+			bool changed = !reached[to];
+			if (changed) {
+				strings[to] = after;
+				reached[to] = true;
+			} else {
+				for (int word = 0; word < (MODULE_MAX_REGISTERS + 63) / 64; word++) {
+					uint64_t both = strings[to].bits[word] & after.bits[word];
+					changed = changed || both != strings[to].bits[word];
+					strings[to].bits[word] = both;
+				}
+			}
+			if (changed && !queued[to]) {
+				queued[to] = true;
+				work[pending++] = to;
+			}
+		}
+	}
+	free(strings);
+	free(reached);
+	free(queued);
+	free(work);
+	return valid;
+}
+
+/* Verifies that the module's code can run without bounds or type checks:
+ * that every register, global, constant and jump target it names is in range, and
+ * that it never runs past its end or prints a register as a string that
+ * may not hold one (see verify_paths).
+ * Returns: whether the code is valid
+ */
+static bool verify(struct VM *vm, const struct Module *module) {
+	int count = module->code_count;
+	if (assert(count > 0, vm, 0, "module has no code")) return false;
+
+	unsigned registers = module->register_count;
+	for (int at = 0; at < count; at++) {
+		uint32_t instruction = module->code[at];
+		int op = INSTRUCTION_OP(instruction);
+		if (assert(op < OPCODES_COUNT, vm, at, "unknown opcode %i", op)) return false;
+
+		int format = opcode_formats[op];
+		if ((format == FORMAT_ABJ || format == FORMAT_AIJ)
+			&& assert(at + 1 < count && INSTRUCTION_OP(module->code[at + 1]) == OP_JUMP, vm, at,
+				"branch not followed by a jump"))
+			return false;
+
+		unsigned a = OPERAND_A(instruction);
+		bool valid = true;
+		switch (format) {
+		case FORMAT_ABC:
+			valid = !assert(OPERAND_C(instruction) < registers, vm, at, "register %u out of bounds", OPERAND_C(instruction));
+			// fall through
+		case FORMAT_AB:
+		case FORMAT_ABI:
+		case FORMAT_ABJ:
+			valid = valid && !assert(OPERAND_B(instruction) < registers, vm, at, "register %u out of bounds", OPERAND_B(instruction));
+			// fall through
+		case FORMAT_A:
+		case FORMAT_AI:
+		case FORMAT_AIJ:
+			valid = valid && !assert(a < registers, vm, at, "register %u out of bounds", a);
+			break;
+		case FORMAT_ABN:
+			valid = !assert(OPERAND_C(instruction) < 64, vm, at, "shift %u out of range", OPERAND_C(instruction))
+				&& !assert(OPERAND_B(instruction) < registers, vm, at, "register %u out of bounds", OPERAND_B(instruction))
+				&& !assert(a < registers, vm, at, "register %u out of bounds", a);
+			break;
+		case FORMAT_AK:
+			valid = !assert(a < registers, vm, at, "register %u out of bounds", a)
+				&& !assert(OPERAND_BX(instruction) < (unsigned) module->constant_count, vm, at,
+					"constant %u out of bounds", OPERAND_BX(instruction));
+			break;
+		case FORMAT_AG:
+			valid = !assert(a < registers, vm, at, "register %u out of bounds", a)
+				&& !assert(OPERAND_BX(instruction) < (unsigned) module->global_count, vm, at,
+					"global %u out of bounds", OPERAND_BX(instruction));
+			break;
+		case FORMAT_AT:
+			valid = !assert(a < registers, vm, at, "register %u out of bounds", a)
+				&& !assert(OPERAND_BX(instruction) < (unsigned) count, vm, at,
+					"jump target %u out of bounds", OPERAND_BX(instruction));
+			break;
+		case FORMAT_T:
+			valid = !assert(OPERAND_AX(instruction) < (unsigned) count, vm, at,
+				"jump target %u out of bounds", OPERAND_AX(instruction));
+			break;
+		case FORMAT_S:
+			valid = !assert(module_string(module, OPERAND_AX(instruction)) != NULL, vm, at,
+				"string constant %u out of bounds", OPERAND_AX(instruction));
+			break;
+		}
+		if (!valid) return false;
+	}
+
+	return verify_paths(vm, module);
+}
+
+/* Reports a runtime error at the instruction before ip. */
+static int runtime_error(struct VM *vm, const uint32_t *code, const uint32_t *ip, const char *error_string) {
+	fprintf(vm->err, "Runtime error at instruction %li: %s\n", (long) (ip - code - 1), error_string);
+	return VM_ERROR;
+}
+
+/* Executes verified code from its first instruction.
+ * Returns: enum vm_result
+ */
+static int execute(struct VM *vm, const uint32_t *code) {
+	const uint32_t *ip = code; // next instruction
+	const union Value *constants = vm->constants;
+	union Value *registers = vm->registers;
+	union Value *globals = vm->globals;
+	uint32_t instruction;
+
+#if VM_PROFILE
+	struct VMProfile *profile = vm->profile;
+	int previous = -1; // opcode of the instruction before, none for the first
+#define PROFILE() \
+	if (profile != NULL) { \
+		profile->dispatches++; \
+		if (previous != -1) profile->pairs[previous][INSTRUCTION_OP(instruction)]++; \
+		previous = INSTRUCTION_OP(instruction); \
+	}
+#else
+#define PROFILE()
+#endif
+
+#define A registers[OPERAND_A(instruction)]
+#define B registers[OPERAND_B(instruction)]
+#define C registers[OPERAND_C(instruction)]
+// integer arithmetic wraps around, as the unsigned operations are defined to
+#define BINARY_INT(operator) \
+	A.int_value = (int64_t) ((uint64_t) B.int_value operator (uint64_t) C.int_value);
+#define BINARY_FLOAT(operator) \
+	A.float_value = B.float_value operator C.float_value;
+#define COMPARE(member, operator) \
+	A.int_value = B.member operator C.member;
+// skips the JUMP after the instruction if the condition holds, else takes it
+#define BRANCH(condition) \
+	ip = (condition) ? ip + 1 : code + OPERAND_AX(*ip);
+
+#if VM_COMPUTED_GOTO
+	static const void *const dispatch_table[OPCODES_COUNT] = {
+#define OPCODE_LABEL(name, format) &&op_##name,
+		OPCODES(OPCODE_LABEL)
+#undef OPCODE_LABEL
+	};
+#define CASE(name) op_##name:
+#define DISPATCH() \
+	instruction = *ip++; \
+	PROFILE(); \
+	goto *dispatch_table[INSTRUCTION_OP(instruction)];
+
+	DISPATCH();
+#else
+#define CASE(name) case OP_##name:
+#define DISPATCH() continue;
+
+	for (;;) {
+	instruction = *ip++;
+	PROFILE();
+	switch (INSTRUCTION_OP(instruction)) {
+#endif
+
+	CASE(NOP)
+		DISPATCH();
+	CASE(HALT)
+	CASE(BREAK)
+	CASE(BREAK_LABEL)
+		return VM_HALTED;
+	CASE(CONST)
+		A = constants[OPERAND_BX(instruction)];
+		DISPATCH();
+	CASE(INT)
+		A.int_value = OPERAND_SBX(instruction);
+		DISPATCH();
+	CASE(MOVE)
+		A = B;
+		DISPATCH();
+	CASE(GET_GLOBAL)
+		A = globals[OPERAND_BX(instruction)];
+		DISPATCH();
+	CASE(SET_GLOBAL)
+		globals[OPERAND_BX(instruction)] = A;
+		DISPATCH();
+	CASE(ADD_INT)
+		BINARY_INT(+);
+		DISPATCH();
+	CASE(SUB_INT)
+		BINARY_INT(-);
+		DISPATCH();
+	CASE(MUL_INT)
+		BINARY_INT(*);
+		DISPATCH();
+	CASE(DIV_INT)
+		if (C.int_value == 0) return runtime_error(vm, code, ip, "division by zero");
+		// INT64_MIN / -1 overflows, so negating is done unsigned
+		A.int_value = (C.int_value == -1)
+			? (int64_t) -(uint64_t) B.int_value
+			: B.int_value / C.int_value;
+		DISPATCH();
+	CASE(MOD_INT)
+		if (C.int_value == 0) return runtime_error(vm, code, ip, "division by zero");
+		A.int_value = (C.int_value == -1) ? 0 : B.int_value % C.int_value;
+		DISPATCH();
+	CASE(NEG_INT)
+		A.int_value = (int64_t) -(uint64_t) B.int_value;
+		DISPATCH();
+	CASE(ADD_INT_IMM)
+		A.int_value = (int64_t) ((uint64_t) B.int_value + (uint64_t) (int64_t) OPERAND_SC(instruction));
+		DISPATCH();
+	CASE(SHL_INT)
+		A.int_value = (int64_t) ((uint64_t) B.int_value << OPERAND_C(instruction));
+		DISPATCH();
+	CASE(DIV_POW2_INT) {
+		// arithmetic shift rounds toward negative infinity, so negative values
+		// are first biased by 2^c - 1 to round toward zero instead
+		int64_t bias = (int64_t) ((uint64_t) (B.int_value >> 63) >> (63 - OPERAND_C(instruction)) >> 1);
+		A.int_value = (B.int_value + bias) >> OPERAND_C(instruction);
+		DISPATCH();
+	}
+	CASE(MOD_POW2_INT) {
+		int64_t bias = (int64_t) ((uint64_t) (B.int_value >> 63) >> (63 - OPERAND_C(instruction)) >> 1);
+		A.int_value = ((B.int_value + bias) & (int64_t) ((UINT64_C(1) << OPERAND_C(instruction)) - 1)) - bias;
+		DISPATCH();
+	}
+	CASE(LESS_INT)
+		COMPARE(int_value, <);
+		DISPATCH();
+	CASE(LESS_EQUAL_INT)
+		COMPARE(int_value, <=);
+		DISPATCH();
+	CASE(EQUAL_INT)
+		COMPARE(int_value, ==);
+		DISPATCH();
+	CASE(NOT_EQUAL_INT)
+		COMPARE(int_value, !=);
+		DISPATCH();
+	CASE(ADD_FLOAT)
+		BINARY_FLOAT(+);
+		DISPATCH();
+	CASE(SUB_FLOAT)
+		BINARY_FLOAT(-);
+		DISPATCH();
+	CASE(MUL_FLOAT)
+		BINARY_FLOAT(*);
+		DISPATCH();
+	CASE(DIV_FLOAT)
+		BINARY_FLOAT(/);
+		DISPATCH();
+	CASE(NEG_FLOAT)
+		A.float_value = -B.float_value;
+		DISPATCH();
+	CASE(LESS_FLOAT)
+		COMPARE(float_value, <);
+		DISPATCH();
+	CASE(LESS_EQUAL_FLOAT)
+		COMPARE(float_value, <=);
+		DISPATCH();
+	CASE(EQUAL_FLOAT)
+		COMPARE(float_value, ==);
+		DISPATCH();
+	CASE(NOT_EQUAL_FLOAT)
+		COMPARE(float_value, !=);
+		DISPATCH();
+	CASE(INT_TO_FLOAT)
+		A.float_value = (double) B.int_value;
+		DISPATCH();
+	CASE(NOT)
+		A.int_value = !B.int_value;
+		DISPATCH();
+	CASE(JUMP)
+		ip = code + OPERAND_AX(instruction);
+		DISPATCH();
+	CASE(JUMP_IF_FALSE)
+		if (!A.int_value) ip = code + OPERAND_BX(instruction);
+		DISPATCH();
+	CASE(BRANCH_LESS_INT)
+		BRANCH(A.int_value < B.int_value);
+		DISPATCH();
+	CASE(BRANCH_LESS_EQUAL_INT)
+		BRANCH(A.int_value <= B.int_value);
+		DISPATCH();
+	CASE(BRANCH_EQUAL_INT)
+		BRANCH(A.int_value == B.int_value);
+		DISPATCH();
+	CASE(BRANCH_NOT_EQUAL_INT)
+		BRANCH(A.int_value != B.int_value);
+		DISPATCH();
+	CASE(BRANCH_LESS_INT_IMM)
+		BRANCH(A.int_value < OPERAND_SBX(instruction));
+		DISPATCH();
+	CASE(BRANCH_LESS_EQUAL_INT_IMM)
+		BRANCH(A.int_value <= OPERAND_SBX(instruction));
+		DISPATCH();
+	CASE(BRANCH_GREATER_INT_IMM)
+		BRANCH(A.int_value > OPERAND_SBX(instruction));
+		DISPATCH();
+	CASE(BRANCH_GREATER_EQUAL_INT_IMM)
+		BRANCH(A.int_value >= OPERAND_SBX(instruction));
+		DISPATCH();
+	CASE(BRANCH_EQUAL_INT_IMM)
+		BRANCH(A.int_value == OPERAND_SBX(instruction));
+		DISPATCH();
+	CASE(BRANCH_NOT_EQUAL_INT_IMM)
+		BRANCH(A.int_value != OPERAND_SBX(instruction));
+		DISPATCH();
+	CASE(PRINT_INT)
+		fprintf(vm->out, "%lli\n", (long long) A.int_value);
+		DISPATCH();
+	CASE(PRINT_FLOAT)
+		fprintf(vm->out, "%g\n", A.float_value);
+		DISPATCH();
+	CASE(PRINT_STRING)
+		fprintf(vm->out, "%s\n", A.string_value);
+		DISPATCH();
+
+#if !VM_COMPUTED_GOTO
+	default:
+		return runtime_error(vm, code, ip, "unknown opcode"); // excluded by verify
+	}
+	}
+#endif
+
+#undef A
+#undef B
+#undef C
+#undef BINARY_INT
+#undef BINARY_FLOAT
+#undef COMPARE
+#undef BRANCH
+#undef PROFILE
+#undef CASE
+#undef DISPATCH
+}
+
+/* Verifies and runs the module from its first instruction until it halts,
+ * starting with every register of its frame and every global zeroed, but
+ * for globals of strings, which start empty. Errors are printed to the VM's
+ * err.
+ * Returns: enum vm_result
+ */
+int vm_run(struct VM *vm, const struct Module *module) {
+	if (!decode_constants(vm, module) || !verify(vm, module))
+		return VM_ERROR;
+	memset(vm->registers, 0, sizeof(union Value) * module->register_count);
+	if (module->global_count > vm->globals_size) {
+		vm->globals_size = module->global_count;
+		vm->globals = realloc(vm->globals, sizeof(union Value) * vm->globals_size);
+	}
+	for (int i = 0; i < module->global_count; i++) {
+		if (module->globals[i] == CONSTANT_STRING) {
+			vm->globals[i].string_value = "";
+		} else {
+			vm->globals[i].int_value = 0;
+		}
+	}
+	return execute(vm, module->code);
+}
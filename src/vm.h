@@ -0,0 +1,53 @@
+/* vm.h
+ * author: Andrew Klinge
+*/
+
+#ifndef __VM_H__
+#define __VM_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "module.h"
+
+enum vm_result {
+	VM_HALTED, // ran to the end of the module
+	VM_ERROR // the module is invalid or failed at runtime
+};
+
+/* a value in a register. the instruction using it determines which member
+ * it is.
+ */
+union Value {
+	int64_t int_value;
+	double float_value;
+	const char *string_value;
+};
+
+/* counts of the instructions a VM built with VM_PROFILE dispatches, for
+ * choosing which instruction sequences to fuse (see bench/opcode_pairs.c).
+ */
+struct VMProfile {
+	uint64_t dispatches;
+	uint64_t pairs[OPCODES_COUNT][OPCODES_COUNT]; // by opcode of an instruction, then of the one after it
+};
+
+/* register-based interpreter for modules. */
+struct VM {
+	union Value *constants; // of the running module, decoded
+	int constants_size;
+	union Value registers[MODULE_MAX_REGISTERS]; // frame of the running module
+	union Value *globals; // of the running module
+	int globals_size;
+	FILE *out; // where the module's output is written
+	FILE *err; // where errors are reported
+	struct VMProfile *profile; // counted into when built with VM_PROFILE, unless NULL
+};
+
+void vm_init(struct VM *vm);
+void vm_deinit(struct VM *vm);
+
+int vm_run(struct VM *vm, const struct Module *module);
+
+#endif
@@ -0,0 +1,191 @@
+/* tests/module.c
+ * Round-trip test of the module format: writes a module with a
+ * ModuleWriter, loads it back with module_load and checks that it holds
+ * what was written, with equal constants merged. Then corrupts the written
+ * file and checks that module_load rejects it.
+ * usage: module_test
+ * author: Andrew Klinge
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "module.h"
+#include "utils/interner.h"
+
+static int failures = 0;
+
+/* Checks if the condition is true, and if not, then reports the failure.
+ * Returns: whether the check failed (condition was false)
+ */
+static bool check(bool condition, const char *description) {
+	if (condition) return false;
+	fprintf(stderr, "FAILED: %s\n", description);
+	failures++;
+	return true;
+}
+
+static StrId intern(Interner *interner, const char *string) {
+	return interner_intern(interner, string, strlen(string));
+}
+
+/* Writes the bytes to a new temporary file.
+ * Returns: whether succeeded
+ *
+ * path - where the file's path is stored, with room for 32 chars
+ */
+static bool write_temp(const char *bytes, size_t size, char *path) {
+	strcpy(path, "/tmp/module_test_XXXXXX");
+	int fd = mkstemp(path);
+	if (fd < 0) return false;
+	bool written = write(fd, bytes, size) == (ssize_t) size;
+	return close(fd) == 0 && written;
+}
+
+/* Loads a copy of the module file whose bytes are changed by corrupt, and
+ * checks that module_load rejects it with the expected error.
+ */
+static void check_rejected(const char *bytes, size_t size, void (*corrupt)(char *bytes),
+	const char *error, const char *description) {
+	char *copy = malloc(size);
+	memcpy(copy, bytes, size);
+	corrupt(copy);
+	char path[32];
+	if (!check(write_temp(copy, size, path), "write corrupted module")) {
+		char *message;
+		size_t message_size;
+		FILE *err = open_memstream(&message, &message_size);
+		struct Module module;
+		bool loaded = module_load(&module, path, err);
+		fclose(err);
+		if (loaded) module_unload(&module);
+		check(!loaded, description);
+		check(strstr(message, error) != NULL, description);
+		free(message);
+		remove(path);
+	}
+	free(copy);
+}
+
+static struct ModuleSection *section(char *bytes, int kind) {
+	struct ModuleSection *sections = (struct ModuleSection*) (bytes + sizeof(struct ModuleHeader));
+	for (int i = 0; i < MODULE_SECTIONS_COUNT; i++) {
+		if (sections[i].kind == (uint32_t) kind) return &sections[i];
+	}
+	return NULL;
+}
+
+static void corrupt_version(char *bytes) {
+	((struct ModuleHeader*) bytes)->version = MODULE_VERSION + 1;
+}
+
+static void corrupt_section_size(char *bytes) {
+	section(bytes, MODULE_SECTION_CONSTANTS)->size = UINT32_MAX;
+}
+
+static void corrupt_section_count(char *bytes) {
+	struct ModuleSection *code = section(bytes, MODULE_SECTION_CODE);
+	code->count = code->size / sizeof(uint32_t) + 1;
+}
+
+int main() {
+	Interner interner;
+	interner_init(&interner);
+	struct ModuleWriter writer;
+	module_writer_init(&writer, &interner);
+
+	// equal constants are merged, others are not
+	int answer = module_writer_int(&writer, 42);
+	int half = module_writer_float(&writer, 0.5);
+	int hello = module_writer_string(&writer, intern(&interner, "hello"));
+	check(module_writer_int(&writer, 42) == answer, "equal int constants merged");
+	check(module_writer_float(&writer, 0.5) == half, "equal float constants merged");
+	check(module_writer_string(&writer, intern(&interner, "hello")) == hello, "equal string constants merged");
+	check(module_writer_int(&writer, 43) != answer, "different int constants kept apart");
+	check(module_writer_float(&writer, -0.5) != half, "different float constants kept apart");
+	int zero = module_writer_int(&writer, 0);
+	check(module_writer_float(&writer, 0.0) != zero, "int and float constants kept apart");
+
+	// variables of the same number and kind share a global
+	int count_global = module_writer_global(&writer, 0, CONSTANT_INT);
+	check(module_writer_global(&writer, 0, CONSTANT_INT) == count_global, "a variable's global reused");
+	int name_global = module_writer_global(&writer, 0, CONSTANT_STRING);
+	check(name_global != count_global, "globals of different kinds kept apart");
+
+	module_writer_emit(&writer, INSTRUCTION_BX(OP_CONST, 0, answer));
+	module_writer_emit(&writer, INSTRUCTION_BX(OP_CONST, 1, hello));
+	module_writer_emit(&writer, INSTRUCTION(OP_ADD_INT, 2, 0, 0));
+	module_writer_emit(&writer, INSTRUCTION(OP_PRINT_STRING, 1, 0, 0));
+	check(module_writer_export(&writer, intern(&interner, "main"), 0, 0), "export main");
+	check(module_writer_export(&writer, intern(&interner, "helper"), 0, 2), "export helper");
+	check(module_writer_import(&writer, intern(&interner, "lib.cslim")), "import lib.cslim");
+	check(module_writer_import(&writer, intern(&interner, "other/lib.cslim")), "import other/lib.cslim");
+
+	char *written;
+	size_t written_size;
+	FILE *file = open_memstream(&written, &written_size);
+	check(module_writer_write(&writer, file), "write module");
+	fclose(file);
+	char path[32];
+	check(write_temp(written, written_size, path), "write module file");
+
+	struct Module module;
+	if (!check(module_load(&module, path, stderr), "load module")) {
+		check(module.register_count == 3, "register count");
+		check(module.code_count == writer.code.count
+			&& memcmp(module.code, writer.code.items, sizeof(uint32_t) * module.code_count) == 0,
+			"code intact");
+		check(module.code_count == 5 && INSTRUCTION_OP(module.code[4]) == OP_HALT, "code ends with HALT");
+		check(module.constant_count == writer.constants.count
+			&& memcmp(module.constants, writer.constants.items,
+				sizeof(struct ModuleConstant) * module.constant_count) == 0,
+			"constants intact");
+		check(module.constants[answer].kind == CONSTANT_INT && module.constants[answer].int_value == 42,
+			"int constant");
+		check(module.constants[half].kind == CONSTANT_FLOAT && module.constants[half].float_value == 0.5,
+			"float constant");
+		const char *text = module_string(&module, hello);
+		check(text != NULL && strcmp(text, "hello") == 0, "string constant");
+		check(module_string(&module, answer) == NULL, "int constant is not a string");
+		check(module.strings_size == writer.strings.count
+			&& memcmp(module.strings, writer.strings.items, module.strings_size) == 0, "strings intact");
+
+		const struct ModuleExport *main_export = module_find_export(&module, "main", 4);
+		const struct ModuleExport *helper_export = module_find_export(&module, "helper", 6);
+		check(module.export_count == 2, "export count");
+		check(main_export != NULL && main_export->address == 0, "export main intact");
+		check(helper_export != NULL && helper_export->address == 2, "export helper intact");
+		check(module_find_export(&module, "mai", 3) == NULL, "no export of a prefix");
+
+		check(module.import_count == 2, "import count");
+		if (module.import_count == 2) {
+			const char *first = module_string(&module, module.imports[0]);
+			const char *second = module_string(&module, module.imports[1]);
+			check(first != NULL && strcmp(first, "lib.cslim") == 0, "first import intact");
+			check(second != NULL && strcmp(second, "other/lib.cslim") == 0, "second import intact");
+		}
+		check(module.global_count == 2 && module.globals[count_global] == CONSTANT_INT
+			&& module.globals[name_global] == CONSTANT_STRING, "globals intact");
+		module_unload(&module);
+	}
+	remove(path);
+
+	check_rejected(written, written_size, corrupt_version, "incompatible version", "wrong version rejected");
+	check_rejected(written, written_size, corrupt_section_size, "section out of bounds",
+		"section larger than the file rejected");
+	check_rejected(written, written_size, corrupt_section_count, "section records out of bounds",
+		"section with more records than its size rejected");
+
+	free(written);
+	module_writer_deinit(&writer);
+	interner_deinit(&interner);
+	if (failures > 0) {
+		printf("FAILURE! %i module checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("SUCCESS! Module round trip passed\n");
+	return EXIT_SUCCESS;
+}